@@ -23,6 +23,7 @@
 
 #include <sabrSDR/api.h>
 #include <gnuradio/sync_block.h>
+#include <string>
 
 namespace gr {
   namespace sabrSDR {
@@ -44,17 +45,63 @@ namespace gr {
        * constructor is in a private implementation
        * class. sabrSDR::sabr_sink::make is the public interface for
        * creating new instances.
+       *
+       * \param scale Multiplies every input value before it is converted to
+       *        16 bit DAC counts. 1.0 expects input already in counts,
+       *        32767 takes +/-1.0 input. Out of range values saturate.
+       *        Ignored by the integer stream types.
+       * \param streamType Input format: 0 gr_complex, 1 interleaved
+       *        host endian int16 I/Q, 2 interleaved int8 I/Q (sent as the
+       *        top 8 bits), 3 two float inputs with I on the first and Q on
+       *        the second.
+       * \param leadTime Seconds of samples the sink may write ahead of the
+       *        sample clock, buffered in the USB stack and the device. 0
+       *        writes each chunk just as the previous one finishes playing.
+       * \param ringSize Number of samples buffered between the flowgraph
+       *        and the USB writer thread. 0 writes to the device
+       *        synchronously from work() instead.
+       * \param prefill Number of samples buffered before the writer starts
+       *        transmitting, and again after it ran out of samples.
+       *        At least one USB transfer is always waited for.
+       * \param burstMode Only transmit samples between tx_sob and tx_eob
+       *        tags, switching the transmitter on for each burst (at the
+       *        host time in an optional tx_time tag on the tx_sob sample)
+       *        and off once it has played out. Needs ringSize > 0.
+       * \param channelConfig Multiplex mode (IQChannelConfig) to transmit
+       *        with: 0 TX1 only, 4 TX1 and TX2 (R0T2), 5 TX1 to TX3 (R0T3),
+       *        6 TX1 to TX4 (R0T4); the RxTy modes with y > 1 work too.
+       *        Only the number of TX channels is used: the device is put
+       *        in the mode that also carries the RX channels of a source
+       *        sharing it. Each channel takes its own input (its own pair
+       *        of inputs for stream type 3), TX1 first. ringSize and
+       *        prefill count samples per channel.
+       * \param serialNumber Serial number of the SABR to transmit on, for
+       *        hosts with several of them. Empty to use the device a
+       *        source in the same flowgraph already has open, or else the
+       *        first one found.
+       * \param cpuCore CPU to pin the USB writer thread to (the block's
+       *        own thread when ringSize is 0), so several devices each
+       *        keep a core to themselves. -1 to leave it to the OS.
        */
-      static sptr make(double frequency, double sampleRate, float attenuation);
+      static sptr make(double frequency, double sampleRate, float attenuation, float scale = 1.0f, int streamType = 0, float leadTime = 0.0f,
+                       int ringSize = 1048576, int prefill = 65536, bool burstMode = false, int channelConfig = 0,
+                       const std::string& serialNumber = "", int cpuCore = -1);
 
-      virtual double set_sample_rate(double rate, int chan = 1) = 0;
-      virtual double get_sample_rate(int chan = 1) = 0;
+      /*!
+       * The setters queue the change for the device and return the requested
+       * value without waiting for it to be applied. Queued changes to the same
+       * setting are coalesced so only the latest value is sent. \p chan is
+       * the input channel, 0 for TX1 up to 3 for TX4, as for sabr_source.
+       * The sample rate is shared by all channels.
+       */
+      virtual double set_sample_rate(double rate, int chan = 0) = 0;
+      virtual double get_sample_rate(int chan = 0) = 0;
 
-      virtual double set_center_freq(double freq, int chan = 1) = 0;
-      virtual double get_center_freq(int chan = 1) = 0;
+      virtual double set_center_freq(double freq, int chan = 0) = 0;
+      virtual double get_center_freq(int chan = 0) = 0;
 
-      virtual float set_attenuation(float attenuation, int chan = 1 ) = 0;
-      virtual float get_attenuation( int chan = 1 ) = 0;
+      virtual float set_attenuation(float attenuation, int chan = 0) = 0;
+      virtual float get_attenuation(int chan = 0) = 0;
     };
 
   } // namespace sabrSDR
@@ -23,6 +23,8 @@
 
 #include <sabrSDR/api.h>
 #include <gnuradio/sync_block.h>
+#include <string>
+#include <vector>
 
 namespace gr {
   namespace sabrSDR {
@@ -44,9 +46,54 @@ namespace gr {
        * constructor is in a private implementation
        * class. sabrSDR::sabr_source::make is the public interface for
        * creating new instances.
+       *
+       * \param ringSize Number of samples buffered between the USB reader
+       *        thread and the flowgraph. 0 reads the device synchronously
+       *        from work() instead.
+       * \param overflowPolicy What the reader thread does when the buffer
+       *        is full: 0 drops the oldest samples, 1 drops the newest,
+       *        2 blocks the reader (the device itself may then overflow).
+       * \param numTransfers Number of USB reads the reader thread keeps
+       *        queued. 1 issues one read at a time.
+       * \param transferSize Samples per USB read, 0 to pick it from the
+       *        sample rate.
+       * \param scale Multiplies every output value. 1.0 outputs raw ADC
+       *        counts, 1/32768 normalizes to +/-1.0. Ignored by the
+       *        integer stream types.
+       * \param streamType Output format: 0 gr_complex, 1 interleaved
+       *        host endian int16 I/Q, 2 interleaved int8 I/Q (top 8 bits),
+       *        3 two float outputs with I on the first and Q on the second.
+       * \param hopFrequencies LO frequencies to hop through while streaming,
+       *        in order and repeating. Empty to stay on \p frequency.
+       * \param hopDwells Samples to stay on each hop frequency: one value
+       *        for all of them, or one per frequency.
+       * \param hopSettle Samples to discard after each retune, tagged as
+       *        rx_settle next to rx_freq. 0 for no tag.
+       * \param channelConfig RX channels to stream: 0 RX1 only, 1 RX1 and
+       *        RX2, 2 RX1 to RX3, 3 RX1 to RX4. Each channel gets its own
+       *        output (its own pair of outputs for stream type 3), RX1
+       *        first. The hop schedule applies to RX1. ringSize and
+       *        transferSize count samples per channel.
+       * \param serialNumber Serial number of the SABR to stream from, for
+       *        hosts with several of them. Empty to use the device a sink
+       *        in the same flowgraph already has open, or else the first
+       *        one found.
+       * \param cpuCore CPU to pin the USB reader thread to (the block's
+       *        own thread when ringSize is 0), so several devices each
+       *        keep a core to themselves. -1 to leave it to the OS.
        */
-      static sptr make(double frequency, double sampleRate, double gain, int gainMode);
+      static sptr make(double frequency, double sampleRate, double gain, int gainMode, int ringSize = 8388608, int overflowPolicy = 0,
+                       int numTransfers = 4, int transferSize = 0, float scale = 1.0f, int streamType = 0,
+                       const std::vector<double>& hopFrequencies = std::vector<double>(), const std::vector<int>& hopDwells = std::vector<int>(),
+                       int hopSettle = 0, int channelConfig = 0, const std::string& serialNumber = "", int cpuCore = -1);
 
+      /*!
+       * The setters queue the change for the device and return the requested
+       * value without waiting for it to be applied. Queued changes to the same
+       * setting are coalesced so only the latest value is sent. \p chan is
+       * the output channel, 0 for RX1 up to 3 for RX4. The sample rate is
+       * shared by all channels.
+       */
       virtual double set_sample_rate(double rate, int chan = 0) = 0;
       virtual double get_sample_rate(int chan = 0) = 0;
 
@@ -61,6 +108,12 @@ namespace gr {
 
       virtual int set_gain_mode(int gainMode, int chan = 0) = 0;
       virtual int get_gain_mode(int chan = 0) = 0;
+
+      /*!
+       * Replace the hop schedule, see make(). Takes effect right away when
+       * the flowgraph is running. An empty frequency list stops hopping.
+       */
+      virtual void set_hop_schedule(const std::vector<double>& frequencies, const std::vector<int>& dwells, int settle) = 0;
     };
   } // namespace sabrSDR
 } // namespace gr
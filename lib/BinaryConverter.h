@@ -7,16 +7,25 @@ namespace BinaryConverter
 	/// <summary>
 	/// Convert an array of 4 bytes into an unsigned 32 bit integer. (Deserialize)
 	/// </summary>
-	/// <param name="values"></param>
+	/// <param name="values">Big endian bytes.</param>
 	/// <returns></returns>
-	uint32_t ToUInt32(uint8_t* values);
+	constexpr uint32_t ToUInt32(const uint8_t* values)
+	{
+		return ((uint32_t)values[0] << 24) | ((uint32_t)values[1] << 16) | ((uint32_t)values[2] << 8) | (uint32_t)values[3];
+	}
 
 	/// <summary>
-	/// Convert an unsigned 32 bit integer into an array of 4 bytes. (Serialize)
+	/// Convert an unsigned 32 bit integer into 4 big endian bytes. (Serialize)
 	/// </summary>
 	/// <param name="value"></param>
-	/// <returns></returns>
-	uint8_t* GetBytes(uint32_t value);
+	/// <param name="bytesOut">Where the 4 bytes are written.</param>
+	inline void WriteBytes(uint32_t value, uint8_t* bytesOut)
+	{
+		bytesOut[0] = (uint8_t)(value >> 24);
+		bytesOut[1] = (uint8_t)(value >> 16);
+		bytesOut[2] = (uint8_t)(value >> 8);
+		bytesOut[3] = (uint8_t)value;
+	}
 }
 
-#endif
\ No newline at end of file
+#endif
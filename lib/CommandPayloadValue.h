@@ -1,6 +1,7 @@
 #ifndef COMMANDPAYLOADVALUE_H
 #define COMMANDPAYLOADVALUE_H
 #include <cstdint>
+#include "BinaryConverter.h"
 
 namespace THR
 {
@@ -13,54 +14,58 @@ namespace THR
 		uint32_t payloadHigh;
 		uint32_t payloadLow;
 	public:
-		CommandPayloadValue();
-		CommandPayloadValue(bool value);
-		CommandPayloadValue(int value);
-		CommandPayloadValue(uint64_t value);
-		CommandPayloadValue(uint32_t inputPayloadHigh, uint32_t inputPayloadLow);
+		constexpr CommandPayloadValue() : payloadHigh(0), payloadLow(0){}
+		constexpr CommandPayloadValue(bool value) : payloadHigh(0), payloadLow(value ? 1 : 0){}
+		constexpr CommandPayloadValue(int value) : payloadHigh(0), payloadLow((uint32_t)value){}
+		constexpr CommandPayloadValue(uint64_t value) : payloadHigh((uint32_t)(value >> 32)), payloadLow((uint32_t)value){}
+		constexpr CommandPayloadValue(uint32_t inputPayloadHigh, uint32_t inputPayloadLow) : payloadHigh(inputPayloadHigh), payloadLow(inputPayloadLow){}
 
 		/// <summary>
 		/// Get the upper 32 bits of the command payload as an unsigned 32 bit integer.
 		/// </summary>
 		/// <returns></returns>
-		uint32_t GetPayloadHigh();
+		constexpr uint32_t GetPayloadHigh() const { return payloadHigh; }
 
 		/// <summary>
 		/// Get the lower 32 bits of the command payload as an unsigned 32 bit integer.
 		/// </summary>
 		/// <returns></returns>
-		uint32_t GetPayloadLow();
+		constexpr uint32_t GetPayloadLow() const { return payloadLow; }
 
 		/// <summary>
 		/// Get the command payload as an unsigned 64 bit integer.
 		/// </summary>
 		/// <returns></returns>
-		uint64_t GetAsUInt64();
+		constexpr uint64_t GetAsUInt64() const { return ((uint64_t)payloadHigh << 32) | payloadLow; }
 
 		/// <summary>
 		/// Get the command payload as an unsigned 32 bit integer. Same as GetPayloadLow().
 		/// </summary>
 		/// <returns></returns>
-		uint32_t GetAsUInt32();
+		constexpr uint32_t GetAsUInt32() const { return payloadLow; }
 
 		/// <summary>
 		/// Get the command payload as an int.
 		/// </summary>
 		/// <returns></returns>
-		int GetAsInt32();
+		constexpr int GetAsInt32() const { return (int)payloadLow; }
 
 		/// <summary>
 		/// Get the command payload as a boolean.
 		/// </summary>
 		/// <returns></returns>
-		bool GetAsBool();
+		constexpr bool GetAsBool() const { return payloadLow != 0; }
 
 		/// <summary>
-		/// Get the command payload serialized as an array of 8 bytes.
+		/// Serialize the command payload as 8 big endian bytes, high word first.
 		/// </summary>
-		/// <returns></returns>
-		uint8_t* ToSerializedBytes();
+		/// <param name="bytesOut">Where the 8 bytes are written.</param>
+		void Serialize(uint8_t* bytesOut) const
+		{
+			BinaryConverter::WriteBytes(payloadHigh, bytesOut);
+			BinaryConverter::WriteBytes(payloadLow, bytesOut + 4);
+		}
 	};
 }
 
-#endif
\ No newline at end of file
+#endif
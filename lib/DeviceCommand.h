@@ -1,5 +1,6 @@
 #ifndef DEVICECOMMAND_H
 #define DEVICECOMMAND_H
+#include <array>
 #include <cstdint>
 #include "CommandPayloadValue.h"
 #include "SpecsEnums.h"
@@ -81,8 +82,14 @@ namespace THR
 		DeviceNotResponding
 	};
 
+	/// <summary>
+	/// One serialized SABR command frame.
+	/// </summary>
+	typedef std::array<uint8_t, 16> CommandFrame;
+
 	/// <summary>
 	/// An internal struct/class that handles the low level formation/decoding of SABR cmd frames. Not intended to be used directly by users.
+	/// Plain value type; encoding and decoding never allocate.
 	/// </summary>
 	class DeviceCommand
 	{
@@ -99,110 +106,150 @@ namespace THR
 		 * Total: 128b (16 Byte)
 		 * A/N is a device to host field
 		 */
-	private:
+	public:
 		//Header field definitions
-		//                                              || (MARK)
-		const uint32_t PACKET_PREFIX = 0x5A000000;
-		const uint32_t PACKET_SUFFIX = 0xA5000000;
-		const uint32_t DEV_ACK_RESP = 0x00800000;
-		//                                                || (RSVD)
-		const uint32_t SET_CMD_BIT = 0x00008000;
-		const uint32_t GET_CMD_BIT = 0x00000000;
-		// CMD IDs are 11 bit                               ||| (CMD)
-		const uint32_t INIT_CMD_ID = 0x00000010;
-		const uint32_t CAPTURE_IQ_CMD_ID = 0x00000020;
-		const uint32_t LO_CMD_ID = 0x00000030;
-		const uint32_t GAIN_CMD_ID = 0x00000040;
-		const uint32_t GAINMODE_CMD_ID = 0x00000050;
-		const uint32_t BANDWIDTH_CMD_ID = 0x00000060;
-		const uint32_t SAMPLERATE_CMD_ID = 0x00000070;
-		const uint32_t IR_FILTER_CFG_CMD_ID = 0x00000080;
-		const uint32_t TRANSMIT_IQ_CMD_ID = 0x00000090;
-		const uint32_t DEV_STAT_CMD_ID = 0x000000A0;
-		const uint32_t MULTIPLEX_MODE_CMD_ID = 0x000000B0;
-		const uint32_t RESET_CMD_ID = 0x000000C0;
-		const uint32_t REFERENCE_SOURCE_CMD_ID = 0x000000D0;
-		const uint32_t IR_FILTER_USE_CMD_ID = 0x000000E0;
-		const uint32_t AGC_PARAMS_CMD_ID = 0x000000F0;
-		const uint32_t CMD_COUNTER_CMD_ID = 0x00007F80;
-		const uint32_t CHIPSET_CMD_ID = 0x00007F90;
-		const uint32_t FIRMWARE_UPDATE_CMD_ID = 0x00007FA0;
-		const uint32_t TEMPERATURE_CMD_ID = 0x00007FB0;
-		const uint32_t ERM_VERSION_CMD_ID = 0x00007FC0;
-		const uint32_t DEBUG_B_CMD_ID = 0x00007FD0;
-		const uint32_t DEBUG_A_CMD_ID = 0x00007FE0;
-		const uint32_t NOP_CMD_ID = 0x00007FF0;
-		//                                                     | (CH)
+		//                                                  || (MARK)
+		static constexpr uint32_t PACKET_PREFIX = 0x5A000000;
+		static constexpr uint32_t PACKET_SUFFIX = 0xA5000000;
+		static constexpr uint32_t DEV_ACK_RESP = 0x00800000;
+		//                                                    || (RSVD)
+		static constexpr uint32_t SET_CMD_BIT = 0x00008000;
+		static constexpr uint32_t GET_CMD_BIT = 0x00000000;
+		// CMD IDs are 11 bit, the CommandType value shifted left 4 times, see GetCommandIdField()
 		// Mask definitions
-		const uint32_t PACKET_DELIMITER_MASK = 0xFF000000;
-		const uint32_t ACK_NACK_FIELD_MASK = 0x00800000;
-		const uint32_t SET_GET_CMD_FIELD_MASK = 0x00008000;
-		const uint32_t CMD_ID_FIELD_MASK = 0x00007FF0;
-		const uint32_t CMD_CHANNEL_FIELD_MASK = 0x0000000F;
-		const uint32_t CHECKSUM_FIELD_MASK = 0x00FFFFFF;
-		uint32_t header;
-		CommandPayloadValue payloadValue;
-		uint32_t footer;
-		bool isValid;
-		DeviceResponseError responseError;
+		static constexpr uint32_t PACKET_DELIMITER_MASK = 0xFF000000;
+		static constexpr uint32_t ACK_NACK_FIELD_MASK = 0x00800000;
+		static constexpr uint32_t SET_GET_CMD_FIELD_MASK = 0x00008000;
+		static constexpr uint32_t CMD_ID_FIELD_MASK = 0x00007FF0;
+		static constexpr uint32_t CMD_CHANNEL_FIELD_MASK = 0x0000000F;
+		static constexpr uint32_t CHECKSUM_FIELD_MASK = 0x00FFFFFF;
+		static constexpr uint32_t STD_RAW_PACKET_LENGTH_BYTES = 16;
 
 		/// <summary>
-		/// Used to verify that the raw frame from the SABR device is valid. Specifically checks for the frame prefix and suffix, the device ACK, and the checksum.
+		/// true if the device knows the command type.
 		/// </summary>
-		/// <param name="header">The header field word</param>
-		/// <param name="payloadValue">The payload word</param>
-		/// <param name="footer">The footer field word (can be with or without an existing checksum field)</param>
-		/// <param name="responseError">If the returned bool is false, this will tell you more about why it was false.</param>
-		/// <returns>true if it is valid; false otherwise.</returns>
-		bool IsRawPacketValid(uint32_t header, CommandPayloadValue payloadValue, uint32_t footer, DeviceResponseError& responseError);
+		static constexpr bool IsKnownCommandType(CommandType commandType)
+		{
+			return ((uint32_t)commandType >= (uint32_t)CommandType::InitDevice && (uint32_t)commandType <= (uint32_t)CommandType::AGCParams)
+				|| ((uint32_t)commandType >= (uint32_t)CommandType::CmdCounter && (uint32_t)commandType <= (uint32_t)CommandType::Nop);
+		}
+
+		/// <summary>
+		/// The CMD field for a command type. Unknown types encode as a Nop.
+		/// </summary>
+		static constexpr uint32_t GetCommandIdField(CommandType commandType)
+		{
+			return IsKnownCommandType(commandType) ? ((uint32_t)commandType << 4) & CMD_ID_FIELD_MASK : ((uint32_t)CommandType::Nop << 4);
+		}
+
+		/// <summary>
+		/// The header word of a to-device frame.
+		/// </summary>
+		static constexpr uint32_t EncodeHeader(CommandType commandType, RadioChannel radioChannel, bool isSetCommand)
+		{
+			return PACKET_PREFIX | (isSetCommand ? SET_CMD_BIT : GET_CMD_BIT) | GetCommandIdField(commandType) | ((uint32_t)radioChannel & CMD_CHANNEL_FIELD_MASK);
+		}
 
 		/// <summary>
 		/// Note: Not currently implemented just returns a 0 for now!
 		/// Calculates the checksum over the header, payload fields, and the non-checksum portion of the footer.
 		/// </summary>
 		/// <returns>The checksum field to be or'ed with the footer</returns>
-		uint32_t CalculateChecksum(uint32_t header, CommandPayloadValue payloadValue, uint32_t footer);
+		static constexpr uint32_t CalculateChecksum(uint32_t header, CommandPayloadValue payloadValue, uint32_t footer)
+		{
+			return 0x00000000;
+		}
+
+		/// <summary>
+		/// Used to verify that the raw frame from the SABR device is valid. Specifically checks for the checksum, the frame prefix and suffix, and the device ACK.
+		/// </summary>
+		/// <param name="header">The header field word</param>
+		/// <param name="payloadValue">The payload word</param>
+		/// <param name="footer">The footer field word (can be with or without an existing checksum field)</param>
+		/// <returns>Why the frame isn't valid, DeviceResponseError::None if it is.</returns>
+		static constexpr DeviceResponseError CheckRawPacket(uint32_t header, CommandPayloadValue payloadValue, uint32_t footer)
+		{
+			return CalculateChecksum(header, payloadValue, footer) != (CHECKSUM_FIELD_MASK & footer) ? DeviceResponseError::ChecksumFailure
+				: (header & PACKET_DELIMITER_MASK) != PACKET_PREFIX || (footer & PACKET_DELIMITER_MASK) != PACKET_SUFFIX ? DeviceResponseError::FramingError
+				: (header & ACK_NACK_FIELD_MASK) != DEV_ACK_RESP ? DeviceResponseError::NotAcknowledged
+				: DeviceResponseError::None;
+		}
+
+	private:
+		uint32_t header;
+		CommandPayloadValue payloadValue;
+		uint32_t footer;
+		DeviceResponseError responseError;
+
+		constexpr DeviceCommand(uint32_t header, CommandPayloadValue payloadValue, uint32_t footer, DeviceResponseError responseError)
+			: header(header), payloadValue(payloadValue), footer(footer), responseError(responseError){}
+
+		friend constexpr DeviceCommand CreateInvalidResponse(const DeviceCommand& failedDeviceCommand);
 	public:
-		const uint32_t STD_RAW_PACKET_LENGTH_BYTES = 16;
-		DeviceCommand();
-		DeviceCommand(CommandType commandType, RadioChannel radioChannel, bool isSetCommand, CommandPayloadValue payloadValue);
-		DeviceCommand(DeviceCommand& failedDeviceCommand);
-		DeviceCommand(uint32_t header, CommandPayloadValue payloadValue, uint32_t footer);
+		/// <summary>
+		/// An empty, invalid command.
+		/// </summary>
+		constexpr DeviceCommand() : header(0), payloadValue(), footer(0), responseError(DeviceResponseError::DeviceNotResponding){}
+
+		/// <summary>
+		/// A to-device frame. Check IsValid() before sending it.
+		/// </summary>
+		constexpr DeviceCommand(CommandType commandType, RadioChannel radioChannel, bool isSetCommand, CommandPayloadValue payloadValue)
+			: header(EncodeHeader(commandType, radioChannel, isSetCommand)), payloadValue(payloadValue),
+			footer(PACKET_SUFFIX | CalculateChecksum(EncodeHeader(commandType, radioChannel, isSetCommand), payloadValue, PACKET_SUFFIX)),
+			responseError(IsKnownCommandType(commandType) ? DeviceResponseError::None : DeviceResponseError::CommandNotRecognized){}
+
+		/// <summary>
+		/// A from-device frame, validated with CheckRawPacket().
+		/// </summary>
+		constexpr DeviceCommand(uint32_t header, CommandPayloadValue payloadValue, uint32_t footer)
+			: header(header), payloadValue(payloadValue), footer(footer), responseError(CheckRawPacket(header, payloadValue, footer)){}
 
 		/// <summary>
 		/// Determines if this command struct represents a valid and correct command frame. This technically checks different things depending on how the struct was made:
 		/// For a to-device frame
 		///     Checks if the command is a recognized one from the CommandType enum.
 		/// For a from-device frame
-		///     See IsRawPacketValid()
+		///     See CheckRawPacket()
 		/// </summary>
 		/// <param name="responseError">If the returned bool is false, this will tell you more about why it was false.</param>
 		/// <returns>true if it is trustworthy; false otherwise.</returns>
-		bool IsValid(DeviceResponseError& responseError);
+		bool IsValid(DeviceResponseError& deviceResponseError) const
+		{
+			deviceResponseError = responseError;
+			return responseError == DeviceResponseError::None;
+		}
 
 		/// <summary>
 		/// Determines if this command struct represents a set or a get command.
 		/// </summary>
 		/// <returns>true if it is a set command; false for a get command.</returns>
-		bool IsSetCommand();
+		constexpr bool IsSetCommand() const { return (header & SET_GET_CMD_FIELD_MASK) == SET_CMD_BIT; }
 
 		/// <summary>
 		/// Gets the command type of this command struct.
 		/// </summary>
 		/// <returns>The type of command the struct represents.</returns>
-		CommandType GetCommandType();
+		constexpr CommandType GetCommandType() const { return (CommandType)((header & CMD_ID_FIELD_MASK) >> 4); }
+
+		/// <summary>
+		/// Gets the channel field of this command struct.
+		/// </summary>
+		/// <returns>The channel the command applies to.</returns>
+		constexpr int GetRadioChannel() const { return (int)(header & CMD_CHANNEL_FIELD_MASK); }
 
 		/// <summary>
 		/// Used to retrieve the payload value, typically for from-device frames as part of get commands.
 		/// </summary>
 		/// <returns>The payload value this struct contains.</returns>
-		CommandPayloadValue GetPayloadValue();
+		constexpr CommandPayloadValue GetPayloadValue() const { return payloadValue; }
 
 		/// <summary>
-		/// This is used to recreate a DeviceCommand struct from raw bytes (which comes from the device). Be sure to check IsValid() on the returned command before using it.
+		/// Serialize the frame for the device.
 		/// </summary>
-		/// <returns>The recovered command struct.</returns>
-		uint8_t* ToSerializedBytes();
+		/// <param name="frame">Receives the 16 frame bytes.</param>
+		void ToSerializedBytes(uint8_t* frame) const;
+		void ToSerializedBytes(CommandFrame& frame) const { ToSerializedBytes(frame.data()); }
 	};
 
 	/// <summary>
@@ -210,7 +257,10 @@ namespace THR
 	/// </summary>
 	/// <param name="failedDeviceCommand">The original to device command that wasn't responded to.</param>
 	/// <returns>An invalid response DeviceCommand.</returns>
-	DeviceCommand* CreateInvalidResponse(DeviceCommand failedDeviceCommand);
+	constexpr DeviceCommand CreateInvalidResponse(const DeviceCommand& failedDeviceCommand)
+	{
+		return DeviceCommand(failedDeviceCommand.header, failedDeviceCommand.payloadValue, failedDeviceCommand.footer, DeviceResponseError::DeviceNotResponding);
+	}
 
 	/// <summary>
 	/// This serves as the true constructor for commands going to a SABR device. Should check IsValid() afterwards before sending on the command.
@@ -221,14 +271,28 @@ namespace THR
 	/// <param name="payloadValue">A wrapper for containing the various numeric types that would be sent to the device represeting things like frequency, gain, etc.</param>
 	/// <param name="radioCommand">The resulting command. Check the returned bool for its validity.</param>
 	/// <returns>true if the commandType used was recognized; false if it was unrecognized.</returns>
-	bool CreateCommand(CommandType commandType, RadioChannel radioChannel, bool isSetCommand, CommandPayloadValue payloadValue, DeviceCommand*& radioCommand);
+	bool CreateCommand(CommandType commandType, RadioChannel radioChannel, bool isSetCommand, CommandPayloadValue payloadValue, DeviceCommand& radioCommand);
 
 	/// <summary>
 	/// This is used to recreate a DeviceCommand struct from raw bytes (which comes from the device). Be sure to check IsValid() on the returned command before using it.
 	/// </summary>
-	/// <param name="serializedBytes">The command frame bytes sent from the device.</param>
+	/// <param name="serializedBytes">The 16 command frame bytes sent from the device.</param>
 	/// <returns>The recovered command struct.</returns>
-	DeviceCommand* FromSerializedBytes(unsigned char* serializedBytes);
+	constexpr DeviceCommand FromSerializedBytes(const uint8_t* serializedBytes)
+	{
+		return DeviceCommand(BinaryConverter::ToUInt32(serializedBytes),
+			CommandPayloadValue(BinaryConverter::ToUInt32(serializedBytes + 4), BinaryConverter::ToUInt32(serializedBytes + 8)),
+			BinaryConverter::ToUInt32(serializedBytes + 12));
+	}
+
+	// The header table used to be a switch over these; the protocol relies on the IDs staying put
+	static_assert(DeviceCommand::GetCommandIdField(CommandType::InitDevice) == 0x00000010, "InitDevice CMD ID");
+	static_assert(DeviceCommand::GetCommandIdField(CommandType::LOFrequency) == 0x00000030, "LOFrequency CMD ID");
+	static_assert(DeviceCommand::GetCommandIdField(CommandType::AGCParams) == 0x000000F0, "AGCParams CMD ID");
+	static_assert(DeviceCommand::GetCommandIdField(CommandType::CmdCounter) == 0x00007F80, "CmdCounter CMD ID");
+	static_assert(DeviceCommand::GetCommandIdField(CommandType::Nop) == 0x00007FF0, "Nop CMD ID");
+	static_assert(DeviceCommand::GetCommandIdField(CommandType::Unknown) == 0x00007FF0, "Unknown types go out as a Nop");
+	static_assert(DeviceCommand::EncodeHeader(CommandType::SampleRate, RadioChannel::Two, true) == 0x5A008071, "Header layout");
 }
 
-#endif
\ No newline at end of file
+#endif
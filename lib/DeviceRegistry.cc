@@ -0,0 +1,153 @@
+#include "DeviceRegistry.h"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+
+using namespace std;
+using namespace THR;
+
+namespace
+{
+	// Open devices by serial number. Entries are weak so the registry never keeps a device open by itself.
+	// No shared_ptr may be destroyed while registryMutex is held: it could be the last reference, and its deleter takes the lock.
+	mutex registryMutex;
+	map<string, weak_ptr<RadioDevice>> openDevices;
+	// Devices whose last reference has gone but whose handle may still be open. An entry that has expired in openDevices counts as closing too,
+	// since the weak_ptr expires before the deleter gets the lock.
+	set<string> closingDevices;
+	condition_variable deviceClosed;
+	// Last device opened, so reopening "any SABR" after a flowgraph restart can skip enumeration
+	string lastSerialNumber;
+
+	bool IsClosing(const string& serialNumber)
+	{
+		map<string, weak_ptr<RadioDevice>>::iterator entry = openDevices.find(serialNumber);
+		return closingDevices.count(serialNumber) > 0 || (entry != openDevices.end() && entry->second.expired());
+	}
+
+	// Called when the last reference goes. The handle is closed outside the registry lock; Open() of the same serial waits for it instead of
+	// finding the device busy.
+	void CloseSharedDevice(RadioDevice* device)
+	{
+		string serialNumber = device->GetSerialNumber();
+		{
+			lock_guard<mutex> lock(registryMutex);
+			map<string, weak_ptr<RadioDevice>>::iterator entry = openDevices.find(serialNumber);
+			if (entry != openDevices.end() && entry->second.expired())
+			{
+				openDevices.erase(entry);
+			}
+			closingDevices.insert(serialNumber);
+		}
+		device->CloseDevice();
+		delete device;
+		{
+			lock_guard<mutex> lock(registryMutex);
+			closingDevices.erase(serialNumber);
+		}
+		deviceClosed.notify_all();
+	}
+}
+
+shared_ptr<RadioDevice> DeviceRegistry::Open(const string& serialNumber, ErrorFlags& result)
+{
+	unique_lock<mutex> lock(registryMutex);
+	result = ErrorFlags::None;
+	shared_ptr<RadioDevice> device = FindOpenDevice(serialNumber);
+	if (device)
+	{
+		return device;
+	}
+
+	// A serial number we were given or have opened before is taken to be connected, so go straight to it with the fast setup and only fall back to
+	// enumerating and the full setup if that fails
+	unique_ptr<RadioDevice> opening;
+	string openSerialNumber = serialNumber.empty() ? lastSerialNumber : serialNumber;
+	if (!openSerialNumber.empty())
+	{
+		// Someone else may have opened the device while the lock was released for the wait
+		if (WaitForClose(lock, openSerialNumber) && (device = FindOpenDevice(serialNumber)))
+		{
+			return device;
+		}
+		opening.reset(new RadioDevice());
+		result = opening->Setup(openSerialNumber, true);
+		if (ERROR_FLAGS_SUCCESS(result))
+		{
+			return Register(opening, openSerialNumber);
+		}
+		openSerialNumber = serialNumber;
+	}
+
+	opening.reset(new RadioDevice());
+	if (openSerialNumber.empty())
+	{
+		// Pick the first SABR rather than whichever happens to be enumerated last
+		bool isDeviceFound = false;
+		vector<ProductInfo> connectedDevices = opening->GetConnectedDevices(isDeviceFound);
+		if (!isDeviceFound)
+		{
+			result = ErrorFlags::Unsuccessful;
+			return shared_ptr<RadioDevice>();
+		}
+		openSerialNumber = connectedDevices.front().serialNumber;
+	}
+	if (WaitForClose(lock, openSerialNumber) && (device = FindOpenDevice(serialNumber)))
+	{
+		return device;
+	}
+	result = opening->Setup(openSerialNumber);
+	if (ERROR_FLAGS_FAILURE(result))
+	{
+		return shared_ptr<RadioDevice>();
+	}
+	return Register(opening, openSerialNumber);
+}
+
+shared_ptr<RadioDevice> DeviceRegistry::FindOpenDevice(const string& serialNumber)
+{
+	for (map<string, weak_ptr<RadioDevice>>::iterator entry = openDevices.begin(); entry != openDevices.end(); ++entry)
+	{
+		if (!serialNumber.empty() && entry->first != serialNumber)
+		{
+			continue;
+		}
+		// Only kept if it is returned, so it is never released under the lock
+		shared_ptr<RadioDevice> device = entry->second.lock();
+		if (device)
+		{
+			return device;
+		}
+	}
+	return shared_ptr<RadioDevice>();
+}
+
+bool DeviceRegistry::WaitForClose(unique_lock<mutex>& lock, const string& serialNumber)
+{
+	if (!IsClosing(serialNumber))
+	{
+		return false;
+	}
+	deviceClosed.wait(lock, [&serialNumber]() { return !IsClosing(serialNumber); });
+	return true;
+}
+
+shared_ptr<RadioDevice> DeviceRegistry::Register(unique_ptr<RadioDevice>& opened, const string& serialNumber)
+{
+	shared_ptr<RadioDevice> device(opened.release(), CloseSharedDevice);
+	openDevices[serialNumber] = device;
+	lastSerialNumber = serialNumber;
+	return device;
+}
+
+size_t DeviceRegistry::GetOpenDeviceCount()
+{
+	lock_guard<mutex> lock(registryMutex);
+	size_t numOpen = 0;
+	for (map<string, weak_ptr<RadioDevice>>::iterator entry = openDevices.begin(); entry != openDevices.end(); ++entry)
+	{
+		numOpen += entry->second.expired() ? 0 : 1;
+	}
+	return numOpen;
+}
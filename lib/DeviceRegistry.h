@@ -0,0 +1,54 @@
+#ifndef DEVICEREGISTRY_H
+#define DEVICEREGISTRY_H
+#include "RadioDevice.h"
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace THR
+{
+	/// <summary>
+	/// Process-wide set of open SABR devices. Every block asking for the same device gets the same RadioDevice, so a flowgraph pays for the open,
+	/// GPIO and SuperSpeed sequence once per device instead of once per block, and RX and TX can stream over one handle at the same time.
+	/// A device is closed once the last block using it lets go. Which block streams which channels is arbitrated by the device itself, see
+	/// RadioDevice::ClaimReceiveChannels().
+	/// </summary>
+	class DeviceRegistry
+	{
+	public:
+		/// <summary>
+		/// Get a shared device, opening it if nobody has it open yet. If the device is still being closed by its last user this waits for the close.
+		/// </summary>
+		/// <param name="serialNumber">Serial number of the device. Empty for any SABR: one that is already open if there is one, otherwise the last
+		/// one opened by this process if it is still there, otherwise the first one enumerated. A device that is known this way is opened with
+		/// RadioDevice::Setup(std::string, bool)'s fast path, falling back to the full setup if that fails.</param>
+		/// <param name="result">Setup() result if the device had to be opened, None if it already was, Unsuccessful if no SABR was found.</param>
+		/// <returns>The device, or empty if it couldn't be opened.</returns>
+		static std::shared_ptr<RadioDevice> Open(const std::string& serialNumber, ErrorFlags& result);
+
+		/// <summary>
+		/// Number of devices currently open through the registry.
+		/// </summary>
+		static size_t GetOpenDeviceCount();
+
+	private:
+		/// <summary>
+		/// An open device with the given serial number, or any open device for an empty one. Called with the registry lock held.
+		/// </summary>
+		static std::shared_ptr<RadioDevice> FindOpenDevice(const std::string& serialNumber);
+
+		/// <summary>
+		/// Wait until a device that is being closed has let go of its handle, so it can be opened again. Called with the registry lock held, which
+		/// is released while waiting.
+		/// </summary>
+		/// <returns>true if it had to wait, in which case another caller may have opened the device meanwhile.</returns>
+		static bool WaitForClose(std::unique_lock<std::mutex>& lock, const std::string& serialNumber);
+
+		/// <summary>
+		/// Hand a device that was just set up over to shared ownership and record it. Called with the registry lock held.
+		/// </summary>
+		static std::shared_ptr<RadioDevice> Register(std::unique_ptr<RadioDevice>& opened, const std::string& serialNumber);
+	};
+}
+
+#endif
@@ -0,0 +1,140 @@
+#include "DeviceTransport.h"
+#include "VirtualDevice.h"
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+using namespace THR;
+
+const char* const THR::VIRTUAL_DEVICE_ENV = "SABR_VIRTUAL_DEVICE";
+
+FT_STATUS FTD3XXTransport::CreateDeviceInfoList(LPDWORD numDevices)
+{
+	return FT_CreateDeviceInfoList(numDevices);
+}
+
+FT_STATUS FTD3XXTransport::GetDeviceInfoDetail(DWORD index, LPDWORD flags, LPDWORD type, LPDWORD id, LPDWORD locId, LPVOID serialNumber, LPVOID description, FT_HANDLE* handle)
+{
+	return FT_GetDeviceInfoDetail(index, flags, type, id, locId, serialNumber, description, handle);
+}
+
+FT_STATUS FTD3XXTransport::Create(PVOID arg, DWORD flags, FT_HANDLE* handle)
+{
+	return FT_Create(arg, flags, handle);
+}
+
+FT_STATUS FTD3XXTransport::Close(FT_HANDLE handle)
+{
+	return FT_Close(handle);
+}
+
+FT_STATUS FTD3XXTransport::GetDeviceDescriptor(FT_HANDLE handle, PFT_DEVICE_DESCRIPTOR descriptor)
+{
+	return FT_GetDeviceDescriptor(handle, descriptor);
+}
+
+FT_STATUS FTD3XXTransport::GetStringDescriptor(FT_HANDLE handle, UCHAR stringIndex, PFT_STRING_DESCRIPTOR descriptor)
+{
+	return FT_GetStringDescriptor(handle, stringIndex, descriptor);
+}
+
+FT_STATUS FTD3XXTransport::GetConfigurationDescriptor(FT_HANDLE handle, PFT_CONFIGURATION_DESCRIPTOR descriptor)
+{
+	return FT_GetConfigurationDescriptor(handle, descriptor);
+}
+
+FT_STATUS FTD3XXTransport::ReadGPIO(FT_HANDLE handle, DWORD* data)
+{
+	return FT_ReadGPIO(handle, data);
+}
+
+FT_STATUS FTD3XXTransport::EnableGPIO(FT_HANDLE handle, DWORD mask, DWORD direction)
+{
+	return FT_EnableGPIO(handle, mask, direction);
+}
+
+FT_STATUS FTD3XXTransport::WriteGPIO(FT_HANDLE handle, DWORD mask, DWORD level)
+{
+	return FT_WriteGPIO(handle, mask, level);
+}
+
+FT_STATUS FTD3XXTransport::SetGPIOPull(FT_HANDLE handle, DWORD mask, DWORD pull)
+{
+	return FT_SetGPIOPull(handle, mask, pull);
+}
+
+FT_STATUS FTD3XXTransport::CycleDevicePort(FT_HANDLE handle)
+{
+#ifdef _WIN32
+	return FT_CycleDevicePort(handle);
+#else
+	// Not supported by the Linux driver; RadioDevice falls back to a libusb reset instead.
+	return FT_NOT_SUPPORTED;
+#endif
+}
+
+FT_STATUS FTD3XXTransport::SetPipeTimeout(FT_HANDLE handle, UCHAR pipe, DWORD timeoutMs)
+{
+	return FT_SetPipeTimeout(handle, pipe, timeoutMs);
+}
+
+FT_STATUS FTD3XXTransport::WritePipe(FT_HANDLE handle, UCHAR pipe, PUCHAR buffer, ULONG bufferLength, PULONG bytesTransferred, LPOVERLAPPED overlapped)
+{
+	return FT_WritePipe(handle, pipe, buffer, bufferLength, bytesTransferred, overlapped);
+}
+
+FT_STATUS FTD3XXTransport::ReadPipe(FT_HANDLE handle, UCHAR pipe, PUCHAR buffer, ULONG bufferLength, PULONG bytesTransferred, LPOVERLAPPED overlapped)
+{
+	return FT_ReadPipe(handle, pipe, buffer, bufferLength, bytesTransferred, overlapped);
+}
+
+FT_STATUS FTD3XXTransport::InitializeOverlapped(FT_HANDLE handle, LPOVERLAPPED overlapped)
+{
+	return FT_InitializeOverlapped(handle, overlapped);
+}
+
+FT_STATUS FTD3XXTransport::ReleaseOverlapped(FT_HANDLE handle, LPOVERLAPPED overlapped)
+{
+	return FT_ReleaseOverlapped(handle, overlapped);
+}
+
+FT_STATUS FTD3XXTransport::GetOverlappedResult(FT_HANDLE handle, LPOVERLAPPED overlapped, PULONG bytesTransferred, BOOL wait)
+{
+	return FT_GetOverlappedResult(handle, overlapped, bytesTransferred, wait);
+}
+
+FT_STATUS FTD3XXTransport::SetStreamPipe(FT_HANDLE handle, BOOL allWritePipes, BOOL allReadPipes, UCHAR pipe, ULONG streamSize)
+{
+	return FT_SetStreamPipe(handle, allWritePipes, allReadPipes, pipe, streamSize);
+}
+
+FT_STATUS FTD3XXTransport::ClearStreamPipe(FT_HANDLE handle, BOOL allWritePipes, BOOL allReadPipes, UCHAR pipe)
+{
+	return FT_ClearStreamPipe(handle, allWritePipes, allReadPipes, pipe);
+}
+
+FT_STATUS FTD3XXTransport::AbortPipe(FT_HANDLE handle, UCHAR pipe)
+{
+	return FT_AbortPipe(handle, pipe);
+}
+
+FT_STATUS FTD3XXTransport::FlushPipe(FT_HANDLE handle, UCHAR pipe)
+{
+	return FT_FlushPipe(handle, pipe);
+}
+
+FT_STATUS FTD3XXTransport::GetWriteQueueStatus(FT_HANDLE handle, UCHAR fifoId, LPDWORD amountInQueue)
+{
+	return FT_GetWriteQueueStatus(handle, fifoId, amountInQueue);
+}
+
+shared_ptr<DeviceTransport> THR::CreateDeviceTransport()
+{
+	const char* virtualArgs = getenv(VIRTUAL_DEVICE_ENV);
+	if (virtualArgs != NULL)
+	{
+		cout << "Using virtual SABR device (" << VIRTUAL_DEVICE_ENV << "=" << virtualArgs << ")" << endl;
+		return GetVirtualDeviceTransport(VirtualDeviceConfig::FromString(virtualArgs));
+	}
+	return make_shared<FTD3XXTransport>();
+}
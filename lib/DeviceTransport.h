@@ -0,0 +1,89 @@
+#ifndef DEVICETRANSPORT_H
+#define DEVICETRANSPORT_H
+#include "ftd3xx.h"
+#include <memory>
+
+namespace THR
+{
+	/// <summary>
+	/// Abstraction over the FTD3XX calls used by RadioDevice. Every method mirrors the FT_* function of the same name (minus the prefix)
+	/// and returns an FT_STATUS so RadioDevice can treat the real driver and the virtual SABR exactly the same way.
+	/// </summary>
+	class DeviceTransport
+	{
+	public:
+		virtual ~DeviceTransport() {}
+
+		virtual FT_STATUS CreateDeviceInfoList(LPDWORD numDevices) = 0;
+		virtual FT_STATUS GetDeviceInfoDetail(DWORD index, LPDWORD flags, LPDWORD type, LPDWORD id, LPDWORD locId, LPVOID serialNumber, LPVOID description, FT_HANDLE* handle) = 0;
+		virtual FT_STATUS Create(PVOID arg, DWORD flags, FT_HANDLE* handle) = 0;
+		virtual FT_STATUS Close(FT_HANDLE handle) = 0;
+		virtual FT_STATUS GetDeviceDescriptor(FT_HANDLE handle, PFT_DEVICE_DESCRIPTOR descriptor) = 0;
+		virtual FT_STATUS GetStringDescriptor(FT_HANDLE handle, UCHAR stringIndex, PFT_STRING_DESCRIPTOR descriptor) = 0;
+		virtual FT_STATUS GetConfigurationDescriptor(FT_HANDLE handle, PFT_CONFIGURATION_DESCRIPTOR descriptor) = 0;
+		virtual FT_STATUS ReadGPIO(FT_HANDLE handle, DWORD* data) = 0;
+		virtual FT_STATUS EnableGPIO(FT_HANDLE handle, DWORD mask, DWORD direction) = 0;
+		virtual FT_STATUS WriteGPIO(FT_HANDLE handle, DWORD mask, DWORD level) = 0;
+		virtual FT_STATUS SetGPIOPull(FT_HANDLE handle, DWORD mask, DWORD pull) = 0;
+		virtual FT_STATUS CycleDevicePort(FT_HANDLE handle) = 0;
+		virtual FT_STATUS SetPipeTimeout(FT_HANDLE handle, UCHAR pipe, DWORD timeoutMs) = 0;
+		virtual FT_STATUS WritePipe(FT_HANDLE handle, UCHAR pipe, PUCHAR buffer, ULONG bufferLength, PULONG bytesTransferred, LPOVERLAPPED overlapped) = 0;
+		virtual FT_STATUS ReadPipe(FT_HANDLE handle, UCHAR pipe, PUCHAR buffer, ULONG bufferLength, PULONG bytesTransferred, LPOVERLAPPED overlapped) = 0;
+		virtual FT_STATUS InitializeOverlapped(FT_HANDLE handle, LPOVERLAPPED overlapped) = 0;
+		virtual FT_STATUS ReleaseOverlapped(FT_HANDLE handle, LPOVERLAPPED overlapped) = 0;
+		virtual FT_STATUS GetOverlappedResult(FT_HANDLE handle, LPOVERLAPPED overlapped, PULONG bytesTransferred, BOOL wait) = 0;
+		virtual FT_STATUS SetStreamPipe(FT_HANDLE handle, BOOL allWritePipes, BOOL allReadPipes, UCHAR pipe, ULONG streamSize) = 0;
+		virtual FT_STATUS ClearStreamPipe(FT_HANDLE handle, BOOL allWritePipes, BOOL allReadPipes, UCHAR pipe) = 0;
+		virtual FT_STATUS AbortPipe(FT_HANDLE handle, UCHAR pipe) = 0;
+		virtual FT_STATUS FlushPipe(FT_HANDLE handle, UCHAR pipe) = 0;
+		virtual FT_STATUS GetWriteQueueStatus(FT_HANDLE handle, UCHAR fifoId, LPDWORD amountInQueue) = 0;
+
+		/// <summary>
+		/// True if this transport talks to a simulated device rather than real hardware.
+		/// </summary>
+		virtual bool IsVirtual() const { return false; }
+	};
+
+	/// <summary>
+	/// Pass-through to the FTDI D3XX driver.
+	/// </summary>
+	class FTD3XXTransport : public DeviceTransport
+	{
+	public:
+		FT_STATUS CreateDeviceInfoList(LPDWORD numDevices);
+		FT_STATUS GetDeviceInfoDetail(DWORD index, LPDWORD flags, LPDWORD type, LPDWORD id, LPDWORD locId, LPVOID serialNumber, LPVOID description, FT_HANDLE* handle);
+		FT_STATUS Create(PVOID arg, DWORD flags, FT_HANDLE* handle);
+		FT_STATUS Close(FT_HANDLE handle);
+		FT_STATUS GetDeviceDescriptor(FT_HANDLE handle, PFT_DEVICE_DESCRIPTOR descriptor);
+		FT_STATUS GetStringDescriptor(FT_HANDLE handle, UCHAR stringIndex, PFT_STRING_DESCRIPTOR descriptor);
+		FT_STATUS GetConfigurationDescriptor(FT_HANDLE handle, PFT_CONFIGURATION_DESCRIPTOR descriptor);
+		FT_STATUS ReadGPIO(FT_HANDLE handle, DWORD* data);
+		FT_STATUS EnableGPIO(FT_HANDLE handle, DWORD mask, DWORD direction);
+		FT_STATUS WriteGPIO(FT_HANDLE handle, DWORD mask, DWORD level);
+		FT_STATUS SetGPIOPull(FT_HANDLE handle, DWORD mask, DWORD pull);
+		FT_STATUS CycleDevicePort(FT_HANDLE handle);
+		FT_STATUS SetPipeTimeout(FT_HANDLE handle, UCHAR pipe, DWORD timeoutMs);
+		FT_STATUS WritePipe(FT_HANDLE handle, UCHAR pipe, PUCHAR buffer, ULONG bufferLength, PULONG bytesTransferred, LPOVERLAPPED overlapped);
+		FT_STATUS ReadPipe(FT_HANDLE handle, UCHAR pipe, PUCHAR buffer, ULONG bufferLength, PULONG bytesTransferred, LPOVERLAPPED overlapped);
+		FT_STATUS InitializeOverlapped(FT_HANDLE handle, LPOVERLAPPED overlapped);
+		FT_STATUS ReleaseOverlapped(FT_HANDLE handle, LPOVERLAPPED overlapped);
+		FT_STATUS GetOverlappedResult(FT_HANDLE handle, LPOVERLAPPED overlapped, PULONG bytesTransferred, BOOL wait);
+		FT_STATUS SetStreamPipe(FT_HANDLE handle, BOOL allWritePipes, BOOL allReadPipes, UCHAR pipe, ULONG streamSize);
+		FT_STATUS ClearStreamPipe(FT_HANDLE handle, BOOL allWritePipes, BOOL allReadPipes, UCHAR pipe);
+		FT_STATUS AbortPipe(FT_HANDLE handle, UCHAR pipe);
+		FT_STATUS FlushPipe(FT_HANDLE handle, UCHAR pipe);
+		FT_STATUS GetWriteQueueStatus(FT_HANDLE handle, UCHAR fifoId, LPDWORD amountInQueue);
+	};
+
+	/// <summary>
+	/// Name of the environment variable that switches RadioDevice over to the virtual SABR. See VirtualDeviceConfig for the accepted value.
+	/// </summary>
+	extern const char* const VIRTUAL_DEVICE_ENV;
+
+	/// <summary>
+	/// Create the transport a RadioDevice should use. Returns the virtual SABR if VIRTUAL_DEVICE_ENV is set, the FTDI driver otherwise.
+	/// </summary>
+	std::shared_ptr<DeviceTransport> CreateDeviceTransport();
+}
+
+#endif
@@ -5,18 +5,40 @@
 #include <libusb-1.0/libusb.h>
 #include <thread>
 #endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "RadioDevice.h"
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 
 using namespace std;
 using namespace THR;
 
+RadioDevice::RadioDevice() : transport(CreateDeviceTransport())
+{
+}
+
+RadioDevice::RadioDevice(shared_ptr<DeviceTransport> deviceTransport) : transport(deviceTransport)
+{
+}
+
+RadioDevice::~RadioDevice()
+{
+	StopHopSchedule();
+	StopAsyncCommands();
+	StopReceiveStream();
+	StopTransmitStream();
+}
+
 vector<ProductInfo> RadioDevice::GetConnectedDevices(bool& deviceFound)
 {
 	deviceFound = false;
 	vector<ProductInfo> foundSABRDevices;
 	DWORD numDevices;
-	ftStatus = FT_CreateDeviceInfoList(&numDevices);
+	ftStatus = transport->CreateDeviceInfoList(&numDevices);
 	if (CHECK_DEVICE_STATUS(ftStatus))
 	{
 		cout << "Detected " << numDevices << " connected FTDI device(s)!" << endl;
@@ -36,7 +58,7 @@ vector<ProductInfo> RadioDevice::GetConnectedDevices(bool& deviceFound)
 			char description[32] = { 0 };
 			for (DWORD i = 0; i < numDevices; i++)
 			{
-				ftStatus = FT_GetDeviceInfoDetail(i, NULL, NULL, NULL, NULL, serialNumber, description, &ftHandle);
+				ftStatus = transport->GetDeviceInfoDetail(i, NULL, NULL, NULL, NULL, serialNumber, description, &ftHandle);
 				if (!FT_FAILED(ftStatus))
 				{
 					string currSerialNumber = serialNumber;
@@ -44,6 +66,7 @@ vector<ProductInfo> RadioDevice::GetConnectedDevices(bool& deviceFound)
 					{
 						ProductInfo currInfo(currSerialNumber, (string)description);
 						foundSABRDevices.push_back(currInfo);
+						cout << "Found SABR device " << currSerialNumber << " (" << description << ")" << endl;
 						// We will just make the assumption initially that only one device is connected and set the serail number used
 						// for setup to this device. If there are multiple then this will be set to whichever device is last in the enumeration...
 						// To select a specific device then GetConnectedDevices should be used followed by the Setup function that takes in the serial number as 
@@ -63,7 +86,34 @@ vector<ProductInfo> RadioDevice::GetConnectedDevices(bool& deviceFound)
 	return foundSABRDevices;
 }
 
-ErrorFlags RadioDevice::DeviceSetup()
+const char* const THR::SETUP_TIMING_ENV = "SABR_SETUP_TIMING";
+
+static void PrintSetupTiming(const string& serialNumber, const SetupTiming& timing)
+{
+	const double NS_PER_MS = 1e6;
+	cout << "SABR " << serialNumber << (timing.isFastOpen ? " fast" : "") << " setup took " << timing.totalNs / NS_PER_MS << " ms (enumerate "
+		<< timing.enumerateNs / NS_PER_MS << ", open " << timing.openNs / NS_PER_MS << ", descriptors " << timing.descriptorNs / NS_PER_MS << ", GPIO "
+		<< timing.gpioNs / NS_PER_MS << ", USB 3.0 " << timing.superSpeedNs / NS_PER_MS << ", timeouts " << timing.timeoutsNs / NS_PER_MS << ")" << endl;
+}
+
+ErrorFlags RadioDevice::DeviceSetup(uint64_t setupStartNs)
+{
+	ErrorFlags resultFlags = DeviceSetupPhases();
+	if (ERROR_FLAGS_FAILURE(resultFlags) && deviceHandle != NULL)
+	{
+		// Don't keep a half set up device open, or retrying the setup (or the fast path falling back to the full one) finds it busy
+		transport->Close(deviceHandle);
+		deviceHandle = NULL;
+	}
+	setupTiming.totalNs = TransmitPacer::GetMonotonicNs() - setupStartNs;
+	if (getenv(SETUP_TIMING_ENV) != NULL)
+	{
+		PrintSetupTiming(attachedSerialNumber, setupTiming);
+	}
+	return resultFlags;
+}
+
+ErrorFlags RadioDevice::DeviceSetupPhases()
 {
 	// If there is a device detected attempt to open it
 	ErrorFlags resultFlags = OpenDevice();
@@ -73,17 +123,29 @@ ErrorFlags RadioDevice::DeviceSetup()
 		return ErrorFlags::Unsuccessful;
 	}
 
-	// Setup the GPIO pins
-	resultFlags = SetupGPIO();
-	if (resultFlags != ErrorFlags::None)
+	// Setup the GPIO pins. The GPIO only drives the SuperSpeed mux and the FPGA reset, and a device that came up at USB 3.0 has been through
+	// this before, so the fast path leaves it alone.
+	uint64_t phaseStartNs = TransmitPacer::GetMonotonicNs();
+	if (!isFastOpen || !isUSB3)
 	{
-		cout << "Failed to setup GPIO!" << endl;
-		return ErrorFlags::Unsuccessful;
+		resultFlags = SetupGPIO();
+		setupTiming.gpioNs = TransmitPacer::GetMonotonicNs() - phaseStartNs;
+		if (resultFlags != ErrorFlags::None)
+		{
+			cout << "Failed to setup GPIO!" << endl;
+			return ErrorFlags::Unsuccessful;
+		}
 	}
 
 	if (!isUSB3)
 	{
+		// SetupSuperSpeed() reopens the device; keep the first open's timings and count the reopen towards its own phase
+		SetupTiming firstOpenTiming = setupTiming;
+		phaseStartNs = TransmitPacer::GetMonotonicNs();
 		resultFlags = SetupSuperSpeed();
+		setupTiming.superSpeedNs = TransmitPacer::GetMonotonicNs() - phaseStartNs;
+		setupTiming.openNs = firstOpenTiming.openNs;
+		setupTiming.descriptorNs = firstOpenTiming.descriptorNs;
 		if (resultFlags != None || !isUSB3)
 		{
 			cout << "Failed to get USB 3.0 speeds.\nPlease make sure a USB 3.0 port and cable are used!\nIf problems still persist try flipping the connector and trying again!" << endl;
@@ -99,56 +161,94 @@ ErrorFlags RadioDevice::DeviceSetup()
 	}
 
 	// Set the pipe timeouts
+	phaseStartNs = TransmitPacer::GetMonotonicNs();
 	resultFlags = SetTimeouts();
+	setupTiming.timeoutsNs = TransmitPacer::GetMonotonicNs() - phaseStartNs;
 	if (resultFlags != ErrorFlags::None)
 	{
 		cout << "Failed to set pipe timeouts!" << endl;
 		return ErrorFlags::Unsuccessful;
 	}
+	InvalidateSettingsCache();
 	isSetup = true;
 	return ErrorFlags::None;
 }
 
 ErrorFlags RadioDevice::CloseDevice()
 {
-	ftStatus = FT_Close(deviceHandle);
+	// Nothing may still be talking to the handle once it is closed, and the handler may reference whoever is closing us
+	StopHopSchedule();
+	StopAsyncCommands();
+	// The stream threads own the IQ pipes until they are stopped
+	StopReceiveStream();
+	StopTransmitStream();
+	{
+		lock_guard<mutex> lock(completionHandlerMutex);
+		completionHandlers.clear();
+	}
+	InvalidateSettingsCache();
+	ftStatus = transport->Close(deviceHandle);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		cout << "Couldn't close device. Error Code: " << ftStatus << endl;
 		return ErrorFlags::Unsuccessful;
 	}
+	deviceHandle = NULL;
 	return ErrorFlags::None;
 }
 
 ErrorFlags RadioDevice::Setup()
 {
+	uint64_t setupStartNs = TransmitPacer::GetMonotonicNs();
+	setupTiming = SetupTiming();
+	isFastOpen = false;
 	// First check if there are any connected devices
 	bool deviceFound = false;
 	vector<ProductInfo> connectedDevices = GetConnectedDevices(deviceFound);
+	setupTiming.enumerateNs = TransmitPacer::GetMonotonicNs() - setupStartNs;
 	if (!deviceFound)
 	{
 		return ErrorFlags::Unsuccessful;
 	}
 
-	return DeviceSetup();
+	return DeviceSetup(setupStartNs);
 }
 
 ErrorFlags RadioDevice::Setup(string deviceSerialNumber)
 {
+	return Setup(deviceSerialNumber, false);
+}
+
+ErrorFlags RadioDevice::Setup(string deviceSerialNumber, bool isFastOpen)
+{
+	uint64_t setupStartNs = TransmitPacer::GetMonotonicNs();
+	setupTiming = SetupTiming();
+	setupTiming.isFastOpen = isFastOpen;
+	this->isFastOpen = isFastOpen;
 	attachedSerialNumber = deviceSerialNumber;
-	return DeviceSetup();
+	return DeviceSetup(setupStartNs);
+}
+
+SetupTiming RadioDevice::GetSetupTiming() const
+{
+	return setupTiming;
 }
 
 ErrorFlags RadioDevice::OpenDevice()
 {
 	// This is a little smarter way to do it where we will get the first connected FTDI device that has a known serial number prefix
-	ftStatus = FT_Create((PVOID)attachedSerialNumber.c_str(), FT_OPEN_BY_SERIAL_NUMBER, &deviceHandle);
+	uint64_t phaseStartNs = TransmitPacer::GetMonotonicNs();
+	ftStatus = transport->Create((PVOID)attachedSerialNumber.c_str(), FT_OPEN_BY_SERIAL_NUMBER, &deviceHandle);
+	setupTiming.openNs = TransmitPacer::GetMonotonicNs() - phaseStartNs;
 	if (CHECK_DEVICE_STATUS(ftStatus))
 	{
+		phaseStartNs = TransmitPacer::GetMonotonicNs();
 		GetDescriptors();
+		setupTiming.descriptorNs = TransmitPacer::GetMonotonicNs() - phaseStartNs;
 	}
 	else
 	{
+		deviceHandle = NULL;
 		return ErrorFlags::Unsuccessful;
 	}
 	return ErrorFlags::None;
@@ -159,7 +259,7 @@ ErrorFlags RadioDevice::GetDescriptors()
 	// Now we need to try to initialize and get descriptors
 	FT_DEVICE_DESCRIPTOR deviceDescriptor;
 	// @TODO replace with the generic FT_GetDescriptor call
-	ftStatus = FT_GetDeviceDescriptor(deviceHandle, &deviceDescriptor);
+	ftStatus = transport->GetDeviceDescriptor(deviceHandle, &deviceDescriptor);
 	if (CHECK_DEVICE_STATUS(ftStatus))
 	{
 		// For this particular command there is a bug
@@ -169,21 +269,25 @@ ErrorFlags RadioDevice::GetDescriptors()
 	uwVID = deviceDescriptor.idVendor;
 	uwPID = deviceDescriptor.idProduct;
 	isUSB3 = deviceDescriptor.bcdUSB >= 0x0300;
+	if (isFastOpen)
+	{
+		return ErrorFlags::None;
+	}
 
 	// Get string descriptors
 	// We don't really need to do anything with these so consider removal
 	FT_STRING_DESCRIPTOR manufacturer;
-	ftStatus = FT_GetStringDescriptor(deviceHandle, 1, &manufacturer);
+	ftStatus = transport->GetStringDescriptor(deviceHandle, 1, &manufacturer);
 
 	FT_STRING_DESCRIPTOR product;
-	ftStatus = FT_GetStringDescriptor(deviceHandle, 2, &product);
+	ftStatus = transport->GetStringDescriptor(deviceHandle, 2, &product);
 
 	FT_STRING_DESCRIPTOR serialNumber;
-	ftStatus = FT_GetStringDescriptor(deviceHandle, 3, &serialNumber);
+	ftStatus = transport->GetStringDescriptor(deviceHandle, 3, &serialNumber);
 
 	// Now try to get configuration descriptor
 	FT_CONFIGURATION_DESCRIPTOR configDescriptor;
-	ftStatus = FT_GetConfigurationDescriptor(deviceHandle, &configDescriptor);
+	ftStatus = transport->GetConfigurationDescriptor(deviceHandle, &configDescriptor);
 
 	return ErrorFlags::None;
 }
@@ -195,7 +299,7 @@ ErrorFlags RadioDevice::SetupGPIO()
 	// If the read in value is a 5 then we can skip this whole procedure. Trying to setup when this value is a 5 has been determined to cause many issues
 	// and causes the device to enter into a state in which it can't be reset and must be unplugged and plugged back in.
 	DWORD pulData = 0;
-	ftStatus = FT_ReadGPIO(deviceHandle, &pulData);
+	ftStatus = transport->ReadGPIO(deviceHandle, &pulData);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		cout << "Couldn't read GPIO values. Error Code: " << ftStatus << endl;
@@ -209,7 +313,7 @@ ErrorFlags RadioDevice::SetupGPIO()
 	// Setup defaults for the GPIO - GPIO0 is for USB SS Mux Control, GPIO1 is for FPGA PRGM_B (reset) as of SABR Micro Rev. B.
 	// Sets both GPIO as outputs (Bits 1 and 0).
 	uint32_t directionValues = (FT_GPIO_DIRECTION_OUT << FT_GPIO_1) | (FT_GPIO_DIRECTION_OUT << FT_GPIO_0);
-	ftStatus = FT_EnableGPIO(deviceHandle, FT_GPIO_ALL, directionValues);
+	ftStatus = transport->EnableGPIO(deviceHandle, FT_GPIO_ALL, directionValues);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		cout << "Couldn't set GPIO as outputs. Error Code: " << ftStatus << endl;	
@@ -218,7 +322,7 @@ ErrorFlags RadioDevice::SetupGPIO()
 
 	// GPIO0 AND GPIO1 should be outputting '0'.
 	uint32_t outputDefaultValues = 0x00000000;
-	ftStatus = FT_WriteGPIO(deviceHandle, FT_GPIO_ALL, outputDefaultValues);
+	ftStatus = transport->WriteGPIO(deviceHandle, FT_GPIO_ALL, outputDefaultValues);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		cout << "Couldn't set GPIO values. Error Code: " << ftStatus << endl;
@@ -227,7 +331,7 @@ ErrorFlags RadioDevice::SetupGPIO()
 
 	// Setup GPIO0 and GPIO1 as pull-down
 	uint32_t pullValues = 0x00000000;
-	ftStatus = FT_SetGPIOPull(deviceHandle, FT_GPIO_ALL, pullValues);
+	ftStatus = transport->SetGPIOPull(deviceHandle, FT_GPIO_ALL, pullValues);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		cout << "Couldn't set GPIO keepers. Error Code: " << ftStatus << endl;
@@ -236,45 +340,81 @@ ErrorFlags RadioDevice::SetupGPIO()
 	return ErrorFlags::None;
 }
 
-// Attempts to reset the SABR USB to help acheive USB 3.0 speeds since FTDI's CycleDevicePort isn't supported on Linux
-ErrorFlags LinuxUSBReset()
+#ifndef _WIN32
+// Hotplug callback for LinuxUSBReset(): flags that the FT601 is back. Returning 1 deregisters the callback.
+static int LIBUSB_CALL OnFT601Arrived(libusb_context* ctx, libusb_device* device, libusb_hotplug_event event, void* userData)
+{
+	*(int*)userData = 1;
+	return 1;
+}
+
+// Attempts to reset the SABR USB to help acheive USB 3.0 speeds since FTDI's CycleDevicePort isn't supported on Linux.
+// If the reset makes the device re-enumerate, waits (up to timeoutMs) for it to arrive again so it can be reopened right away.
+// Without hotplug support in libusb this returns straight after the reset and the caller's reopen poll does the waiting.
+static ErrorFlags LinuxUSBReset(uint32_t timeoutMs)
 {
-	libusb_device** devs; //pointer to pointer of device, used to retrieve a list of devices
-	libusb_device_handle* dev_handle; //a device handle
-	libusb_context* ctx = NULL; //a libusb session
-	int r; //for return values
-	ssize_t cnt; //holding number of devices in list
-	r = libusb_init(&ctx); // initialize the library for the session we just declared
-	if (r < 0) {
+	libusb_context* ctx = NULL;
+	int r = libusb_init(&ctx);
+	if (r < 0)
+	{
 		cout << "Init Error " << r << endl;
 		return ErrorFlags::Unsuccessful;
 	}
-	libusb_set_debug(ctx, 3); //set verbosity level to 3, as suggested in the documentation
+	libusb_set_debug(ctx, 3);
 
-	cnt = libusb_get_device_list(ctx, &devs); //get the list of devices
-	if (cnt < 0) {
+	// Register before resetting so an arrival can't slip in between
+	int isArrived = 0;
+	libusb_hotplug_callback_handle arrivedCallback;
+	bool isHotplugRegistered = libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) && libusb_hotplug_register_callback(ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED,
+		LIBUSB_HOTPLUG_NO_FLAGS, 0x0403, 0x601f, LIBUSB_HOTPLUG_MATCH_ANY, OnFT601Arrived, &isArrived, &arrivedCallback) == LIBUSB_SUCCESS;
+
+	libusb_device** devs;
+	ssize_t cnt = libusb_get_device_list(ctx, &devs);
+	if (cnt < 0)
+	{
 		cout << "Get Device Error" << endl;
+		libusb_exit(ctx);
 		return ErrorFlags::Unsuccessful;
 	}
 
-	for (size_t idx = 0; idx < cnt; ++idx) {
+	bool isReenumerating = false;
+	for (ssize_t idx = 0; idx < cnt; ++idx)
+	{
 		libusb_device* device = devs[idx];
 		libusb_device_descriptor desc = { 0 };
-
-		int rc = libusb_get_device_descriptor(device, &desc);
 		// Look for our device in particular
-		if (desc.idVendor == 0x0403 && desc.idProduct == 0x601f)
+		if (libusb_get_device_descriptor(device, &desc) == LIBUSB_SUCCESS && desc.idVendor == 0x0403 && desc.idProduct == 0x601f)
 		{
 			cout << "Reseting FT601" << endl;
-			libusb_device_handle* handle;
-			handle = libusb_open_device_with_vid_pid(NULL, desc.idVendor, desc.idProduct);
-			libusb_reset_device(handle);
-			// Wait for the device to come back online
-			std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+			libusb_device_handle* handle = NULL;
+			if (libusb_open(device, &handle) == LIBUSB_SUCCESS)
+			{
+				// NOT_FOUND means the device dropped off the bus to come back as a new device, which is what a speed change looks like.
+				// On success it came back as the same device and is usable straight away.
+				isReenumerating |= libusb_reset_device(handle) == LIBUSB_ERROR_NOT_FOUND;
+				libusb_close(handle);
+			}
 		}
 	}
+	libusb_free_device_list(devs, 1);
+
+	if (isHotplugRegistered)
+	{
+		chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+		while (isReenumerating && !isArrived && chrono::steady_clock::now() < deadline)
+		{
+			timeval eventTimeout = { 0, 50000 };
+			libusb_handle_events_timeout_completed(ctx, &eventTimeout, &isArrived);
+		}
+		if (!isArrived)
+		{
+			libusb_hotplug_deregister_callback(ctx, arrivedCallback);
+		}
+	}
+	libusb_exit(ctx);
 	return ErrorFlags::None;
 }
+#endif
 
 ErrorFlags RadioDevice::SetupSuperSpeed()
 {
@@ -283,7 +423,8 @@ ErrorFlags RadioDevice::SetupSuperSpeed()
 		return ErrorFlags::None;
 	}
 	cout << "Attempting to get USB 3.0 speeds..." << endl;
-	ftStatus = FT_WriteGPIO(deviceHandle, 0x01, 0x01);
+	chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(REOPEN_TIMEOUT_MS);
+	ftStatus = transport->WriteGPIO(deviceHandle, 0x01, 0x01);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		cout << "Couldn't set GPIO0 output value. Error Code: " << ftStatus << endl;
@@ -291,7 +432,7 @@ ErrorFlags RadioDevice::SetupSuperSpeed()
 	}
 
 #ifdef _WIN32
-	ftStatus = FT_CycleDevicePort(deviceHandle);
+	ftStatus = transport->CycleDevicePort(deviceHandle);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		cout << "Couldn't cycle dev port. Error Code: " << ftStatus << endl;
@@ -300,30 +441,32 @@ ErrorFlags RadioDevice::SetupSuperSpeed()
 #else
 	cout << "Consider flipping the USB-C connector!" << endl;
 	cout << "Device occasionally behaves unexpectly when connector is plugged in with the current orientation." << endl;
-	if (ERROR_FLAGS_FAILURE(LinuxUSBReset()))
+	if (ERROR_FLAGS_FAILURE(LinuxUSBReset(REOPEN_TIMEOUT_MS)))
 	{
 		return ErrorFlags::Unsuccessful;
 	}
 #endif
 
-	ftStatus = FT_Close(deviceHandle);
+	ftStatus = transport->Close(deviceHandle);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		cout << "Couldn't close device. Error Code: " << ftStatus << endl;
 		return ErrorFlags::Unsuccessful;
 	}
+	deviceHandle = NULL;
 
-	// We will try to reopen the device for at max 3 seconds after we close it
-	auto start = chrono::system_clock::now();
-	chrono::duration<double> elapsedSeconds;
+	// Reopen as soon as the driver lists the device again. The poll interval doubles from REOPEN_MIN_POLL_MS so a quick re-enumeration is
+	// picked up right away without hammering FT_Create through a slow one.
+	uint32_t pollMs = REOPEN_MIN_POLL_MS;
 	ErrorFlags result = OpenDevice();
 	while (result != ErrorFlags::None)
 	{
-		elapsedSeconds = chrono::system_clock::now() - start;
-		if (elapsedSeconds.count() > 3.0)
+		if (chrono::steady_clock::now() + chrono::milliseconds(pollMs) > deadline)
 		{
 			return ErrorFlags::Unsuccessful;
 		}
+		this_thread::sleep_for(chrono::milliseconds(pollMs));
+		pollMs = min(pollMs * 2, REOPEN_MAX_POLL_MS);
 		result = OpenDevice();
 	}
 	if (isUSB3)
@@ -335,22 +478,22 @@ ErrorFlags RadioDevice::SetupSuperSpeed()
 
 ErrorFlags RadioDevice::SetTimeouts()
 {
-	ftStatus = FT_SetPipeTimeout(deviceHandle, CMD_READ_PIPE, CMD_PIPE_TIMEOUT_MS);
+	ftStatus = transport->SetPipeTimeout(deviceHandle, CMD_READ_PIPE, CMD_PIPE_TIMEOUT_MS);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		return ErrorFlags::Unsuccessful;
 	}
-	ftStatus = FT_SetPipeTimeout(deviceHandle, CMD_WRITE_PIPE, CMD_PIPE_TIMEOUT_MS);
+	ftStatus = transport->SetPipeTimeout(deviceHandle, CMD_WRITE_PIPE, CMD_PIPE_TIMEOUT_MS);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		return ErrorFlags::Unsuccessful;
 	}
-	ftStatus = FT_SetPipeTimeout(deviceHandle, IQ_READ_PIPE, IQ_PIPE_TIMEOUT_MS);
+	ftStatus = transport->SetPipeTimeout(deviceHandle, IQ_READ_PIPE, IQ_PIPE_TIMEOUT_MS);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		return ErrorFlags::Unsuccessful;
 	}
-	ftStatus = FT_SetPipeTimeout(deviceHandle, IQ_WRITE_PIPE, IQ_PIPE_TIMEOUT_MS);
+	ftStatus = transport->SetPipeTimeout(deviceHandle, IQ_WRITE_PIPE, IQ_PIPE_TIMEOUT_MS);
 	if (!CHECK_DEVICE_STATUS(ftStatus))
 	{
 		return ErrorFlags::Unsuccessful;
@@ -363,23 +506,10 @@ uint32_t RadioDevice::GetIQStreamSize()
 	return iqStreamSize;
 }
 
-ErrorFlags RadioDevice::CommandChannelTransact(DeviceCommand command, DeviceCommand*& response)
-{
-	ErrorFlags result = CommandChannelTransmit(command);
-	if (result != ErrorFlags::None)
-	{
-		response = CreateInvalidResponse(command);
-		return result;
-	}
-	result = CommandChannelReceive(response);
-	return result;
-}
-
-ErrorFlags RadioDevice::CommandChannelTransmit(DeviceCommand command)
+ErrorFlags RadioDevice::CommandChannelTransmit(const uint8_t* frames, ULONG numBytes)
 {
 	ULONG numCmdTrans = 0;
-	uint8_t* buf = command.ToSerializedBytes();
-	ftStatus = FT_WritePipe(deviceHandle, CMD_WRITE_PIPE, buf, 16, &numCmdTrans, NULL);
+	ftStatus = transport->WritePipe(deviceHandle, CMD_WRITE_PIPE, (PUCHAR)frames, numBytes, &numCmdTrans, NULL);
 	if (FT_FAILED(ftStatus))
 	{
 		cout << "CMD TX timeout: " << ftStatus << endl;
@@ -388,48 +518,22 @@ ErrorFlags RadioDevice::CommandChannelTransmit(DeviceCommand command)
 	return ErrorFlags::None;
 }
 
-ErrorFlags RadioDevice::CommandChannelReceive(DeviceCommand*& response)
+ErrorFlags RadioDevice::CommandChannelReceive(uint8_t* frames, ULONG bufferLength, ULONG& numBytes)
 {
-	ULONG bufferLength = 16;
-	ULONG bytesTransferred = 0;
-	unsigned char responseFromDeviceByteBuffer[16];
-	ftStatus = FT_ReadPipe(deviceHandle, CMD_READ_PIPE, responseFromDeviceByteBuffer, bufferLength, &bytesTransferred, NULL);
+	numBytes = 0;
+	ftStatus = transport->ReadPipe(deviceHandle, CMD_READ_PIPE, frames, bufferLength, &numBytes, NULL);
 	if (FT_FAILED(ftStatus))
 	{
 		cout << "Command RX timeout: " << ftStatus << endl;
-		response = new DeviceCommand(0, CommandPayloadValue(0, 0), 0);
 		return ErrorFlags::Unsuccessful;
 	}
-	response = FromSerializedBytes(responseFromDeviceByteBuffer);
 	return ErrorFlags::None;
 }
 
-ErrorFlags RadioDevice::ProcessCommand(CommandType commandType, int radioChannel, bool isSetCommand, CommandPayloadValue commandPayload, CommandPayloadValue& responsePayload)
+ErrorFlags RadioDevice::CheckResponse(const DeviceCommand& response)
 {
-	responsePayload = CommandPayloadValue();
-	if (!isSetup)
-	{
-		return ErrorFlags::NotInitialized;
-	}
-	DeviceCommand* deviceCommandPtr = NULL;
-	bool result = CreateCommand(commandType, (RadioChannel)radioChannel, isSetCommand, commandPayload, deviceCommandPtr);
-	if (!result)
-	{
-		return ErrorFlags::Unsuccessful;
-	}
-
-	DeviceCommand* deviceResponsePtr = NULL;
-	commandSyncObject.lock();
-	ErrorFlags transactionStatus = CommandChannelTransact(*deviceCommandPtr, deviceResponsePtr);
-	commandSyncObject.unlock();
-	if (ERROR_FLAGS_FAILURE(transactionStatus))
-	{
-		cout << "Didn't get a command response from the device!" << endl;
-		return ErrorFlags::NotResponding;
-	}
-
 	DeviceResponseError responseError = DeviceResponseError::None;
-	bool isResponseValid = deviceResponsePtr->IsValid(responseError);
+	bool isResponseValid = response.IsValid(responseError);
 	if (!isResponseValid)
 	{
 		switch (responseError)
@@ -447,132 +551,785 @@ ErrorFlags RadioDevice::ProcessCommand(CommandType commandType, int radioChannel
 			throw;
 		}
 	}
-
-	responsePayload = deviceResponsePtr->GetPayloadValue();
 	return ErrorFlags::None;
 }
 
-ErrorFlags RadioDevice::InitDevice()
-{
-	CommandPayloadValue responsePayload;
-	return ProcessCommand(CommandType::InitDevice, 0, true, CommandPayloadValue(), responsePayload);
-}
+const uint32_t RadioDevice::MAX_COMMAND_BATCH;
 
-ErrorFlags RadioDevice::ResetDevice(bool softReset)
+ErrorFlags RadioDevice::ProcessCommand(CommandType commandType, int radioChannel, bool isSetCommand, CommandPayloadValue commandPayload, CommandPayloadValue& responsePayload)
 {
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::Reset, 0, true, CommandPayloadValue(), responsePayload);
-	if (ERROR_FLAGS_SUCCESS(result))
-	{
-		return 	InitDevice();
-	}
+	CommandRequest command(commandType, radioChannel, isSetCommand, commandPayload);
+	ErrorFlags result = ProcessCommandBatch(&command, 1);
+	responsePayload = command.responsePayload;
 	return result;
 }
 
-ErrorFlags RadioDevice::GetMultiplexMode(bool& isTDM, IQChannelConfig& channelConfig)
+ErrorFlags RadioDevice::ProcessCommandBatch(vector<CommandRequest>& commands)
 {
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::MultiplexMode, 0, false, CommandPayloadValue(), responsePayload);
-	channelConfig = (IQChannelConfig)responsePayload.GetPayloadHigh();
-	isTDM = responsePayload.GetAsBool();
-	return result;
+	return commands.empty() ? ErrorFlags::None : ProcessCommandBatch(&commands[0], commands.size());
 }
 
-ErrorFlags RadioDevice::SetMultiplexMode(bool isTDM, IQChannelConfig channelConfig)
+ErrorFlags RadioDevice::ProcessCommandBatch(CommandRequest* commands, size_t numCommands)
 {
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::MultiplexMode, 0, true, CommandPayloadValue((uint32_t)channelConfig, (uint32_t)isTDM), responsePayload);
+	ErrorFlags result = ErrorFlags::None;
+	for (size_t start = 0; start < numCommands; start += MAX_COMMAND_BATCH)
+	{
+		size_t batchSize = min<size_t>(MAX_COMMAND_BATCH, numCommands - start);
+		TransactCommands(commands + start, (uint32_t)batchSize);
+		for (size_t i = start; i < start + batchSize; i++)
+		{
+			if (commands[i].commandType == CommandType::SampleRate && commands[i].isSetCommand && ERROR_FLAGS_SUCCESS(commands[i].result))
+			{
+				ApplySampleRate(commands[i].commandPayload.GetAsUInt64());
+			}
+			if (ERROR_FLAGS_SUCCESS(result) && ERROR_FLAGS_FAILURE(commands[i].result))
+			{
+				result = commands[i].result;
+			}
+		}
+	}
 	return result;
 }
 
-ErrorFlags RadioDevice::GetDeviceStatus(DeviceStatus& deviceStatus)
+void RadioDevice::TransactCommands(CommandRequest* commands, uint32_t numCommands)
 {
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::DeviceStatus, 0, false, CommandPayloadValue(), responsePayload);
-	deviceStatus = (DeviceStatus)responsePayload.GetAsInt32();
-	return result;
+	const ULONG frameBytes = DeviceCommand::STD_RAW_PACKET_LENGTH_BYTES;
+	array<uint8_t, MAX_COMMAND_BATCH * DeviceCommand::STD_RAW_PACKET_LENGTH_BYTES> frames;
+	// Commands sent to the device and still waiting for a response, in the order they were sent
+	uint32_t pending[MAX_COMMAND_BATCH];
+	uint32_t numPending = 0;
+	lock_guard<mutex> lock(commandSyncObject);
+	for (uint32_t i = 0; i < numCommands; i++)
+	{
+		CommandRequest& command = commands[i];
+		command.responsePayload = CommandPayloadValue();
+		command.result = ErrorFlags::None;
+		if (!isSetup)
+		{
+			command.result = ErrorFlags::NotInitialized;
+			continue;
+		}
+		if (command.commandType == CommandType::LOFrequency && command.isSetCommand
+			&& (command.commandPayload.GetAsUInt64() < MIN_LO || command.commandPayload.GetAsUInt64() > MAX_LO))
+		{
+			command.result = ErrorFlags::InvalidParameter;
+			continue;
+		}
+		if (TryShadowCommand(command))
+		{
+			continue;
+		}
+		DeviceCommand deviceCommand;
+		if (CreateCommand(command.commandType, (RadioChannel)command.radioChannel, command.isSetCommand, command.commandPayload, deviceCommand))
+		{
+			deviceCommand.ToSerializedBytes(&frames[numPending * frameBytes]);
+			pending[numPending++] = i;
+			if (command.isSetCommand)
+			{
+				// Later commands in the batch must not be answered from the old value
+				InvalidateShadowRegisters(command);
+			}
+		}
+		else
+		{
+			command.result = ErrorFlags::Unsuccessful;
+		}
+	}
+	if (numPending == 0)
+	{
+		return;
+	}
+
+	if (isCommandPipeStale)
+	{
+		// Don't let answers to an earlier batch that timed out be taken for answers to this one
+		transport->AbortPipe(deviceHandle, CMD_READ_PIPE);
+		transport->FlushPipe(deviceHandle, CMD_READ_PIPE);
+		isCommandPipeStale = false;
+	}
+
+	uint32_t numSent = numPending;
+	uint32_t sent[MAX_COMMAND_BATCH];
+	copy(pending, pending + numPending, sent);
+	bool isTransmitted = ERROR_FLAGS_SUCCESS(CommandChannelTransmit(frames.data(), numPending * frameBytes));
+	// Responses can trickle in over several reads; keep going until each command has one or the device stops answering
+	while (isTransmitted && numPending > 0)
+	{
+		ULONG numBytes = 0;
+		if (ERROR_FLAGS_FAILURE(CommandChannelReceive(frames.data(), numPending * frameBytes, numBytes)) || numBytes < frameBytes)
+		{
+			break;
+		}
+		for (ULONG offset = 0; offset + frameBytes <= numBytes; offset += frameBytes)
+		{
+			DeviceCommand response = FromSerializedBytes(&frames[offset]);
+			for (uint32_t p = 0; p < numPending; p++)
+			{
+				CommandRequest& command = commands[pending[p]];
+				// A set and a get of the same setting can share a batch, so the direction has to match too
+				if (response.GetCommandType() == command.commandType && response.GetRadioChannel() == command.radioChannel
+					&& response.IsSetCommand() == command.isSetCommand)
+				{
+					command.result = CheckResponse(response);
+					if (ERROR_FLAGS_SUCCESS(command.result))
+					{
+						command.responsePayload = response.GetPayloadValue();
+					}
+					copy(pending + p + 1, pending + numPending, pending + p);
+					numPending--;
+					break;
+				}
+			}
+		}
+	}
+	if (numPending > 0)
+	{
+		cout << "Didn't get a command response from the device!" << endl;
+		for (uint32_t p = 0; p < numPending; p++)
+		{
+			commands[pending[p]].result = ErrorFlags::NotResponding;
+		}
+		// The device may have been reset or replugged; nothing cached can be trusted any more
+		ClearShadowRegisters();
+		isCommandPipeStale = true;
+		return;
+	}
+	for (uint32_t p = 0; p < numSent; p++)
+	{
+		UpdateShadowRegisters(commands[sent[p]]);
+	}
 }
 
-ErrorFlags RadioDevice::GetLOFrequency(int radioChannel, uint64_t& frequency)
+RadioDevice::ShadowRegister* RadioDevice::FindShadowRegister(CommandType commandType, int radioChannel)
 {
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::LOFrequency, radioChannel, false, CommandPayloadValue(), responsePayload);
-	frequency = responsePayload.GetAsUInt64();
-	return result;
+	if (radioChannel < 0 || radioChannel >= NUM_SHADOW_CHANNELS)
+	{
+		return NULL;
+	}
+	switch (commandType)
+	{
+	case CommandType::LOFrequency:
+		return &shadowRegisters[0][radioChannel];
+	case CommandType::Gain:
+		return &shadowRegisters[1][radioChannel];
+	case CommandType::GainMode:
+		return &shadowRegisters[2][radioChannel];
+	case CommandType::Bandwidth:
+		return &shadowRegisters[3][radioChannel];
+	case CommandType::SampleRate:
+		return &shadowRegisters[4][radioChannel];
+	default:
+		return NULL;
+	}
 }
 
-ErrorFlags RadioDevice::SetLOFrequency(int radioChannel, uint64_t frequency)
+bool RadioDevice::TryShadowCommand(CommandRequest& command)
 {
-	if (frequency < 70000000 || frequency > 6000000000)
+	ShadowRegister* shadow = FindShadowRegister(command.commandType, command.radioChannel);
+	if (shadow == NULL || !shadow->isValid)
 	{
-		return ErrorFlags::InvalidParameter;
+		return false;
 	}
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::LOFrequency, radioChannel, true, CommandPayloadValue(frequency), responsePayload);
-	return result;
+	uint64_t payload = command.commandPayload.GetAsUInt64();
+	if (command.isSetCommand)
+	{
+		if (payload != shadow->value && payload != shadow->requestedValue)
+		{
+			return false;
+		}
+	}
+	else if (command.commandType == CommandType::Gain)
+	{
+		// The AGC moves the gain on its own, and with the mode unknown it may be running
+		ShadowRegister* gainMode = FindShadowRegister(CommandType::GainMode, command.radioChannel);
+		if (!gainMode->isValid || gainMode->value != (uint64_t)RadioGainMode::Manual)
+		{
+			return false;
+		}
+	}
+	command.responsePayload = CommandPayloadValue(shadow->value);
+	command.result = ErrorFlags::None;
+	return true;
 }
 
-ErrorFlags RadioDevice::GetGain(int radioChannel, int& gain)
+void RadioDevice::InvalidateShadowRegisters(const CommandRequest& command)
 {
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::Gain, radioChannel, false, CommandPayloadValue(), responsePayload);
-	gain = responsePayload.GetAsInt32();
-	return result;
+	if (command.commandType == CommandType::Reset || command.commandType == CommandType::InitDevice || command.commandType == CommandType::MultiplexMode)
+	{
+		// These can put every setting back to its default or reassign channels
+		ClearShadowRegisters();
+		return;
+	}
+	ShadowRegister* shadow = FindShadowRegister(command.commandType, command.radioChannel);
+	if (shadow == NULL)
+	{
+		return;
+	}
+	shadow->isValid = false;
+	if (command.commandType == CommandType::SampleRate)
+	{
+		// The converters share one clock, so a new rate applies to every channel
+		for (int channel = 0; channel < NUM_SHADOW_CHANNELS; channel++)
+		{
+			FindShadowRegister(CommandType::SampleRate, channel)->isValid = false;
+		}
+	}
+	else if (command.commandType == CommandType::GainMode)
+	{
+		FindShadowRegister(CommandType::Gain, command.radioChannel)->isValid = false;
+	}
 }
 
-ErrorFlags RadioDevice::SetGain(int radioChannel, int gain)
+void RadioDevice::UpdateShadowRegisters(const CommandRequest& command)
 {
-	//@TODO figure out all the other check stuff based on the gain table
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::Gain, radioChannel, true, CommandPayloadValue((uint64_t)gain), responsePayload);
-	return result;
+	if (command.isSetCommand)
+	{
+		InvalidateShadowRegisters(command);
+	}
+	ShadowRegister* shadow = FindShadowRegister(command.commandType, command.radioChannel);
+	if (shadow == NULL || ERROR_FLAGS_FAILURE(command.result))
+	{
+		return;
+	}
+	uint64_t value = command.responsePayload.GetAsUInt64();
+	uint64_t requestedValue = command.isSetCommand ? command.commandPayload.GetAsUInt64() : value;
+	// A set answered with an empty payload doesn't tell us what the device applied
+	if (command.isSetCommand && value == 0 && requestedValue != 0)
+	{
+		return;
+	}
+	shadow->isValid = true;
+	shadow->value = value;
+	shadow->requestedValue = requestedValue;
 }
 
-ErrorFlags RadioDevice::GetGainMode(int radioChannel, RadioGainMode& gainMode)
+void RadioDevice::ClearShadowRegisters()
 {
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::GainMode, radioChannel, false, CommandPayloadValue(), responsePayload);
-	gainMode = (RadioGainMode)responsePayload.GetAsInt32();
-	return result;
+	for (int setting = 0; setting < NUM_SHADOW_SETTINGS; setting++)
+	{
+		for (int channel = 0; channel < NUM_SHADOW_CHANNELS; channel++)
+		{
+			shadowRegisters[setting][channel].isValid = false;
+		}
+	}
 }
 
-ErrorFlags RadioDevice::SetGainMode(int radioChannel, RadioGainMode gainMode)
+shared_future<ErrorFlags> RadioDevice::SubmitCommand(const CommandRequest& command)
 {
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::GainMode, radioChannel, true, CommandPayloadValue((int)gainMode), responsePayload);
-	return result;
+	lock_guard<mutex> lock(asyncCommandMutex);
+	if (command.isSetCommand)
+	{
+		for (deque<AsyncCommand>::iterator queued = asyncCommands.begin(); queued != asyncCommands.end(); ++queued)
+		{
+			if (queued->command.isSetCommand && queued->command.commandType == command.commandType && queued->command.radioChannel == command.radioChannel)
+			{
+				// Not sent yet, so only the latest value needs to go out. It has to go out after everything queued since the old value though
+				// (e.g. a gain set must not overtake a gain mode change queued in between), so the entry moves to the back with its future.
+				AsyncCommand entry = *queued;
+				entry.command.commandPayload = command.commandPayload;
+				asyncCommands.erase(queued);
+				asyncCommands.push_back(entry);
+				return entry.future;
+			}
+		}
+	}
+	AsyncCommand entry;
+	entry.command = command;
+	entry.promise = make_shared<promise<ErrorFlags>>();
+	entry.future = entry.promise->get_future().share();
+	asyncCommands.push_back(entry);
+	if (!isAsyncCommandRunning)
+	{
+		isAsyncCommandRunning = true;
+		asyncCommandThread = thread(&RadioDevice::AsyncCommandLoop, this, asyncCommandGeneration);
+	}
+	asyncCommandReady.notify_one();
+	return entry.future;
 }
 
-ErrorFlags RadioDevice::GetTransmitAttenuation(int radioChannel, float& attenuation)
+void RadioDevice::AsyncCommandLoop(uint32_t generation)
 {
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::Gain, radioChannel, false, new CommandPayloadValue(0), responsePayload);
-	// Device returns atten in +mdB->divide by 1000
-	int tempAttenuation = responsePayload.GetAsInt32();
-	attenuation = tempAttenuation / 1000.0f;
-	return result;
+	AsyncCommand batch[MAX_COMMAND_BATCH];
+	CommandRequest requests[MAX_COMMAND_BATCH];
+	unique_lock<mutex> lock(asyncCommandMutex);
+	while (true)
+	{
+		// A newer executor may already have been started if commands were submitted while this one was being stopped
+		asyncCommandReady.wait(lock, [this, generation] { return !asyncCommands.empty() || generation != asyncCommandGeneration; });
+		if (asyncCommands.empty())
+		{
+			return;
+		}
+		// Whatever is queued now goes out in one round trip; anything submitted meanwhile queues (and coalesces) behind it
+		uint32_t numCommands = 0;
+		while (numCommands < MAX_COMMAND_BATCH && !asyncCommands.empty())
+		{
+			batch[numCommands] = asyncCommands.front();
+			requests[numCommands] = batch[numCommands].command;
+			asyncCommands.pop_front();
+			numCommands++;
+		}
+		lock.unlock();
+
+		ProcessCommandBatch(requests, numCommands);
+		CommandCompletion completion;
+		completion.hostTimeNs = GetHostTimeNs();
+		completion.receiveSampleIndex = receiveSampleCount;
+		{
+			// Held while the handlers run so RemoveCommandCompletionHandler() can't return while one is still being called
+			lock_guard<mutex> handlerLock(completionHandlerMutex);
+			for (uint32_t i = 0; i < numCommands && !completionHandlers.empty(); i++)
+			{
+				completion.commandType = requests[i].commandType;
+				completion.radioChannel = requests[i].radioChannel;
+				completion.isSetCommand = requests[i].isSetCommand;
+				completion.responsePayload = requests[i].responsePayload;
+				completion.result = requests[i].result;
+				for (auto& handler : completionHandlers)
+				{
+					handler.second(completion);
+				}
+			}
+		}
+		for (uint32_t i = 0; i < numCommands; i++)
+		{
+			batch[i].promise->set_value(requests[i].result);
+			batch[i] = AsyncCommand();
+		}
+		lock.lock();
+	}
 }
 
-ErrorFlags RadioDevice::SetTransmitAttenuation(int radioChannel, float attenuation)
+void RadioDevice::StopAsyncCommands()
 {
-	if (attenuation >= MIN_ATTENUATION && attenuation <= MAX_ATTENUATION)
+	thread worker;
 	{
-		CommandPayloadValue responsePayload;
-		// Need to send the value as mdB
-		int attenIndex = (int)(attenuation * 1000);
-		ErrorFlags result = ProcessCommand(CommandType::Gain, radioChannel, true, CommandPayloadValue(attenIndex), responsePayload);
-		return result;
+		lock_guard<mutex> lock(asyncCommandMutex);
+		isAsyncCommandRunning = false;
+		asyncCommandGeneration++;
+		asyncCommandReady.notify_all();
+		worker = move(asyncCommandThread);
 	}
-	else
+	// The loop drains the queue before it exits so no future is left hanging
+	if (worker.joinable())
 	{
-		return ErrorFlags::InvalidParameter;
+		worker.join();
 	}
 }
 
-ErrorFlags RadioDevice::GetComplexBandwidth(int radioChannel, uint64_t& bandwidth)
+uint32_t RadioDevice::AddCommandCompletionHandler(CommandCompletionHandler handler)
 {
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::Bandwidth, radioChannel, false, CommandPayloadValue(), responsePayload);
+	lock_guard<mutex> lock(completionHandlerMutex);
+	uint32_t handlerId = nextCompletionHandlerId++;
+	completionHandlers[handlerId] = handler;
+	return handlerId;
+}
+
+void RadioDevice::RemoveCommandCompletionHandler(uint32_t handlerId)
+{
+	lock_guard<mutex> lock(completionHandlerMutex);
+	completionHandlers.erase(handlerId);
+}
+
+ErrorFlags RadioDevice::ClaimReceiveChannels(int numChannels)
+{
+	lock_guard<mutex> lock(channelClaimMutex);
+	// There is one IQ pipe per direction, so one user per direction
+	if (claimedReceiveChannels > 0)
+	{
+		return ErrorFlags::ResourceUnavailable;
+	}
+	ErrorFlags result = ApplyChannelClaims(numChannels, claimedTransmitChannels);
+	if (ERROR_FLAGS_SUCCESS(result))
+	{
+		claimedReceiveChannels = numChannels;
+	}
+	return result;
+}
+
+ErrorFlags RadioDevice::ClaimTransmitChannels(int numChannels)
+{
+	lock_guard<mutex> lock(channelClaimMutex);
+	if (claimedTransmitChannels > 0)
+	{
+		return ErrorFlags::ResourceUnavailable;
+	}
+	ErrorFlags result = ApplyChannelClaims(claimedReceiveChannels, numChannels);
+	if (ERROR_FLAGS_SUCCESS(result))
+	{
+		claimedTransmitChannels = numChannels;
+	}
+	return result;
+}
+
+void RadioDevice::ReleaseReceiveChannels()
+{
+	lock_guard<mutex> lock(channelClaimMutex);
+	claimedReceiveChannels = 0;
+}
+
+void RadioDevice::ReleaseTransmitChannels()
+{
+	lock_guard<mutex> lock(channelClaimMutex);
+	claimedTransmitChannels = 0;
+}
+
+ErrorFlags RadioDevice::ApplyChannelClaims(int numReceive, int numTransmit)
+{
+	IQChannelConfig channelConfig;
+	if (numReceive + numTransmit <= 0 || !GetChannelConfig(numReceive, numTransmit, channelConfig))
+	{
+		return ErrorFlags::InvalidParameter;
+	}
+	// Only touch the multiplex mode if the device isn't already streaming the right channels
+	bool isTDM = false;
+	IQChannelConfig currentConfig = IQChannelConfig::Default;
+	ErrorFlags result = GetMultiplexMode(isTDM, currentConfig);
+	if (ERROR_FLAGS_FAILURE(result) || currentConfig != channelConfig)
+	{
+		result = SetMultiplexMode(isTDM, channelConfig);
+	}
+	return result;
+}
+
+bool RadioDevice::GetChannelConfig(int numReceive, int numTransmit, IQChannelConfig& channelConfig)
+{
+	static const struct
+	{
+		int numReceive;
+		int numTransmit;
+		IQChannelConfig channelConfig;
+	} CHANNEL_CONFIGS[] =
+	{
+		{ 2, 0, IQChannelConfig::R2T0 }, { 3, 0, IQChannelConfig::R3T0 }, { 4, 0, IQChannelConfig::R4T0 },
+		{ 0, 2, IQChannelConfig::R0T2 }, { 0, 3, IQChannelConfig::R0T3 }, { 0, 4, IQChannelConfig::R0T4 },
+		{ 1, 2, IQChannelConfig::R1T2 }, { 1, 3, IQChannelConfig::R1T3 }, { 2, 1, IQChannelConfig::R2T1 },
+		{ 2, 2, IQChannelConfig::R2T2 }, { 3, 1, IQChannelConfig::R3T1 }
+	};
+	// Default covers R1T0, R0T1 and R1T1
+	if (numReceive <= 1 && numTransmit <= 1)
+	{
+		channelConfig = IQChannelConfig::Default;
+		return true;
+	}
+	for (size_t i = 0; i < sizeof(CHANNEL_CONFIGS) / sizeof(CHANNEL_CONFIGS[0]); i++)
+	{
+		if (CHANNEL_CONFIGS[i].numReceive == numReceive && CHANNEL_CONFIGS[i].numTransmit == numTransmit)
+		{
+			channelConfig = CHANNEL_CONFIGS[i].channelConfig;
+			return true;
+		}
+	}
+	return false;
+}
+
+ErrorFlags RadioDevice::StartHopSchedule(int radioChannel, const vector<HopDwell>& schedule, bool isRepeating)
+{
+	if (schedule.empty())
+	{
+		return ErrorFlags::InvalidParameter;
+	}
+	for (const HopDwell& dwell : schedule)
+	{
+		if (dwell.numSamples == 0 || dwell.frequency < MIN_LO || dwell.frequency > MAX_LO)
+		{
+			return ErrorFlags::InvalidParameter;
+		}
+	}
+	StopHopSchedule();
+	hopSchedule = schedule;
+	hopChannel = radioChannel;
+	isHopRepeating = isRepeating;
+	lateHopCount = 0;
+	isHopping = true;
+	hopThread = thread(&RadioDevice::HopLoop, this);
+	return ErrorFlags::None;
+}
+
+void RadioDevice::StopHopSchedule()
+{
+	isHopping = false;
+	if (hopThread.joinable())
+	{
+		hopThread.join();
+	}
+}
+
+uint64_t RadioDevice::GetLateHopCount()
+{
+	return lateHopCount;
+}
+
+void RadioDevice::HopLoop()
+{
+	// Longest the engine sleeps before checking the sample count (and isHopping) again
+	const uint64_t MAX_HOP_WAIT_NS = 1000000;
+	uint64_t sampleRate = 0;
+	GetSampleRate(hopChannel, sampleRate);
+
+	uint64_t received = EstimateReceivedSamples(sampleRate);
+	ErrorFlags result = SetLOFrequencyAsync(hopChannel, hopSchedule[0].frequency).get();
+	if (ERROR_FLAGS_FAILURE(result))
+	{
+		cerr << "Hop schedule stopped, the first hop failed (" << result << ")" << endl;
+		isHopping = false;
+		return;
+	}
+	// Boundaries are laid out from where the first dwell actually started so scheduling jitter never accumulates
+	uint64_t nextBoundary = EstimateReceivedSamples(sampleRate);
+	// Samples that go by between queueing a hop and the device answering, smoothed over the last few hops
+	uint64_t leadSamples = nextBoundary - received;
+	nextBoundary += hopSchedule[0].numSamples;
+	size_t next = 1 % hopSchedule.size();
+	while (isHopping)
+	{
+		if (next == 0 && !isHopRepeating)
+		{
+			break;
+		}
+		received = EstimateReceivedSamples(sampleRate);
+		if (received + leadSamples < nextBoundary)
+		{
+			uint64_t waitNs = sampleRate > 0 ? (uint64_t)((double)(nextBoundary - leadSamples - received) * 1e9 / sampleRate) : MAX_HOP_WAIT_NS;
+			this_thread::sleep_for(chrono::nanoseconds(min(waitNs, MAX_HOP_WAIT_NS)));
+			continue;
+		}
+		if (received > nextBoundary)
+		{
+			lateHopCount++;
+		}
+		result = SetLOFrequencyAsync(hopChannel, hopSchedule[next].frequency).get();
+		if (ERROR_FLAGS_FAILURE(result))
+		{
+			// Stay on schedule; the completion handler has seen the failure
+			lateHopCount++;
+		}
+		uint64_t latency = EstimateReceivedSamples(sampleRate) - received;
+		leadSamples = (3 * leadSamples + latency) / 4;
+		nextBoundary += hopSchedule[next].numSamples;
+		next = (next + 1) % hopSchedule.size();
+	}
+	isHopping = false;
+}
+
+void RadioDevice::InvalidateSettingsCache()
+{
+	lock_guard<mutex> lock(commandSyncObject);
+	ClearShadowRegisters();
+}
+
+ErrorFlags RadioDevice::InitDevice()
+{
+	CommandPayloadValue responsePayload;
+	return ProcessCommand(CommandType::InitDevice, 0, true, CommandPayloadValue(), responsePayload);
+}
+
+ErrorFlags RadioDevice::ResetDevice(bool softReset)
+{
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::Reset, 0, true, CommandPayloadValue(), responsePayload);
+	if (ERROR_FLAGS_SUCCESS(result))
+	{
+		return 	InitDevice();
+	}
+	return result;
+}
+
+ErrorFlags RadioDevice::GetMultiplexMode(bool& isTDM, IQChannelConfig& channelConfig)
+{
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::MultiplexMode, 0, false, CommandPayloadValue(), responsePayload);
+	channelConfig = (IQChannelConfig)responsePayload.GetPayloadHigh();
+	isTDM = responsePayload.GetAsBool();
+	if (ERROR_FLAGS_SUCCESS(result))
+	{
+		UpdateFrameBytes(channelConfig);
+	}
+	return result;
+}
+
+ErrorFlags RadioDevice::SetMultiplexMode(bool isTDM, IQChannelConfig channelConfig)
+{
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::MultiplexMode, 0, true, CommandPayloadValue((uint32_t)channelConfig, (uint32_t)isTDM), responsePayload);
+	if (ERROR_FLAGS_SUCCESS(result))
+	{
+		UpdateFrameBytes(channelConfig);
+	}
+	return result;
+}
+
+void RadioDevice::UpdateFrameBytes(IQChannelConfig channelConfig)
+{
+	receiveFrameBytes = BYTES_PER_IQ_SAMPLE * (uint32_t)GetReceiveChannelCount(channelConfig);
+	transmitFrameBytes = BYTES_PER_IQ_SAMPLE * (uint32_t)max(1, GetTransmitChannelCount(channelConfig));
+}
+
+int RadioDevice::GetReceiveChannelCount(IQChannelConfig channelConfig)
+{
+	switch (channelConfig)
+	{
+	case IQChannelConfig::R2T0:
+	case IQChannelConfig::R2T1:
+	case IQChannelConfig::R2T2:
+		return 2;
+	case IQChannelConfig::R3T0:
+	case IQChannelConfig::R3T1:
+		return 3;
+	case IQChannelConfig::R4T0:
+		return 4;
+	default:
+		return 1;
+	}
+}
+
+int RadioDevice::GetTransmitChannelCount(IQChannelConfig channelConfig)
+{
+	switch (channelConfig)
+	{
+	case IQChannelConfig::R2T0:
+	case IQChannelConfig::R3T0:
+	case IQChannelConfig::R4T0:
+		return 0;
+	case IQChannelConfig::R0T2:
+	case IQChannelConfig::R1T2:
+	case IQChannelConfig::R2T2:
+		return 2;
+	case IQChannelConfig::R0T3:
+	case IQChannelConfig::R1T3:
+		return 3;
+	case IQChannelConfig::R0T4:
+		return 4;
+	default:
+		return 1;
+	}
+}
+
+ErrorFlags RadioDevice::GetDeviceStatus(DeviceStatus& deviceStatus)
+{
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::DeviceStatus, 0, false, CommandPayloadValue(), responsePayload);
+	deviceStatus = (DeviceStatus)responsePayload.GetAsInt32();
+	return result;
+}
+
+ErrorFlags RadioDevice::GetLOFrequency(int radioChannel, uint64_t& frequency)
+{
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::LOFrequency, radioChannel, false, CommandPayloadValue(), responsePayload);
+	frequency = responsePayload.GetAsUInt64();
+	return result;
+}
+
+ErrorFlags RadioDevice::SetLOFrequency(int radioChannel, uint64_t frequency)
+{
+	if (frequency < 70000000 || frequency > 6000000000)
+	{
+		return ErrorFlags::InvalidParameter;
+	}
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::LOFrequency, radioChannel, true, CommandPayloadValue(frequency), responsePayload);
+	return result;
+}
+
+ErrorFlags RadioDevice::GetGain(int radioChannel, int& gain)
+{
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::Gain, radioChannel, false, CommandPayloadValue(), responsePayload);
+	gain = responsePayload.GetAsInt32();
+	return result;
+}
+
+ErrorFlags RadioDevice::SetGain(int radioChannel, int gain)
+{
+	//@TODO figure out all the other check stuff based on the gain table
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::Gain, radioChannel, true, CommandPayloadValue((uint64_t)gain), responsePayload);
+	return result;
+}
+
+ErrorFlags RadioDevice::GetGainMode(int radioChannel, RadioGainMode& gainMode)
+{
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::GainMode, radioChannel, false, CommandPayloadValue(), responsePayload);
+	gainMode = (RadioGainMode)responsePayload.GetAsInt32();
+	return result;
+}
+
+ErrorFlags RadioDevice::SetGainMode(int radioChannel, RadioGainMode gainMode)
+{
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::GainMode, radioChannel, true, CommandPayloadValue((int)gainMode), responsePayload);
+	return result;
+}
+
+ErrorFlags RadioDevice::GetTransmitAttenuation(int radioChannel, float& attenuation)
+{
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::Gain, radioChannel, false, CommandPayloadValue(0), responsePayload);
+	// Device returns atten in +mdB->divide by 1000
+	int tempAttenuation = responsePayload.GetAsInt32();
+	attenuation = tempAttenuation / 1000.0f;
+	return result;
+}
+
+ErrorFlags RadioDevice::SetTransmitAttenuation(int radioChannel, float attenuation)
+{
+	if (attenuation >= MIN_ATTENUATION && attenuation <= MAX_ATTENUATION)
+	{
+		CommandPayloadValue responsePayload;
+		// Need to send the value as mdB
+		int attenIndex = (int)(attenuation * 1000);
+		ErrorFlags result = ProcessCommand(CommandType::Gain, radioChannel, true, CommandPayloadValue(attenIndex), responsePayload);
+		return result;
+	}
+	else
+	{
+		return ErrorFlags::InvalidParameter;
+	}
+}
+
+shared_future<ErrorFlags> RadioDevice::SetLOFrequencyAsync(int radioChannel, uint64_t frequency)
+{
+	return SubmitCommand(CommandRequest(CommandType::LOFrequency, radioChannel, true, CommandPayloadValue(frequency)));
+}
+
+shared_future<ErrorFlags> RadioDevice::SetGainAsync(int radioChannel, int gain)
+{
+	return SubmitCommand(CommandRequest(CommandType::Gain, radioChannel, true, CommandPayloadValue((uint64_t)gain)));
+}
+
+shared_future<ErrorFlags> RadioDevice::SetGainModeAsync(int radioChannel, RadioGainMode gainMode)
+{
+	return SubmitCommand(CommandRequest(CommandType::GainMode, radioChannel, true, CommandPayloadValue((int)gainMode)));
+}
+
+shared_future<ErrorFlags> RadioDevice::SetComplexBandwidthAsync(int radioChannel, uint64_t bandwidth)
+{
+	return SubmitCommand(CommandRequest(CommandType::Bandwidth, radioChannel, true, CommandPayloadValue(bandwidth)));
+}
+
+shared_future<ErrorFlags> RadioDevice::SetSampleRateAsync(int radioChannel, uint64_t sampleRate)
+{
+	return SubmitCommand(CommandRequest(CommandType::SampleRate, radioChannel, true, CommandPayloadValue(sampleRate)));
+}
+
+shared_future<ErrorFlags> RadioDevice::SetTransmitAttenuationAsync(int radioChannel, float attenuation)
+{
+	if (attenuation < MIN_ATTENUATION || attenuation > MAX_ATTENUATION)
+	{
+		promise<ErrorFlags> invalid;
+		invalid.set_value(ErrorFlags::InvalidParameter);
+		return invalid.get_future().share();
+	}
+	// Need to send the value as mdB
+	return SubmitCommand(CommandRequest(CommandType::Gain, radioChannel, true, CommandPayloadValue((int)(attenuation * 1000))));
+}
+
+ErrorFlags RadioDevice::GetComplexBandwidth(int radioChannel, uint64_t& bandwidth)
+{
+	CommandPayloadValue responsePayload;
+	ErrorFlags result = ProcessCommand(CommandType::Bandwidth, radioChannel, false, CommandPayloadValue(), responsePayload);
 	bandwidth = responsePayload.GetAsUInt64();
 	return result;
 }
@@ -588,7 +1345,12 @@ ErrorFlags RadioDevice::GetSampleRate(int radioChannel, uint64_t& sampleRate)
 {
 	CommandPayloadValue responsePayload;
 	ErrorFlags result = ProcessCommand(CommandType::SampleRate, radioChannel, false, CommandPayloadValue(), responsePayload);
-	sampleRate = responsePayload.GetAsUInt64();
+	sampleRate = CorrectReportedSampleRate(responsePayload.GetAsUInt64());
+	return result;
+}
+
+uint64_t RadioDevice::CorrectReportedSampleRate(uint64_t sampleRate)
+{
 	if (sampleRate % 2 != 0)
 	{
 		if ((sampleRate & 0x02) == 0x02)
@@ -602,36 +1364,75 @@ ErrorFlags RadioDevice::GetSampleRate(int radioChannel, uint64_t& sampleRate)
 			sampleRate -= 1;
 		}
 	}
+	return sampleRate;
+}
+
+ErrorFlags RadioDevice::SetSampleRate(int radioChannel, uint64_t sampleRate)
+{
+	CommandPayloadValue responsePayload;
+	return ProcessCommand(CommandType::SampleRate, radioChannel, true, CommandPayloadValue(sampleRate), responsePayload);
+}
+
+ErrorFlags RadioDevice::ConfigureReceiveChannel(int radioChannel, uint64_t& frequency, uint64_t& sampleRate, RadioGainMode gainMode, int gain)
+{
+	CommandRequest commands[6];
+	size_t numCommands = 0;
+	commands[numCommands++] = CommandRequest(CommandType::LOFrequency, radioChannel, true, CommandPayloadValue(frequency));
+	commands[numCommands++] = CommandRequest(CommandType::SampleRate, radioChannel, true, CommandPayloadValue(sampleRate));
+	commands[numCommands++] = CommandRequest(CommandType::GainMode, radioChannel, true, CommandPayloadValue((int)gainMode));
+	if (gainMode == RadioGainMode::Manual)
+	{
+		commands[numCommands++] = CommandRequest(CommandType::Gain, radioChannel, true, CommandPayloadValue((uint64_t)gain));
+	}
+	return ConfigureChannel(commands, numCommands, radioChannel, frequency, sampleRate);
+}
+
+ErrorFlags RadioDevice::ConfigureTransmitChannel(int radioChannel, uint64_t& frequency, uint64_t& sampleRate, float attenuation)
+{
+	CommandRequest commands[5];
+	size_t numCommands = 0;
+	commands[numCommands++] = CommandRequest(CommandType::LOFrequency, radioChannel, true, CommandPayloadValue(frequency));
+	commands[numCommands++] = CommandRequest(CommandType::SampleRate, radioChannel, true, CommandPayloadValue(sampleRate));
+	bool isAttenuationValid = attenuation >= MIN_ATTENUATION && attenuation <= MAX_ATTENUATION;
+	if (isAttenuationValid)
+	{
+		// Need to send the value as mdB
+		commands[numCommands++] = CommandRequest(CommandType::Gain, radioChannel, true, CommandPayloadValue((int)(attenuation * 1000)));
+	}
+	ErrorFlags result = ConfigureChannel(commands, numCommands, radioChannel, frequency, sampleRate);
+	return ERROR_FLAGS_SUCCESS(result) && !isAttenuationValid ? ErrorFlags::InvalidParameter : result;
+}
+
+ErrorFlags RadioDevice::ConfigureChannel(CommandRequest* commands, size_t numSets, int radioChannel, uint64_t& frequency, uint64_t& sampleRate)
+{
+	commands[numSets] = CommandRequest(CommandType::LOFrequency, radioChannel, false);
+	commands[numSets + 1] = CommandRequest(CommandType::SampleRate, radioChannel, false);
+	ErrorFlags result = ProcessCommandBatch(commands, numSets + 2);
+	frequency = commands[numSets].responsePayload.GetAsUInt64();
+	sampleRate = CorrectReportedSampleRate(commands[numSets + 1].responsePayload.GetAsUInt64());
 	return result;
 }
 
-ErrorFlags RadioDevice::SetSampleRate(int radioChannel, uint64_t sampleRate)
+void RadioDevice::ApplySampleRate(uint64_t sampleRate)
 {
-	CommandPayloadValue responsePayload;
-	ErrorFlags result = ProcessCommand(CommandType::SampleRate, radioChannel, true, CommandPayloadValue(sampleRate), responsePayload);
 	uint32_t optimalNewStreamSize = 0;
-	if (ERROR_FLAGS_SUCCESS(result))
+	if (sampleRate <= 1000000)
 	{
-		if (sampleRate <= 1000000)
-		{
-			optimalNewStreamSize = SLOW_RATE_STREAM_SIZE_BYTES;
-		}
-		else if (sampleRate <= 2000000)
-		{
-			optimalNewStreamSize = MED_LOW_RATE_STREAM_SIZE_BYTES;
-		}
-		else if (sampleRate < 30000000)
-		{
-			optimalNewStreamSize = MED_RATE_STREAM_SIZE_BYTES;
-		}
-		else
-		{
-			optimalNewStreamSize = FAST_RATE_STREAM_SIZE_BYTES;
-		}
-		iqStreamSize = optimalNewStreamSize;
+		optimalNewStreamSize = SLOW_RATE_STREAM_SIZE_BYTES;
 	}
-
-	return result;
+	else if (sampleRate <= 2000000)
+	{
+		optimalNewStreamSize = MED_LOW_RATE_STREAM_SIZE_BYTES;
+	}
+	else if (sampleRate < 30000000)
+	{
+		optimalNewStreamSize = MED_RATE_STREAM_SIZE_BYTES;
+	}
+	else
+	{
+		optimalNewStreamSize = FAST_RATE_STREAM_SIZE_BYTES;
+	}
+	iqStreamSize = optimalNewStreamSize;
 }
 
 ErrorFlags RadioDevice::GetDeviceTemperature(float& tempCelsius)
@@ -691,33 +1492,312 @@ ErrorFlags RadioDevice::StopTransmit()
 }
 
 ErrorFlags RadioDevice::ReceiveSamples(uint8_t*& rawIQBytes)
+{
+	return ReceiveSamples(rawIQBytes, iqStreamSize);
+}
+
+ErrorFlags RadioDevice::ReceiveSamples(uint8_t*& rawIQBytes, uint64_t numReceiveBytes)
+{
+	uint32_t numReceivedBytes;
+	rawIQBytes = new uint8_t[numReceiveBytes];
+	return ReceiveSamplesInto(rawIQBytes, (uint32_t)numReceiveBytes, numReceivedBytes);
+}
+
+ErrorFlags RadioDevice::ReceiveSamplesInto(uint8_t* rawIQBytes, uint32_t numReceiveBytes, uint32_t& numReceivedBytes)
 {
 	ULONG numTransferred = 0;
-	rawIQBytes = new uint8_t[iqStreamSize];
-	ftStatus = FT_ReadPipe(deviceHandle, IQ_READ_PIPE, rawIQBytes, (ULONG)iqStreamSize, &numTransferred, NULL);
-	if (FT_SUCCESS(ftStatus))
+	// Local status; with a shared device ftStatus belongs to whichever thread is sending commands or writing
+	FT_STATUS readStatus = transport->ReadPipe(deviceHandle, IQ_READ_PIPE, rawIQBytes, (ULONG)numReceiveBytes, &numTransferred, NULL);
+	numReceivedBytes = (uint32_t)numTransferred;
+	receiveTransferSamples = numReceiveBytes / receiveFrameBytes;
+	CountReceivedSamples(numTransferred);
+	if (FT_SUCCESS(readStatus))
 	{
 		return ErrorFlags::None;
 	}
+	else if (CountReceiveFailure(readStatus) == RING_SLOT_READ_TIMEOUT)
+	{
+		return ErrorFlags::NotResponding;
+	}
 	else
 	{
 		return ErrorFlags::Unsuccessful;
 	}
 }
 
-ErrorFlags RadioDevice::ReceiveSamples(uint8_t*& rawIQBytes, uint64_t numReceiveBytes)
+ErrorFlags RadioDevice::StartReceiveStream(uint64_t ringSizeBytes, OverflowPolicy overflowPolicy, uint32_t numTransfers, uint32_t transferBytes)
 {
-	ULONG numTransferred = 0;
-	rawIQBytes = new uint8_t[numReceiveBytes];
-	ftStatus = FT_ReadPipe(deviceHandle, IQ_READ_PIPE, rawIQBytes, (ULONG)numReceiveBytes, &numTransferred, NULL);
-	if (FT_SUCCESS(ftStatus))
+	if (!isSetup)
+	{
+		return ErrorFlags::NotInitialized;
+	}
+	if (isReceiveStreaming)
+	{
+		return ErrorFlags::AlreadyRunning;
+	}
+	if (transferBytes == 0)
+	{
+		transferBytes = iqStreamSize;
+	}
+	uint32_t frameBytes = receiveFrameBytes;
+	transferBytes = max(frameBytes, transferBytes - transferBytes % frameBytes);
+	receiveNumTransfers = max(1u, numTransfers);
+	uint64_t numSlots = max<uint64_t>(receiveNumTransfers + 1, (ringSizeBytes + transferBytes - 1) / transferBytes);
+	receiveRing.reset(new SampleRing((uint32_t)numSlots, transferBytes, overflowPolicy, receiveNumTransfers));
+	receiveErrorCount = 0;
+	receiveTimeoutCount = 0;
+	receiveSampleCount = 0;
+	receiveSampleTimeNs = 0;
+	receivePartialFrameBytes = 0;
+	receiveTransferSamples = transferBytes / receiveFrameBytes;
+	isReceiveStreaming = true;
+	receiveThread = thread(&RadioDevice::ReceiveStreamLoop, this);
+	if (receiveThreadCpu >= 0 && ERROR_FLAGS_FAILURE(PinThread(receiveThread, receiveThreadCpu)))
+	{
+		cout << "Failed to pin the receive thread to CPU " << receiveThreadCpu << ", leaving it to the scheduler." << endl;
+	}
+	return ErrorFlags::None;
+}
+
+void RadioDevice::SetReceiveThreadCpu(int cpu)
+{
+	receiveThreadCpu = max(-1, cpu);
+}
+
+void RadioDevice::SetTransmitThreadCpu(int cpu)
+{
+	transmitThreadCpu = max(-1, cpu);
+}
+
+ErrorFlags RadioDevice::PinThread(thread& streamThread, int cpu)
+{
+#ifdef __linux__
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+	{
+		return ErrorFlags::InvalidParameter;
+	}
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(cpu, &cpuSet);
+	// Fails with EINVAL if the CPU is offline or outside this process's cpuset
+	if (pthread_setaffinity_np(streamThread.native_handle(), sizeof(cpuSet), &cpuSet) != 0)
+	{
+		return ErrorFlags::InvalidParameter;
+	}
+	return ErrorFlags::None;
+#else
+	return ErrorFlags::OperationUnsupported;
+#endif
+}
+
+ErrorFlags RadioDevice::StopReceiveStream()
+{
+	if (!isReceiveStreaming)
 	{
 		return ErrorFlags::None;
 	}
-	else
+	isReceiveStreaming = false;
+	receiveRing->Shutdown();
+	if (receiveThread.joinable())
 	{
-		return ErrorFlags::Unsuccessful;
+		receiveThread.join();
+	}
+	if (receiveRing->GetOverflowCount() > 0 || receiveErrorCount > 0 || receiveTimeoutCount > 0)
+	{
+		cout << "Receive stream stopped. Overflows: " << receiveRing->GetOverflowCount() << " (" << receiveRing->GetDroppedBytes() << " bytes dropped), read timeouts: "
+			<< receiveTimeoutCount << ", read errors: " << receiveErrorCount << endl;
+	}
+	receiveRing.reset();
+	return ErrorFlags::None;
+}
+
+void RadioDevice::ReceiveStreamLoop()
+{
+	if (receiveNumTransfers > 1 && ERROR_FLAGS_SUCCESS(ReceiveStreamQueued()))
+	{
+		return;
+	}
+	while (isReceiveStreaming)
+	{
+		uint8_t* slot = receiveRing->AcquireWrite();
+		ULONG numTransferred = 0;
+		uint32_t flags = 0;
+		// Local status; ftStatus belongs to the command path running on other threads
+		FT_STATUS readStatus = transport->ReadPipe(deviceHandle, IQ_READ_PIPE, slot, (ULONG)receiveRing->GetSlotBytes(), &numTransferred, NULL);
+		if (FT_FAILED(readStatus))
+		{
+			flags = CountReceiveFailure(readStatus);
+		}
+		// Only hand out whole IQ samples. Empty commits still carry the flags on to the next slot with data.
+		if (numTransferred % BYTES_PER_IQ_SAMPLE != 0)
+		{
+			flags |= RING_SLOT_DATA_LOST;
+		}
+		uint64_t arrivalNs = GetHostTimeNs();
+		CountReceivedSamples(numTransferred);
+		receiveRing->CommitWrite((uint32_t)(numTransferred - numTransferred % BYTES_PER_IQ_SAMPLE), flags, arrivalNs);
+		if (FT_FAILED(readStatus) && readStatus != FT_TIMEOUT)
+		{
+			// Don't spin if the device has gone away
+			this_thread::sleep_for(chrono::milliseconds(1));
+		}
+	}
+}
+
+ErrorFlags RadioDevice::ReceiveStreamQueued()
+{
+	uint32_t numTransfers = receiveNumTransfers;
+	ULONG transferBytes = receiveRing->GetSlotBytes();
+	vector<OVERLAPPED> overlapped(numTransfers);
+	// Result of queueing each read; anything but FT_IO_PENDING/FT_OK means there is nothing to wait for
+	vector<FT_STATUS> queueStatus(numTransfers, FT_OTHER_ERROR);
+	for (uint32_t i = 0; i < numTransfers; i++)
+	{
+		memset(&overlapped[i], 0, sizeof(OVERLAPPED));
+		FT_STATUS initStatus = transport->InitializeOverlapped(deviceHandle, &overlapped[i]);
+		if (FT_FAILED(initStatus))
+		{
+			cout << "Overlapped reads unavailable (" << initStatus << "), falling back to one transfer at a time." << endl;
+			for (uint32_t j = 0; j < i; j++)
+			{
+				transport->ReleaseOverlapped(deviceHandle, &overlapped[j]);
+			}
+			return ErrorFlags::OperationUnsupported;
+		}
+	}
+	// Fixed size reads let the driver keep requests posted on the pipe
+	transport->SetStreamPipe(deviceHandle, false, false, IQ_READ_PIPE, transferBytes);
+
+	// Each read goes into the ring slot acquired for it. Reads complete in the order they were queued, which is the order the ring expects them committed in.
+	for (uint32_t i = 0; i < numTransfers; i++)
+	{
+		ULONG numTransferred = 0;
+		queueStatus[i] = transport->ReadPipe(deviceHandle, IQ_READ_PIPE, receiveRing->AcquireWrite(), transferBytes, &numTransferred, &overlapped[i]);
+	}
+	uint32_t next = 0;
+	while (isReceiveStreaming)
+	{
+		ULONG numTransferred = 0;
+		FT_STATUS readStatus = queueStatus[next];
+		if (readStatus == FT_IO_PENDING || readStatus == FT_OK)
+		{
+			readStatus = transport->GetOverlappedResult(deviceHandle, &overlapped[next], &numTransferred, true);
+		}
+		uint32_t flags = 0;
+		if (FT_FAILED(readStatus))
+		{
+			flags = CountReceiveFailure(readStatus);
+		}
+		if (numTransferred % BYTES_PER_IQ_SAMPLE != 0)
+		{
+			flags |= RING_SLOT_DATA_LOST;
+		}
+		// Empty commits keep the ring in step with the queue when a read times out or fails
+		uint64_t arrivalNs = GetHostTimeNs();
+		CountReceivedSamples(numTransferred);
+		receiveRing->CommitWrite((uint32_t)(numTransferred - numTransferred % BYTES_PER_IQ_SAMPLE), flags, arrivalNs);
+		queueStatus[next] = transport->ReadPipe(deviceHandle, IQ_READ_PIPE, receiveRing->AcquireWrite(), transferBytes, &numTransferred, &overlapped[next]);
+		if (queueStatus[next] != FT_IO_PENDING && queueStatus[next] != FT_OK)
+		{
+			// Don't spin if the device has gone away
+			this_thread::sleep_for(chrono::milliseconds(1));
+		}
+		next = (next + 1) % numTransfers;
+	}
+
+	// The driver must be done with every buffer before the ring is freed
+	transport->AbortPipe(deviceHandle, IQ_READ_PIPE);
+	for (uint32_t i = 0; i < numTransfers; i++)
+	{
+		if (queueStatus[i] == FT_IO_PENDING || queueStatus[i] == FT_OK)
+		{
+			ULONG numTransferred = 0;
+			transport->GetOverlappedResult(deviceHandle, &overlapped[i], &numTransferred, true);
+		}
+		transport->ReleaseOverlapped(deviceHandle, &overlapped[i]);
+	}
+	transport->ClearStreamPipe(deviceHandle, false, false, IQ_READ_PIPE);
+	return ErrorFlags::None;
+}
+
+uint32_t RadioDevice::CountReceiveFailure(FT_STATUS readStatus)
+{
+	if (readStatus == FT_TIMEOUT)
+	{
+		receiveTimeoutCount++;
+		return RING_SLOT_READ_TIMEOUT;
+	}
+	receiveErrorCount++;
+	return RING_SLOT_READ_ERROR;
+}
+
+ErrorFlags RadioDevice::AcquireReceiveData(const uint8_t*& rawIQBytes, uint32_t& numBytes, uint32_t& flags, uint64_t& timestampNs, uint32_t timeoutMs)
+{
+	if (!isReceiveStreaming)
+	{
+		return ErrorFlags::InvalidState;
+	}
+	if (!receiveRing->AcquireRead(rawIQBytes, numBytes, flags, timestampNs, timeoutMs))
+	{
+		return ErrorFlags::NotResponding;
+	}
+	return ErrorFlags::None;
+}
+
+void RadioDevice::ReleaseReceiveData(uint32_t numBytes)
+{
+	if (isReceiveStreaming)
+	{
+		receiveRing->ReleaseRead(numBytes);
+	}
+}
+
+uint64_t RadioDevice::GetReceiveOverflowCount()
+{
+	return receiveRing ? receiveRing->GetOverflowCount() : 0;
+}
+
+uint64_t RadioDevice::GetReceivedSampleCount()
+{
+	return receiveSampleCount;
+}
+
+void RadioDevice::CountReceivedSamples(ULONG numBytes)
+{
+	// Transfers don't have to end on a frame boundary with several channels active
+	uint64_t numFrameBytes = receivePartialFrameBytes + numBytes - numBytes % BYTES_PER_IQ_SAMPLE;
+	receiveSampleCount += numFrameBytes / receiveFrameBytes;
+	receivePartialFrameBytes = (uint32_t)(numFrameBytes % receiveFrameBytes);
+	receiveSampleTimeNs = TransmitPacer::GetMonotonicNs();
+}
+
+uint64_t RadioDevice::EstimateReceivedSamples(uint64_t sampleRate)
+{
+	uint64_t count = receiveSampleCount;
+	uint64_t countTimeNs = receiveSampleTimeNs;
+	uint64_t nowNs = TransmitPacer::GetMonotonicNs();
+	if (sampleRate == 0 || countTimeNs == 0 || nowNs <= countTimeNs)
+	{
+		return count;
 	}
+	// The count only moves once per USB transfer; the device keeps sampling in between. Never run ahead by more than the transfer in flight.
+	uint64_t sinceCount = (uint64_t)((double)(nowNs - countTimeNs) * sampleRate / 1e9);
+	return count + min<uint64_t>(sinceCount, receiveTransferSamples);
+}
+
+uint64_t RadioDevice::GetReceiveTimeoutCount()
+{
+	return receiveTimeoutCount;
+}
+
+uint64_t RadioDevice::GetReceiveErrorCount()
+{
+	return receiveErrorCount;
+}
+
+uint64_t RadioDevice::GetHostTimeNs()
+{
+	return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
 }
 
 /// <summary>
@@ -731,9 +1811,8 @@ ErrorFlags RadioDevice::ReceiveSamples(uint8_t*& rawIQBytes, uint64_t numReceive
 /// <returns></returns>
 ErrorFlags RadioDevice::TransmitSamples(uint8_t* rawIQBytes, uint64_t numTransmitBytes)
 {
-	ULONG numBytesTransferred = 0;
-	ftStatus = FT_WritePipe(deviceHandle, IQ_WRITE_PIPE, rawIQBytes, (ULONG)numTransmitBytes, &numBytesTransferred, NULL);
-	if (FT_SUCCESS(ftStatus))
+	FT_STATUS writeStatus = WriteTransmitPipe(rawIQBytes, (ULONG)numTransmitBytes);
+	if (FT_SUCCESS(writeStatus))
 	{
 		return ErrorFlags::None;
 	}
@@ -743,6 +1822,218 @@ ErrorFlags RadioDevice::TransmitSamples(uint8_t* rawIQBytes, uint64_t numTransmi
 	}
 }
 
+ErrorFlags RadioDevice::StartTransmitStream(uint64_t ringSizeBytes, uint32_t transferBytes, uint64_t prefillBytes, double leadSeconds, bool isBurstMode)
+{
+	if (!isSetup)
+	{
+		return ErrorFlags::NotInitialized;
+	}
+	if (isTransmitStreaming)
+	{
+		return ErrorFlags::AlreadyRunning;
+	}
+	transferBytes = max(BYTES_PER_IQ_SAMPLE, transferBytes - transferBytes % BYTES_PER_IQ_SAMPLE);
+	uint64_t numSlots = max<uint64_t>(2, (ringSizeBytes + transferBytes - 1) / transferBytes);
+	transmitRing.reset(new SampleRing((uint32_t)numSlots, transferBytes, OverflowPolicy::Block));
+	// A full ring still has one slot out with the producer. At least one slot, so an empty ring is waited out instead of counted over and over.
+	transmitPrefillBytes = max<uint64_t>(transferBytes, min<uint64_t>(prefillBytes, (numSlots - 1) * transferBytes));
+	transmitLeadTime = leadSeconds;
+	isTransmitBurstMode = isBurstMode;
+	transmitBurstEndsQueued = 0;
+	transmitUnderflowCount = 0;
+	transmitErrorCount = 0;
+	transmitLateCount = 0;
+	transmitBytesSubmitted = 0;
+	transmitBytesAccepted = 0;
+	isTransmitStreaming = true;
+	transmitThread = thread(&RadioDevice::TransmitStreamLoop, this);
+	if (transmitThreadCpu >= 0 && ERROR_FLAGS_FAILURE(PinThread(transmitThread, transmitThreadCpu)))
+	{
+		cout << "Failed to pin the transmit thread to CPU " << transmitThreadCpu << ", leaving it to the scheduler." << endl;
+	}
+	return ErrorFlags::None;
+}
+
+ErrorFlags RadioDevice::StopTransmitStream()
+{
+	if (!isTransmitStreaming)
+	{
+		return ErrorFlags::None;
+	}
+	// The writer drains the ring before it exits
+	isTransmitStreaming = false;
+	if (transmitThread.joinable())
+	{
+		transmitThread.join();
+	}
+	transmitRing->Shutdown();
+	if (transmitUnderflowCount > 0 || transmitErrorCount > 0 || transmitLateCount > 0)
+	{
+		cout << "Transmit stream stopped. Underflows: " << transmitUnderflowCount << ", late writes: " << transmitLateCount << ", write errors: "
+			<< transmitErrorCount << endl;
+	}
+	transmitRing.reset();
+	return ErrorFlags::None;
+}
+
+void RadioDevice::SetTransmitStreamRate(double sampleRate)
+{
+	transmitSampleRate = sampleRate;
+}
+
+void RadioDevice::TransmitStreamLoop()
+{
+	TransmitPacer pacer;
+	double pacerRate = 0;
+	pacer.SetLeadTime(transmitLeadTime);
+	bool isPrimed = false;
+	while (true)
+	{
+		double sampleRate = transmitSampleRate.load();
+		if (sampleRate != pacerRate)
+		{
+			pacer.SetSampleRate(sampleRate);
+			pacerRate = sampleRate;
+		}
+		bool isStopping = !isTransmitStreaming;
+		if (sampleRate <= 0 && !isStopping)
+		{
+			// Nothing to pace against until the rate is known
+			this_thread::sleep_for(chrono::milliseconds(1));
+			continue;
+		}
+		if (!isPrimed)
+		{
+			if (!isStopping && transmitBurstEndsQueued == 0 && (uint64_t)transmitRing->GetNumQueuedSlots() * transmitRing->GetSlotBytes() < transmitPrefillBytes)
+			{
+				this_thread::sleep_for(chrono::milliseconds(1));
+				continue;
+			}
+			isPrimed = true;
+			pacer.Reset();
+		}
+
+		// The next transfer has to be queued by the time it is due. Being late here means the previous write blocked for too long.
+		if (pacer.Wait(0) > 0)
+		{
+			transmitLateCount++;
+		}
+		const uint8_t* rawIQBytes;
+		uint32_t numBytes;
+		uint32_t flags;
+		uint64_t timestamp;
+		if (!transmitRing->AcquireRead(rawIQBytes, numBytes, flags, timestamp, 0))
+		{
+			if (isStopping)
+			{
+				break;
+			}
+			transmitUnderflowCount++;
+			isPrimed = false;
+			continue;
+		}
+		if (isTransmitBurstMode && (flags & RING_SLOT_START_OF_BURST))
+		{
+			if (timestamp != 0)
+			{
+				// Burst times are wall clock; the pacer runs on the monotonic clock
+				uint64_t hostNowNs = GetHostTimeNs();
+				pacer.StartAt(TransmitPacer::GetMonotonicNs() + (timestamp > hostNowNs ? timestamp - hostNowNs : 0));
+			}
+			else
+			{
+				pacer.Reset();
+			}
+			// Sleep until the burst is due, less the lead time. Late if the requested start time had already passed.
+			if (pacer.Wait(0) > 0)
+			{
+				transmitLateCount++;
+			}
+			StartTransmit();
+		}
+		if (pacer.Wait(numBytes / transmitFrameBytes) > 0)
+		{
+			transmitLateCount++;
+		}
+		// Status is dropped on purpose; ftStatus belongs to the command path running on other threads and failures are counted
+		WriteTransmitPipe(rawIQBytes, numBytes);
+		transmitRing->ReleaseRead(numBytes);
+		if (isTransmitBurstMode && (flags & RING_SLOT_END_OF_BURST))
+		{
+			// Let the tail of the burst play out, then go quiet until the next one. An empty ring in between is not an underflow.
+			pacer.WaitForDrain();
+			StopTransmit();
+			transmitBurstEndsQueued--;
+			isPrimed = false;
+		}
+	}
+}
+
+uint8_t* RadioDevice::AcquireTransmitBuffer()
+{
+	if (!isTransmitStreaming)
+	{
+		return NULL;
+	}
+	return transmitRing->AcquireWrite();
+}
+
+void RadioDevice::CommitTransmitBuffer(uint32_t numBytes, uint32_t flags, uint64_t burstTimeNs)
+{
+	if (isTransmitStreaming)
+	{
+		if (flags & RING_SLOT_END_OF_BURST)
+		{
+			transmitBurstEndsQueued++;
+		}
+		transmitRing->CommitWrite(numBytes - numBytes % BYTES_PER_IQ_SAMPLE, flags, burstTimeNs);
+	}
+}
+
+uint64_t RadioDevice::GetTransmitUnderflowCount()
+{
+	return transmitUnderflowCount;
+}
+
+FT_STATUS RadioDevice::WriteTransmitPipe(const uint8_t* rawIQBytes, ULONG numBytes)
+{
+	ULONG numBytesTransferred = 0;
+	FT_STATUS writeStatus = transport->WritePipe(deviceHandle, IQ_WRITE_PIPE, (PUCHAR)rawIQBytes, numBytes, &numBytesTransferred, NULL);
+	transmitBytesSubmitted += numBytes;
+	transmitBytesAccepted += min(numBytesTransferred, numBytes);
+	if (FT_FAILED(writeStatus))
+	{
+		transmitErrorCount++;
+	}
+	return writeStatus;
+}
+
+ErrorFlags RadioDevice::GetTransmitStatistics(TransmitStatistics& statistics)
+{
+	statistics.bytesSubmitted = transmitBytesSubmitted;
+	statistics.bytesAccepted = transmitBytesAccepted;
+	statistics.failedWrites = transmitErrorCount;
+	statistics.lateWrites = transmitLateCount;
+	statistics.underflows = transmitUnderflowCount;
+	statistics.driverQueueBytes = 0;
+	statistics.ringQueueBytes = 0;
+	if (!isSetup)
+	{
+		return ErrorFlags::NotInitialized;
+	}
+	// FIFO IDs count the write pipes from 0x02
+	DWORD queuedBytes = 0;
+	if (FT_SUCCESS(transport->GetWriteQueueStatus(deviceHandle, (UCHAR)((IQ_WRITE_PIPE & 0x0F) - 2), &queuedBytes)))
+	{
+		statistics.driverQueueBytes = queuedBytes;
+	}
+	if (isTransmitStreaming)
+	{
+		statistics.ringQueueBytes = (uint64_t)transmitRing->GetNumQueuedSlots() * transmitRing->GetSlotBytes();
+	}
+	return ErrorFlags::None;
+}
+
 ErrorFlags RadioDevice::GetReferenceSource(bool& isInternal)
 {
 	isInternal = true;
@@ -3,9 +3,20 @@
 #include "ftd3xx.h"
 #include "ErrorFlags.h"
 #include "DeviceCommand.h"
+#include "DeviceTransport.h"
+#include "SampleRing.h"
+#include "TransmitPacer.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 namespace THR
@@ -82,6 +93,149 @@ namespace THR
 		ProductInfo(std::string serialNum, std::string description) : serialNumber(serialNum), deviceDescription(description){}
 	};
 
+	/// <summary>
+	/// Snapshot of the transmit counters, see RadioDevice::GetTransmitStatistics(). Counters cover both TransmitSamples() and the background writer
+	/// since the device was created or the last StartTransmitStream().
+	/// </summary>
+	struct TransmitStatistics
+	{
+		/// <summary>
+		/// Bytes handed to the IQ write pipe.
+		/// </summary>
+		uint64_t bytesSubmitted = 0;
+		/// <summary>
+		/// Bytes the driver reported as written (numBytesTransferred). Less than bytesSubmitted after short or failed writes.
+		/// </summary>
+		uint64_t bytesAccepted = 0;
+		/// <summary>
+		/// Writes that returned an error.
+		/// </summary>
+		uint64_t failedWrites = 0;
+		/// <summary>
+		/// Background writer only: writes issued after their pacing deadline had passed, i.e. the device may have run dry.
+		/// </summary>
+		uint64_t lateWrites = 0;
+		/// <summary>
+		/// Background writer only: times the ring was empty when the next write was due.
+		/// </summary>
+		uint64_t underflows = 0;
+		/// <summary>
+		/// Bytes waiting in the driver's write queue for the IQ pipe when the snapshot was taken (FT_GetWriteQueueStatus), 0 if it couldn't be read.
+		/// </summary>
+		uint32_t driverQueueBytes = 0;
+		/// <summary>
+		/// Bytes waiting in the background writer's ring when the snapshot was taken.
+		/// </summary>
+		uint64_t ringQueueBytes = 0;
+	};
+
+	/// <summary>
+	/// How long each phase of the last RadioDevice::Setup() took, see RadioDevice::GetSetupTiming(). Phases that were skipped are 0.
+	/// </summary>
+	struct SetupTiming
+	{
+		/// <summary>
+		/// Whether the fast open path was taken.
+		/// </summary>
+		bool isFastOpen = false;
+		/// <summary>
+		/// Listing the connected FTDI devices to find a SABR (FT_CreateDeviceInfoList and the per-device info reads). Only done by Setup() without a serial number.
+		/// </summary>
+		uint64_t enumerateNs = 0;
+		/// <summary>
+		/// FT_Create by serial number.
+		/// </summary>
+		uint64_t openNs = 0;
+		/// <summary>
+		/// Reading the USB descriptors.
+		/// </summary>
+		uint64_t descriptorNs = 0;
+		/// <summary>
+		/// Reading and, on a freshly plugged device, configuring the GPIO.
+		/// </summary>
+		uint64_t gpioNs = 0;
+		/// <summary>
+		/// Trying to get the device onto USB 3.0 by resetting its port and reopening it. Dominates everything else when it runs.
+		/// </summary>
+		uint64_t superSpeedNs = 0;
+		/// <summary>
+		/// Setting the pipe timeouts.
+		/// </summary>
+		uint64_t timeoutsNs = 0;
+		/// <summary>
+		/// The whole Setup() call.
+		/// </summary>
+		uint64_t totalNs = 0;
+	};
+
+	/// <summary>
+	/// Environment variable that makes every RadioDevice print its SetupTiming once Setup() returns. Any value enables it.
+	/// </summary>
+	extern const char* const SETUP_TIMING_ENV;
+
+	/// <summary>
+	/// One command of a RadioDevice::ProcessCommandBatch() call, and its outcome.
+	/// </summary>
+	struct CommandRequest
+	{
+		CommandType commandType;
+		int radioChannel;
+		bool isSetCommand;
+		CommandPayloadValue commandPayload;
+		/// <summary>
+		/// Payload of the device's response. Only meaningful if result is ErrorFlags::None.
+		/// </summary>
+		CommandPayloadValue responsePayload;
+		/// <summary>
+		/// Outcome of this command on its own.
+		/// </summary>
+		ErrorFlags result;
+
+		CommandRequest() : commandType(CommandType::Nop), radioChannel(0), isSetCommand(false), result(ErrorFlags::None){}
+		CommandRequest(CommandType commandType, int radioChannel, bool isSetCommand, CommandPayloadValue commandPayload = CommandPayloadValue())
+			: commandType(commandType), radioChannel(radioChannel), isSetCommand(isSetCommand), commandPayload(commandPayload), result(ErrorFlags::None){}
+	};
+
+	/// <summary>
+	/// Passed to the RadioDevice command completion handler once the device has answered a command queued with one of the *Async() setters.
+	/// </summary>
+	struct CommandCompletion
+	{
+		CommandType commandType;
+		int radioChannel;
+		bool isSetCommand;
+		/// <summary>
+		/// What the device reported back, typically the value it applied.
+		/// </summary>
+		CommandPayloadValue responsePayload;
+		ErrorFlags result;
+		/// <summary>
+		/// RadioDevice::GetHostTimeNs() when the response arrived.
+		/// </summary>
+		uint64_t hostTimeNs;
+		/// <summary>
+		/// RadioDevice::GetReceivedSampleCount() when the response arrived. The change applies from around this sample of the receive stream on.
+		/// </summary>
+		uint64_t receiveSampleIndex;
+	};
+
+	typedef std::function<void(const CommandCompletion&)> CommandCompletionHandler;
+
+	/// <summary>
+	/// One entry of a RadioDevice hop schedule.
+	/// </summary>
+	struct HopDwell
+	{
+		/// <summary>
+		/// LO frequency, in Hz.
+		/// </summary>
+		uint64_t frequency;
+		/// <summary>
+		/// How many received samples to stay on it for, counted from where this dwell was due to start.
+		/// </summary>
+		uint64_t numSamples;
+	};
+
 #define CHECK_DEVICE_STATUS(status) ((status) == FT_OK)
 
 	class RadioDevice
@@ -92,16 +246,23 @@ namespace THR
 		bool isTransmitEnabled = false;
 		std::string attachedSerialNumber;
 		std::mutex commandSyncObject;
-		FT_HANDLE deviceHandle;
+		// A batch went unanswered, so late responses to it may still turn up on the command read pipe. Guarded by commandSyncObject.
+		bool isCommandPipeStale = false;
+		std::shared_ptr<DeviceTransport> transport;
+		FT_HANDLE deviceHandle = NULL;
 		FT_STATUS ftStatus;
 		uint16_t uwVID;
 		uint16_t uwPID;
 		bool isUSB3 = false;
+		// Setup() was asked to skip everything not needed to stream, see Setup(std::string, bool)
+		bool isFastOpen = false;
+		SetupTiming setupTiming;
 		const uint32_t FAST_RATE_STREAM_SIZE_BYTES = 4194304;
 		const uint32_t MED_RATE_STREAM_SIZE_BYTES = 1048576;
 		const uint32_t MED_LOW_RATE_STREAM_SIZE_BYTES = 262144;
 		const uint32_t SLOW_RATE_STREAM_SIZE_BYTES = 65536;
 		uint32_t iqStreamSize = MED_RATE_STREAM_SIZE_BYTES;
+		const uint32_t BYTES_PER_IQ_SAMPLE = 4;
 		const char IQ_READ_PIPE = 0x82;
 		const char IQ_WRITE_PIPE = 0x02;
 		const char CMD_READ_PIPE = 0x83;
@@ -109,6 +270,27 @@ namespace THR
 		const float MIN_ATTENUATION = 0.0f;
 		const float MAX_ATTENUATION = 89.75f;
 		const DWORD CMD_PIPE_TIMEOUT_MS = 2500;
+		// How long SetupSuperSpeed() waits for the device to come back after resetting it, and how often it tries to reopen it meanwhile
+		const uint32_t REOPEN_TIMEOUT_MS = 5000;
+		const uint32_t REOPEN_MIN_POLL_MS = 5;
+		const uint32_t REOPEN_MAX_POLL_MS = 250;
+		// Commands per write on the command pipe; larger batches are split
+		static const uint32_t MAX_COMMAND_BATCH = 16;
+
+		// Shadow copy of one channel setting, see TransactCommands()
+		struct ShadowRegister
+		{
+			bool isValid;
+			// Last value the device reported for the setting
+			uint64_t value;
+			// Last value a set asked for, so repeating it is a no-op even if the device rounded it
+			uint64_t requestedValue;
+		};
+		static const int NUM_SHADOW_SETTINGS = 5;
+		// One per value of the 4 bit channel field
+		static const int NUM_SHADOW_CHANNELS = 16;
+		// LO, gain (attenuation on TX channels), gain mode, bandwidth and sample rate per channel. Guarded by commandSyncObject.
+		ShadowRegister shadowRegisters[NUM_SHADOW_SETTINGS][NUM_SHADOW_CHANNELS] = {};
 		const DWORD IQ_PIPE_TIMEOUT_MS = 1000;
 		const uint64_t MIN_LO = 70000000;
 		const uint64_t MAX_LO = 6000000000;
@@ -143,9 +325,25 @@ namespace THR
 			61440000
 		};
 
+		/// <summary>
+		/// Read the device descriptor to find out whether the device enumerated at USB 3.0. Without isFastOpen the string and configuration
+		/// descriptors are read as well.
+		/// </summary>
+		/// <returns></returns>
 		ErrorFlags GetDescriptors();
 
-		ErrorFlags DeviceSetup();
+		/// <summary>
+		/// Open attachedSerialNumber and bring it up, recording each phase in setupTiming.
+		/// </summary>
+		/// <param name="setupStartNs">TransmitPacer::GetMonotonicNs() when Setup() was called, so the total includes any enumeration.</param>
+		/// <returns></returns>
+		ErrorFlags DeviceSetup(uint64_t setupStartNs);
+
+		/// <summary>
+		/// The steps of DeviceSetup(), which adds the total and the report around them.
+		/// </summary>
+		/// <returns></returns>
+		ErrorFlags DeviceSetupPhases();
 
 		/// <summary>
 		/// Attempt to open up the first found FTDI device.
@@ -171,11 +369,353 @@ namespace THR
 		/// <returns></returns>
 		ErrorFlags SetTimeouts();
 
+		// Background IQ reader, see StartReceiveStream()
+		std::unique_ptr<SampleRing> receiveRing;
+		std::thread receiveThread;
+		std::atomic<bool> isReceiveStreaming{false};
+		std::atomic<uint64_t> receiveErrorCount{0};
+		std::atomic<uint64_t> receiveTimeoutCount{0};
+		// Whole samples read from the IQ pipe, see GetReceivedSampleCount()
+		std::atomic<uint64_t> receiveSampleCount{0};
+		// When receiveSampleCount last moved (TransmitPacer::GetMonotonicNs(), so a wall clock step can't throw the hop timing), and by how much
+		// it moves per transfer at most; see EstimateReceivedSamples()
+		std::atomic<uint64_t> receiveSampleTimeNs{0};
+		std::atomic<uint32_t> receiveTransferSamples{0};
+		// Bytes per frame (one sample of every active channel) on each IQ pipe, following the last multiplex mode read or set
+		std::atomic<uint32_t> receiveFrameBytes{4};
+		std::atomic<uint32_t> transmitFrameBytes{4};
+		// Reader side only: bytes of a frame the last transfer ended in the middle of
+		uint32_t receivePartialFrameBytes = 0;
+
+		/// <summary>
+		/// Update receiveFrameBytes and transmitFrameBytes for a multiplex mode the device has confirmed.
+		/// </summary>
+		void UpdateFrameBytes(IQChannelConfig channelConfig);
+
+		/// <summary>
+		/// Add a completed IQ read to receiveSampleCount.
+		/// </summary>
+		void CountReceivedSamples(ULONG numBytes);
+
+		/// <summary>
+		/// receiveSampleCount extrapolated to now at the given sample rate, for timing finer than one USB transfer.
+		/// </summary>
+		uint64_t EstimateReceivedSamples(uint64_t sampleRate);
+		uint32_t receiveNumTransfers = 1;
+		// CPU the reader and writer threads are pinned to, -1 to leave them to the OS scheduler
+		int receiveThreadCpu = -1;
+		int transmitThreadCpu = -1;
+
+		/// <summary>
+		/// Pin a streaming thread to one CPU. Only supported on Linux, elsewhere the thread is left alone.
+		/// </summary>
+		/// <returns>InvalidParameter if the CPU doesn't exist or isn't available to this process, OperationUnsupported if pinning isn't supported.</returns>
+		static ErrorFlags PinThread(std::thread& streamThread, int cpu);
+
+		/// <summary>
+		/// Reader thread body. Reads the IQ pipe straight into receiveRing slots until StopReceiveStream() is called.
+		/// </summary>
+		void ReceiveStreamLoop();
+
+		/// <summary>
+		/// Reader thread body when more than one transfer is requested. Keeps receiveNumTransfers overlapped reads queued on the IQ pipe so the bus never
+		/// waits for the host to issue the next request.
+		/// </summary>
+		/// <returns>OperationUnsupported if the transport can't do overlapped I/O, in which case nothing was read.</returns>
+		ErrorFlags ReceiveStreamQueued();
+
+		/// <summary>
+		/// Count a failed IQ read and get the RING_SLOT_* flag that marks the gap it leaves in the stream.
+		/// </summary>
+		uint32_t CountReceiveFailure(FT_STATUS readStatus);
+
+		// Background IQ writer, see StartTransmitStream()
+		std::unique_ptr<SampleRing> transmitRing;
+		std::thread transmitThread;
+		std::atomic<bool> isTransmitStreaming{false};
+		std::atomic<uint64_t> transmitUnderflowCount{0};
+		std::atomic<uint64_t> transmitErrorCount{0};
+		std::atomic<uint64_t> transmitLateCount{0};
+		std::atomic<uint64_t> transmitBytesSubmitted{0};
+		std::atomic<uint64_t> transmitBytesAccepted{0};
+		std::atomic<double> transmitSampleRate{0};
+		uint64_t transmitPrefillBytes = 0;
+		double transmitLeadTime = 0;
+		bool isTransmitBurstMode = false;
+		// Bursts whose end has been queued but not written yet; lets a burst shorter than the prefill go out
+		std::atomic<uint32_t> transmitBurstEndsQueued{0};
+
+		/// <summary>
+		/// Writer thread body. Waits for the prefill, then writes transmitRing slots to the IQ pipe at the sample rate until StopTransmitStream() is called
+		/// and everything queued has been sent.
+		/// </summary>
+		void TransmitStreamLoop();
+
+		/// <summary>
+		/// Write to the IQ pipe and update the transmit counters.
+		/// </summary>
+		FT_STATUS WriteTransmitPipe(const uint8_t* rawIQBytes, ULONG numBytes);
+
 		ErrorFlags ProcessCommand(CommandType commandType, int radioChannel, bool isSetCommand, CommandPayloadValue commandPayload, CommandPayloadValue& responsePayload);
-		ErrorFlags CommandChannelTransact(DeviceCommand command, DeviceCommand*& response);
-		ErrorFlags CommandChannelTransmit(DeviceCommand command);
-		ErrorFlags CommandChannelReceive(DeviceCommand*& response);
+		ErrorFlags CommandChannelTransmit(const uint8_t* frames, ULONG numBytes);
+
+		/// <summary>
+		/// Send up to MAX_COMMAND_BATCH commands in one write and fill in each one's result and response. Uses no heap memory.
+		/// </summary>
+		void TransactCommands(CommandRequest* commands, uint32_t numCommands);
+		ErrorFlags CommandChannelReceive(uint8_t* frames, ULONG bufferLength, ULONG& numBytes);
+
+		/// <summary>
+		/// Turn a response frame from the device into the ErrorFlags for the command it answers.
+		/// </summary>
+		ErrorFlags CheckResponse(const DeviceCommand& response);
+
+		/// <summary>
+		/// The shadow register for a setting, or NULL if the command type isn't cached.
+		/// </summary>
+		ShadowRegister* FindShadowRegister(CommandType commandType, int radioChannel);
+
+		/// <summary>
+		/// Answer a command from the shadow registers if that's safe: a get of a known setting, or a set to the value the setting already has.
+		/// Gain gets are only answered from the cache while the channel's gain mode is known to be Manual; an AGC, or a mode not read back yet, goes to the device.
+		/// </summary>
+		/// <returns>true if the command is complete and doesn't need to be sent.</returns>
+		bool TryShadowCommand(CommandRequest& command);
+
+		// Background command executor, see SubmitCommand()
+		struct AsyncCommand
+		{
+			CommandRequest command;
+			std::shared_ptr<std::promise<ErrorFlags>> promise;
+			std::shared_future<ErrorFlags> future;
+		};
+		std::mutex asyncCommandMutex;
+		std::condition_variable asyncCommandReady;
+		std::deque<AsyncCommand> asyncCommands;
+		std::thread asyncCommandThread;
+		bool isAsyncCommandRunning = false;
+		uint32_t asyncCommandGeneration = 0;
+		// Channels claimed by the users of a shared device, see ClaimReceiveChannels()
+		std::mutex channelClaimMutex;
+		int claimedReceiveChannels = 0;
+		int claimedTransmitChannels = 0;
+
+		/// <summary>
+		/// Switch the multiplex mode to carry the given channels. Called with channelClaimMutex held.
+		/// </summary>
+		ErrorFlags ApplyChannelClaims(int numReceive, int numTransmit);
+
+		// Registered with AddCommandCompletionHandler(). The mutex is held while they run.
+		std::mutex completionHandlerMutex;
+		std::map<uint32_t, CommandCompletionHandler> completionHandlers;
+		uint32_t nextCompletionHandlerId = 1;
+
+		// Hop schedule engine, see StartHopSchedule()
+		std::thread hopThread;
+		std::atomic<bool> isHopping{false};
+		std::atomic<uint64_t> lateHopCount{0};
+		std::vector<HopDwell> hopSchedule;
+		int hopChannel = 0;
+		bool isHopRepeating = true;
+
+		/// <summary>
+		/// Hop engine thread body. Follows the received sample count and queues each LO change early by the measured command latency so it lands
+		/// on the dwell boundary.
+		/// </summary>
+		void HopLoop();
+
+		/// <summary>
+		/// Queue a command for the executor thread, starting it if needed. A set that is still queued for the same setting and channel is replaced
+		/// by the new value instead and moved to the back of the queue, so it still goes out after anything queued since; both callers get the same future.
+		/// </summary>
+		std::shared_future<ErrorFlags> SubmitCommand(const CommandRequest& command);
+
+		/// <summary>
+		/// Executor thread body. Sends whatever is queued as one batch, then completes the futures and calls the completion handler.
+		/// </summary>
+		void AsyncCommandLoop(uint32_t generation);
+
+		/// <summary>
+		/// Send whatever is still queued and stop the executor thread.
+		/// </summary>
+		void StopAsyncCommands();
+
+		/// <summary>
+		/// Drop the shadow registers a set command is about to change, including the ones it changes as a side effect.
+		/// </summary>
+		void InvalidateShadowRegisters(const CommandRequest& command);
+
+		/// <summary>
+		/// Update the shadow registers from a command the device has answered.
+		/// </summary>
+		void UpdateShadowRegisters(const CommandRequest& command);
+
+		/// <summary>
+		/// Forget every shadowed setting. The caller holds commandSyncObject.
+		/// </summary>
+		void ClearShadowRegisters();
+
+		/// <summary>
+		/// Host side effects of a sample rate the device accepted.
+		/// </summary>
+		void ApplySampleRate(uint64_t sampleRate);
+
+		/// <summary>
+		/// Round a sample rate read back from the device to the even rate it stands for.
+		/// </summary>
+		static uint64_t CorrectReportedSampleRate(uint64_t sampleRate);
+
+		/// <summary>
+		/// Shared by ConfigureReceiveChannel()/ConfigureTransmitChannel(): append LO and sample rate readbacks to a batch of sets and run it.
+		/// commands must have room for numSets + 2 entries.
+		/// </summary>
+		ErrorFlags ConfigureChannel(CommandRequest* commands, size_t numSets, int radioChannel, uint64_t& frequency, uint64_t& sampleRate);
 	public:
+		/// <summary>
+		/// Create a RadioDevice using the FTDI driver, or the virtual SABR if the SABR_VIRTUAL_DEVICE environment variable is set.
+		/// </summary>
+		RadioDevice();
+
+		/// <summary>
+		/// Create a RadioDevice on top of a specific transport (for instance a VirtualDeviceTransport for benchmarks).
+		/// </summary>
+		/// <param name="deviceTransport">The transport all device I/O goes through.</param>
+		explicit RadioDevice(std::shared_ptr<DeviceTransport> deviceTransport);
+
+		/// <summary>
+		/// Stops the receive and transmit streams if they are still running.
+		/// </summary>
+		~RadioDevice();
+
+		/// <summary>
+		/// Send several commands in one write on the command pipe and collect their responses, matched by command and channel, so the whole batch costs
+		/// a single USB turnaround. Commands are applied by the device in order. Responses that don't belong to the batch (left over from an earlier
+		/// timeout) are discarded.
+		/// </summary>
+		/// <param name="commands">Commands to send. Each one gets its own result and response payload.</param>
+		/// <returns>None if every command succeeded, otherwise the result of the first one that failed.</returns>
+		ErrorFlags ProcessCommandBatch(std::vector<CommandRequest>& commands);
+
+		/// <summary>
+		/// Queue an LO change without waiting for the device. Commands queued this way are sent in order from a background thread, several per
+		/// USB round trip, and a newer value for a setting that hasn't been sent yet replaces the older one.
+		/// </summary>
+		/// <param name="radioChannel">The RadioChannel this should apply to.</param>
+		/// <param name="frequency">The desired LO frequency, in Hz.</param>
+		/// <returns>Becomes ready with the same ErrorFlags SetLOFrequency() would have returned.</returns>
+		std::shared_future<ErrorFlags> SetLOFrequencyAsync(int radioChannel, uint64_t frequency);
+
+		/// <summary>
+		/// Queue a gain change without waiting for the device. See SetLOFrequencyAsync().
+		/// </summary>
+		std::shared_future<ErrorFlags> SetGainAsync(int radioChannel, int gain);
+
+		/// <summary>
+		/// Queue a gain mode change without waiting for the device. See SetLOFrequencyAsync().
+		/// </summary>
+		std::shared_future<ErrorFlags> SetGainModeAsync(int radioChannel, RadioGainMode gainMode);
+
+		/// <summary>
+		/// Queue a bandwidth change without waiting for the device. See SetLOFrequencyAsync().
+		/// </summary>
+		std::shared_future<ErrorFlags> SetComplexBandwidthAsync(int radioChannel, uint64_t bandwidth);
+
+		/// <summary>
+		/// Queue a sample rate change without waiting for the device. See SetLOFrequencyAsync().
+		/// </summary>
+		std::shared_future<ErrorFlags> SetSampleRateAsync(int radioChannel, uint64_t sampleRate);
+
+		/// <summary>
+		/// Queue a transmit attenuation change without waiting for the device. See SetLOFrequencyAsync().
+		/// </summary>
+		std::shared_future<ErrorFlags> SetTransmitAttenuationAsync(int radioChannel, float attenuation);
+
+		/// <summary>
+		/// Register a handler to be called from the executor thread after each queued command has been answered, before its future becomes ready.
+		/// Keep it short. Every handler sees every command, whoever queued it, so check radioChannel when the device is shared.
+		/// </summary>
+		/// <returns>Id to pass to RemoveCommandCompletionHandler().</returns>
+		uint32_t AddCommandCompletionHandler(CommandCompletionHandler handler);
+
+		/// <summary>
+		/// Unregister a handler. Once this returns the handler isn't running and won't be called again. Don't call it from a handler.
+		/// </summary>
+		void RemoveCommandCompletionHandler(uint32_t handlerId);
+
+		/// <summary>
+		/// Take the receive side of the IQ stream for RX1 up to RX(numChannels), for when several users share the device (see DeviceRegistry).
+		/// There is one IQ pipe per direction, so only one user can receive and one can transmit at a time. The multiplex mode is switched to
+		/// carry these channels plus any claimed transmit channels. Reads and writes then run on their own threads (the reader and writer threads,
+		/// or each user's own) and commands from either side are serialized as usual, so neither direction waits on the other.
+		/// </summary>
+		/// <returns>ResourceUnavailable if someone else already receives, InvalidParameter if no multiplex mode has this many receive channels
+		/// alongside the claimed transmit channels, otherwise see SetMultiplexMode().</returns>
+		ErrorFlags ClaimReceiveChannels(int numChannels);
+
+		/// <summary>
+		/// Transmit counterpart of ClaimReceiveChannels(), for TX1 up to TX(numChannels).
+		/// </summary>
+		ErrorFlags ClaimTransmitChannels(int numChannels);
+
+		/// <summary>
+		/// Give up a claim. The multiplex mode is left alone until the next claim.
+		/// </summary>
+		void ReleaseReceiveChannels();
+		void ReleaseTransmitChannels();
+
+		/// <summary>
+		/// Multiplex mode that streams exactly the given number of receive and transmit channels.
+		/// </summary>
+		/// <returns>false if the device has no such mode.</returns>
+		static bool GetChannelConfig(int numReceive, int numTransmit, IQChannelConfig& channelConfig);
+
+		/// <summary>
+		/// Serial number of the device being used, once Setup() has picked one.
+		/// </summary>
+		const std::string& GetSerialNumber() const { return attachedSerialNumber; }
+
+		/// <summary>
+		/// Number of whole IQ samples per channel (frames, with several receive channels active) read from the device since the receive stream was
+		/// started (or since the device was created when reading synchronously), including any the receive ring later dropped.
+		/// </summary>
+		/// <returns></returns>
+		uint64_t GetReceivedSampleCount();
+
+		/// <summary>
+		/// Hop the LO of one channel through a list of frequencies with fixed dwell times, measured in received samples so they follow the sample
+		/// clock rather than the host scheduler. Each hop goes out on the asynchronous command path (so the completion handler sees it like any
+		/// other LO change), queued ahead of its dwell boundary by the command round trip time. Needs the receive stream running to advance.
+		/// Replaces any schedule that is already running.
+		/// </summary>
+		/// <param name="radioChannel">The RadioChannel to hop.</param>
+		/// <param name="schedule">Frequencies and dwell lengths, in order. The first hop goes out right away.</param>
+		/// <param name="isRepeating">Start over after the last entry instead of staying there.</param>
+		/// <returns>InvalidParameter if the schedule is empty, has a zero length dwell or a frequency out of range.</returns>
+		ErrorFlags StartHopSchedule(int radioChannel, const std::vector<HopDwell>& schedule, bool isRepeating = true);
+
+		/// <summary>
+		/// Stop hopping. The LO stays on the frequency it was last set to.
+		/// </summary>
+		void StopHopSchedule();
+
+		/// <summary>
+		/// Number of hops since StartHopSchedule() that were queued after their dwell boundary had already passed, because the previous hop took
+		/// longer than its dwell or the host stalled.
+		/// </summary>
+		uint64_t GetLateHopCount();
+
+		/// <summary>
+		/// Forget the cached LO, gain, gain mode, bandwidth, sample rate and attenuation settings so the next get reads them from the device.
+		/// The cache is normally kept up to date from command responses and cleared automatically on reset, re-initialization and communication
+		/// failures; this is for when something else may have changed the device.
+		/// </summary>
+		void InvalidateSettingsCache();
+
+		/// <summary>
+		/// Same as ProcessCommandBatch(std::vector&lt;CommandRequest&gt;&amp;) on a caller owned array, so no heap memory is needed.
+		/// </summary>
+		ErrorFlags ProcessCommandBatch(CommandRequest* commands, size_t numCommands);
+
 		/// <summary>
 		/// Determine if there are any connected FTDI devices and return their serial numbers. Also sets the provided boolean to indicate wheter any devices were found.
 		/// </summary>
@@ -183,7 +723,7 @@ namespace THR
 		std::vector<ProductInfo> GetConnectedDevices(bool& deviceFound);
 
 		/// <summary>
-		/// Close the device.
+		/// Close the device. Any hop schedule, queued commands and receive or transmit stream are stopped first.
 		/// </summary>
 		/// <returns></returns>
 		ErrorFlags CloseDevice();
@@ -204,6 +744,22 @@ namespace THR
 		/// <returns></returns>
 		ErrorFlags Setup(std::string deviceSerialNumber);
 
+		/// <summary>
+		/// Same as Setup(std::string), optionally taking the fast path for a device that is known to be connected, e.g. one that was opened
+		/// before: only the device descriptor is read (for the USB 3.0 check), and the GPIO is only touched when the device has to be moved
+		/// to USB 3.0. Nothing is enumerated either way since the serial number is given.
+		/// </summary>
+		/// <param name="deviceSerialNumber">Serial number of the device to setup</param>
+		/// <param name="isFastOpen">Take the fast path.</param>
+		/// <returns></returns>
+		ErrorFlags Setup(std::string deviceSerialNumber, bool isFastOpen);
+
+		/// <summary>
+		/// Phase by phase timing of the last Setup() call. Also printed after each Setup() when SETUP_TIMING_ENV is set.
+		/// </summary>
+		/// <returns></returns>
+		SetupTiming GetSetupTiming() const;
+
 		/// <summary>
 		/// Get the number of bytes that ReceiveSamples() will return if you don't specify the desired number of bytes out. Note that the number of IQ samples will be the 
 		/// returned value divided by 4 since each IQ sample is serialized as 4 bytes (2 bytes for I and 2 bytes for Q).
@@ -226,6 +782,91 @@ namespace THR
 		/// <returns></returns>
 		ErrorFlags ReceiveSamples(uint8_t*& rawIQBytes, uint64_t numReceiveBytes);
 
+		/// <summary>
+		/// Receive raw IQ samples straight into a caller supplied buffer, so the USB driver writes the final destination and nothing is allocated or copied.
+		/// </summary>
+		/// <param name="rawIQBytes">Buffer of at least numReceiveBytes bytes.</param>
+		/// <param name="numReceiveBytes">Number of bytes to request from the radio hardware. Should be a multiple of 4.</param>
+		/// <param name="numReceivedBytes">Number of bytes actually written to rawIQBytes, which can be less than requested.</param>
+		/// <returns>NotResponding if the read timed out, Unsuccessful if it failed otherwise. numReceivedBytes still holds whatever was transferred before
+		/// the failure, and the device may have dropped samples after it.</returns>
+		ErrorFlags ReceiveSamplesInto(uint8_t* rawIQBytes, uint32_t numReceiveBytes, uint32_t& numReceivedBytes);
+
+		/// <summary>
+		/// Start a background thread that keeps reading the IQ pipe into a preallocated ring so the device FIFO is drained even while the caller is busy.
+		/// Samples are then taken out with AcquireReceiveData()/ReleaseReceiveData() instead of ReceiveSamples(). Capture must be enabled separately with StartCapture().
+		/// The ring is made of transfer sized slots (GetIQStreamSize() by default), so set the sample rate before starting the stream.
+		/// </summary>
+		/// <param name="ringSizeBytes">Total ring size in bytes. Rounded up to a whole number of transfers, at least one more than numTransfers.</param>
+		/// <param name="overflowPolicy">What the reader does when the ring is full.</param>
+		/// <param name="numTransfers">Number of reads kept queued on the IQ pipe. 1 issues one blocking read at a time; more keeps the bus busy between completions,
+		/// which is needed to sustain the highest sample rates. Falls back to 1 if the transport doesn't support overlapped I/O.</param>
+		/// <param name="transferBytes">Size of each read in bytes, 0 to use GetIQStreamSize(). Rounded down to whole frames of the active RX channels, so a slot
+		/// dropped on overflow never leaves the next one starting mid-frame. Multiples of 16384 work best with the FTDI driver.</param>
+		/// <returns>NotInitialized if the device is not setup, AlreadyRunning if the stream is already running.</returns>
+		ErrorFlags StartReceiveStream(uint64_t ringSizeBytes, OverflowPolicy overflowPolicy, uint32_t numTransfers = 1, uint32_t transferBytes = 0);
+
+		/// <summary>
+		/// Stop the background reader started by StartReceiveStream() and free the ring. Any data still queued is discarded.
+		/// </summary>
+		/// <returns></returns>
+		ErrorFlags StopReceiveStream();
+
+		/// <summary>
+		/// Pin the reader thread to one CPU so several devices streaming at once each keep a core to themselves and don't steal cache or time slices
+		/// from each other. Takes effect the next time StartReceiveStream() is called.
+		/// </summary>
+		/// <param name="cpu">CPU index as the OS numbers them, -1 (the default) to let the scheduler move the thread around.</param>
+		void SetReceiveThreadCpu(int cpu);
+
+		/// <summary>
+		/// Same as SetReceiveThreadCpu() for the writer thread. Takes effect the next time StartTransmitStream() is called.
+		/// </summary>
+		void SetTransmitThreadCpu(int cpu);
+
+		/// <summary>
+		/// Get the oldest unread raw IQ bytes from the receive stream without copying them. The pointer stays valid until all of the bytes have been released with ReleaseReceiveData().
+		/// </summary>
+		/// <param name="rawIQBytes">Start of the unread bytes.</param>
+		/// <param name="numBytes">Number of unread bytes available at rawIQBytes. Always a multiple of 4.</param>
+		/// <param name="flags">RING_SLOT_* flags. RING_SLOT_DATA_LOST means samples were dropped right before rawIQBytes, RING_SLOT_READ_TIMEOUT/RING_SLOT_READ_ERROR
+		/// that a read failed right before it so the device may have dropped some.</param>
+		/// <param name="timestampNs">GetHostTimeNs() when the USB transfer holding these bytes completed, i.e. roughly when its last sample was captured.</param>
+		/// <param name="timeoutMs">How long to wait for data, 0 to return immediately.</param>
+		/// <returns>NotResponding if no data arrived in time, InvalidState if the stream is not running.</returns>
+		ErrorFlags AcquireReceiveData(const uint8_t*& rawIQBytes, uint32_t& numBytes, uint32_t& flags, uint64_t& timestampNs, uint32_t timeoutMs);
+
+		/// <summary>
+		/// Hand back bytes obtained from AcquireReceiveData().
+		/// </summary>
+		/// <param name="numBytes">Number of bytes consumed. Should be a multiple of 4.</param>
+		void ReleaseReceiveData(uint32_t numBytes);
+
+		/// <summary>
+		/// Number of times the receive ring overflowed (transfers dropped according to the OverflowPolicy) since the stream was started.
+		/// </summary>
+		/// <returns></returns>
+		uint64_t GetReceiveOverflowCount();
+
+		/// <summary>
+		/// Number of IQ reads that timed out, counted both for ReceiveSamplesInto() and the background reader.
+		/// </summary>
+		/// <returns></returns>
+		uint64_t GetReceiveTimeoutCount();
+
+		/// <summary>
+		/// Number of IQ reads that failed for reasons other than a timeout.
+		/// </summary>
+		/// <returns></returns>
+		uint64_t GetReceiveErrorCount();
+
+		/// <summary>
+		/// Host wall clock in nanoseconds since the Unix epoch. Receive timestamps (rx_time) are taken with this clock; intervals such as the hop
+		/// timing use the monotonic TransmitPacer::GetMonotonicNs() instead since this one can step.
+		/// </summary>
+		/// <returns></returns>
+		static uint64_t GetHostTimeNs();
+
 		/// <summary>
 		/// Transmit the supplied raw IQ sample bytes.
 		/// </summary>
@@ -234,6 +875,61 @@ namespace THR
 		/// <returns></returns>
 		ErrorFlags TransmitSamples(uint8_t* rawIQBytes, uint64_t numTransmitBytes);
 
+		/// <summary>
+		/// Start a background thread that owns the IQ write pipe and feeds it from a preallocated ring at the sample rate, so the caller only has to keep
+		/// the ring topped up. Samples are queued with AcquireTransmitBuffer()/CommitTransmitBuffer() instead of TransmitSamples(). Transmit must be enabled
+		/// separately with StartTransmit().
+		/// </summary>
+		/// <param name="ringSizeBytes">Total ring size in bytes. Rounded up to a whole number of transfers, at least 2.</param>
+		/// <param name="transferBytes">Size of each write in bytes.</param>
+		/// <param name="prefillBytes">How much has to be queued before the first write, and again after an underflow, so the device has a cushion to
+		/// play from. At least one transfer and at most the ring size, so each time the ring runs dry counts as one underflow.</param>
+		/// <param name="leadSeconds">How far ahead of the sample clock writes may run. See TransmitPacer::SetLeadTime().</param>
+		/// <returns>NotInitialized if the device is not setup, AlreadyRunning if the stream is already running.</returns>
+		/// <param name="isBurstMode">Only transmit between RING_SLOT_START_OF_BURST and RING_SLOT_END_OF_BURST slots. The writer enables the transmitter
+		/// at the start of each burst and disables it once the burst has played out, so StartTransmit() should not be called.</param>
+		ErrorFlags StartTransmitStream(uint64_t ringSizeBytes, uint32_t transferBytes, uint64_t prefillBytes, double leadSeconds, bool isBurstMode = false);
+
+		/// <summary>
+		/// Send whatever is still queued, then stop the background writer and free the ring.
+		/// </summary>
+		/// <returns></returns>
+		ErrorFlags StopTransmitStream();
+
+		/// <summary>
+		/// Rate the background writer releases samples at. Can be changed while the stream is running.
+		/// </summary>
+		/// <param name="sampleRate">Samples per second per channel. With several transmit channels active each frame holds one sample of each.</param>
+		void SetTransmitStreamRate(double sampleRate);
+
+		/// <summary>
+		/// Get the next transfer sized buffer to fill, waiting for the writer to free one if the ring is full.
+		/// </summary>
+		/// <returns>The buffer, or NULL if the stream is not running.</returns>
+		uint8_t* AcquireTransmitBuffer();
+
+		/// <summary>
+		/// Queue the buffer returned by AcquireTransmitBuffer() for the writer.
+		/// </summary>
+		/// <param name="numBytes">Number of valid bytes in the buffer. Should be a multiple of 4.</param>
+		/// <param name="flags">RING_SLOT_START_OF_BURST/RING_SLOT_END_OF_BURST in burst mode.</param>
+		/// <param name="burstTimeNs">With RING_SLOT_START_OF_BURST, when the burst should start as GetHostTimeNs() time. 0 to start as soon as possible.</param>
+		void CommitTransmitBuffer(uint32_t numBytes, uint32_t flags = 0, uint64_t burstTimeNs = 0);
+
+		/// <summary>
+		/// Number of times the writer found the ring empty when the next write was due since the stream was started.
+		/// </summary>
+		/// <returns></returns>
+		uint64_t GetTransmitUnderflowCount();
+
+		/// <summary>
+		/// Get the transmit counters, sampling the driver's write queue depth on the way. Can be called from any thread while samples are being sent, but
+		/// not while StopTransmitStream() is running.
+		/// </summary>
+		/// <param name="statistics">Filled with the current counters.</param>
+		/// <returns>NotInitialized if the device is not setup; the counters are still filled in.</returns>
+		ErrorFlags GetTransmitStatistics(TransmitStatistics& statistics);
+
 		/// <summary>
 	   /// Initializes the device. Needs to be called first before anything else.
 	   /// </summary>
@@ -330,6 +1026,17 @@ namespace THR
 		/// </returns>
 		ErrorFlags SetMultiplexMode(bool isTDM, IQChannelConfig channelConfig);
 
+		/// <summary>
+		/// Number of receive channels a multiplex mode streams. Their samples arrive interleaved on the IQ pipe, one sample of each channel in turn,
+		/// in RadioChannel order (RX1, RX2...).
+		/// </summary>
+		static int GetReceiveChannelCount(IQChannelConfig channelConfig);
+
+		/// <summary>
+		/// Number of transmit channels a multiplex mode streams, interleaved on the IQ pipe the same way (TX1, TX2...). 0 for receive only modes.
+		/// </summary>
+		static int GetTransmitChannelCount(IQChannelConfig channelConfig);
+
 		/// <summary>
 		/// Get the current LO frequency. Check the returned ErrorFlags before accepting the output value.
 		/// </summary>
@@ -458,6 +1165,27 @@ namespace THR
 		/// <exception cref="ArgumentException">If radioChannel is not valid.</exception>
 		ErrorFlags SetSampleRate(int radioChannel, uint64_t sampleRate);
 
+		/// <summary>
+		/// Set the LO, sample rate and gain of a receive channel and read back the LO and sample rate the device applied, all in one command batch.
+		/// </summary>
+		/// <param name="radioChannel">The RadioChannel this should apply to.</param>
+		/// <param name="frequency">In: the desired LO frequency, in Hz. Out: the LO frequency the device reports.</param>
+		/// <param name="sampleRate">In: the desired sample rate, in Hz. Out: the sample rate the device reports.</param>
+		/// <param name="gainMode">The gain mode to use.</param>
+		/// <param name="gain">Only sent with RadioGainMode::Manual.</param>
+		/// <returns>See ProcessCommandBatch().</returns>
+		ErrorFlags ConfigureReceiveChannel(int radioChannel, uint64_t& frequency, uint64_t& sampleRate, RadioGainMode gainMode, int gain);
+
+		/// <summary>
+		/// Set the LO, sample rate and attenuation of a transmit channel and read back the LO and sample rate the device applied, all in one command batch.
+		/// </summary>
+		/// <param name="radioChannel">The RadioChannel this should apply to (should be a transmit channel).</param>
+		/// <param name="frequency">In: the desired LO frequency, in Hz. Out: the LO frequency the device reports.</param>
+		/// <param name="sampleRate">In: the desired sample rate, in Hz. Out: the sample rate the device reports.</param>
+		/// <param name="attenuation">The desired attenuation, in dB. Skipped (and InvalidParameter returned) if out of range.</param>
+		/// <returns>See ProcessCommandBatch().</returns>
+		ErrorFlags ConfigureTransmitChannel(int radioChannel, uint64_t& frequency, uint64_t& sampleRate, float attenuation);
+
 		/// <summary>
 		/// Gets the current device temperature. It's best to look at the device reference manual to understand where this comes from.
 		/// </summary>
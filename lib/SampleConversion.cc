@@ -0,0 +1,938 @@
+#include "SampleConversion.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAMPLE_CONVERSION_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SAMPLE_CONVERSION_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace THR;
+
+namespace
+{
+	typedef void (*SC16BEToFC32Function)(const uint8_t* in, float* out, size_t numSamples, float scale);
+	typedef size_t (*FC32ToSC16BEFunction)(const float* in, uint8_t* out, size_t numSamples, float scale);
+	typedef void (*SwapSC16Function)(const uint8_t* in, uint8_t* out, size_t numSamples);
+	typedef void (*DeinterleaveFunction)(const uint8_t* in, uint8_t* const* out, size_t numFrames, float scale);
+	typedef size_t (*InterleaveFunction)(const uint8_t* const* in, uint8_t* out, size_t numFrames, float scale);
+
+	const float SC16_MIN = -32768.0f;
+	const float SC16_MAX = 32767.0f;
+
+	// Reference implementation. The SIMD kernels only differ in how many values they handle per step:
+	// int16 -> float is exact and the scale is a single rounded multiply either way.
+	void ConvertSC16BEToFC32Scalar(const uint8_t* in, float* out, size_t numSamples, float scale)
+	{
+		size_t numValues = numSamples * 2;
+		for (size_t i = 0; i < numValues; i++)
+		{
+			int16_t value = (int16_t)(((uint16_t)in[2 * i] << 8) | (uint16_t)in[2 * i + 1]);
+			out[i] = (float)value * scale;
+		}
+	}
+
+	// The clamp is written the way the SIMD max/min instructions behave (NaN ends up at SC16_MIN) so all kernels agree.
+	inline void PackSC16BE(float value, uint8_t* out, size_t& numClipped)
+	{
+		float clamped = value > SC16_MIN ? value : SC16_MIN;
+		clamped = clamped < SC16_MAX ? clamped : SC16_MAX;
+		numClipped += value != clamped;
+		int16_t converted = (int16_t)(int32_t)clamped;
+		out[0] = (uint8_t)((uint16_t)converted >> 8);
+		out[1] = (uint8_t)converted;
+	}
+
+	// Reference implementation
+	size_t ConvertFC32ToSC16BEScalar(const float* in, uint8_t* out, size_t numSamples, float scale)
+	{
+		size_t numValues = numSamples * 2;
+		size_t numClipped = 0;
+		for (size_t i = 0; i < numValues; i++)
+		{
+			PackSC16BE(in[i] * scale, out + 2 * i, numClipped);
+		}
+		return numClipped;
+	}
+
+	void SwapSC16Scalar(const uint8_t* in, uint8_t* out, size_t numSamples)
+	{
+		size_t numValues = numSamples * 2;
+		for (size_t i = 0; i < numValues; i++)
+		{
+			uint8_t high = in[2 * i];
+			out[2 * i] = in[2 * i + 1];
+			out[2 * i + 1] = high;
+		}
+	}
+
+#ifdef SAMPLE_CONVERSION_X86
+	__attribute__((target("sse2")))
+	void ConvertSC16BEToFC32SSE2(const uint8_t* in, float* out, size_t numSamples, float scale)
+	{
+		const __m128 scaleVector = _mm_set1_ps(scale);
+		size_t numValues = numSamples * 2;
+		size_t i = 0;
+		for (; i + 8 <= numValues; i += 8)
+		{
+			__m128i raw = _mm_loadu_si128((const __m128i*)(in + 2 * i));
+			// No byte shuffle before SSSE3, so swap with shifts
+			__m128i swapped = _mm_or_si128(_mm_slli_epi16(raw, 8), _mm_srli_epi16(raw, 8));
+			// Sign extend by putting each value in the top half of a 32 bit lane and shifting it back down
+			__m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(swapped, swapped), 16);
+			__m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(swapped, swapped), 16);
+			_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scaleVector));
+			_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scaleVector));
+		}
+		ConvertSC16BEToFC32Scalar(in + 2 * i, out + i, (numValues - i) / 2, scale);
+	}
+
+	__attribute__((target("sse2")))
+	size_t ConvertFC32ToSC16BESSE2(const float* in, uint8_t* out, size_t numSamples, float scale)
+	{
+		const __m128 scaleVector = _mm_set1_ps(scale);
+		const __m128 minVector = _mm_set1_ps(SC16_MIN);
+		const __m128 maxVector = _mm_set1_ps(SC16_MAX);
+		size_t numValues = numSamples * 2;
+		size_t numClipped = 0;
+		size_t i = 0;
+		for (; i + 8 <= numValues; i += 8)
+		{
+			__m128 low = _mm_mul_ps(_mm_loadu_ps(in + i), scaleVector);
+			__m128 high = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scaleVector);
+			__m128 lowClamped = _mm_min_ps(_mm_max_ps(low, minVector), maxVector);
+			__m128 highClamped = _mm_min_ps(_mm_max_ps(high, minVector), maxVector);
+			numClipped += __builtin_popcount(_mm_movemask_ps(_mm_cmpneq_ps(low, lowClamped)) | (_mm_movemask_ps(_mm_cmpneq_ps(high, highClamped)) << 4));
+			__m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(lowClamped), _mm_cvttps_epi32(highClamped));
+			_mm_storeu_si128((__m128i*)(out + 2 * i), _mm_or_si128(_mm_slli_epi16(packed, 8), _mm_srli_epi16(packed, 8)));
+		}
+		return numClipped + ConvertFC32ToSC16BEScalar(in + i, out + 2 * i, (numValues - i) / 2, scale);
+	}
+
+	__attribute__((target("sse2")))
+	void SwapSC16SSE2(const uint8_t* in, uint8_t* out, size_t numSamples)
+	{
+		size_t numBytes = numSamples * 4;
+		size_t i = 0;
+		for (; i + 16 <= numBytes; i += 16)
+		{
+			__m128i raw = _mm_loadu_si128((const __m128i*)(in + i));
+			_mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(_mm_slli_epi16(raw, 8), _mm_srli_epi16(raw, 8)));
+		}
+		SwapSC16Scalar(in + i, out + i, (numBytes - i) / 4);
+	}
+
+	__attribute__((target("avx2")))
+	void SwapSC16AVX2(const uint8_t* in, uint8_t* out, size_t numSamples)
+	{
+		const __m256i swapMask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		size_t numBytes = numSamples * 4;
+		size_t i = 0;
+		for (; i + 32 <= numBytes; i += 32)
+		{
+			_mm256_storeu_si256((__m256i*)(out + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(in + i)), swapMask));
+		}
+		SwapSC16Scalar(in + i, out + i, (numBytes - i) / 4);
+	}
+
+	__attribute__((target("avx2")))
+	void ConvertSC16BEToFC32AVX2(const uint8_t* in, float* out, size_t numSamples, float scale)
+	{
+		const __m256 scaleVector = _mm256_set1_ps(scale);
+		const __m128i swapMask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		size_t numValues = numSamples * 2;
+		size_t i = 0;
+		for (; i + 16 <= numValues; i += 16)
+		{
+			__m128i low = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 2 * i)), swapMask);
+			__m128i high = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 2 * i + 16)), swapMask);
+			_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(low)), scaleVector));
+			_mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(high)), scaleVector));
+		}
+		ConvertSC16BEToFC32Scalar(in + 2 * i, out + i, (numValues - i) / 2, scale);
+	}
+
+	__attribute__((target("avx2,popcnt")))
+	size_t ConvertFC32ToSC16BEAVX2(const float* in, uint8_t* out, size_t numSamples, float scale)
+	{
+		const __m256 scaleVector = _mm256_set1_ps(scale);
+		const __m256 minVector = _mm256_set1_ps(SC16_MIN);
+		const __m256 maxVector = _mm256_set1_ps(SC16_MAX);
+		const __m256i swapMask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		size_t numValues = numSamples * 2;
+		size_t numClipped = 0;
+		size_t i = 0;
+		for (; i + 16 <= numValues; i += 16)
+		{
+			__m256 low = _mm256_mul_ps(_mm256_loadu_ps(in + i), scaleVector);
+			__m256 high = _mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scaleVector);
+			__m256 lowClamped = _mm256_min_ps(_mm256_max_ps(low, minVector), maxVector);
+			__m256 highClamped = _mm256_min_ps(_mm256_max_ps(high, minVector), maxVector);
+			numClipped += _mm_popcnt_u32(_mm256_movemask_ps(_mm256_cmp_ps(low, lowClamped, _CMP_NEQ_UQ)) |
+				(_mm256_movemask_ps(_mm256_cmp_ps(high, highClamped, _CMP_NEQ_UQ)) << 8));
+			// packs works per 128 bit lane, so put the 64 bit quarters back in order afterwards
+			__m256i packed = _mm256_packs_epi32(_mm256_cvttps_epi32(lowClamped), _mm256_cvttps_epi32(highClamped));
+			packed = _mm256_permute4x64_epi64(packed, 0xD8);
+			_mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_shuffle_epi8(packed, swapMask));
+		}
+		return numClipped + ConvertFC32ToSC16BEScalar(in + i, out + 2 * i, (numValues - i) / 2, scale);
+	}
+
+	__attribute__((target("avx512f,avx512bw")))
+	void ConvertSC16BEToFC32AVX512(const uint8_t* in, float* out, size_t numSamples, float scale)
+	{
+		const __m512 scaleVector = _mm512_set1_ps(scale);
+		const __m256i swapMask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		size_t numValues = numSamples * 2;
+		size_t i = 0;
+		for (; i + 32 <= numValues; i += 32)
+		{
+			__m256i low = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(in + 2 * i)), swapMask);
+			__m256i high = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(in + 2 * i + 32)), swapMask);
+			_mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(low)), scaleVector));
+			_mm512_storeu_ps(out + i + 16, _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(high)), scaleVector));
+		}
+		ConvertSC16BEToFC32Scalar(in + 2 * i, out + i, (numValues - i) / 2, scale);
+	}
+
+	__attribute__((target("avx512f,avx512bw,popcnt")))
+	size_t ConvertFC32ToSC16BEAVX512(const float* in, uint8_t* out, size_t numSamples, float scale)
+	{
+		const __m512 scaleVector = _mm512_set1_ps(scale);
+		const __m512 minVector = _mm512_set1_ps(SC16_MIN);
+		const __m512 maxVector = _mm512_set1_ps(SC16_MAX);
+		const __m512i swapMask = _mm512_broadcast_i32x4(_mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+		size_t numValues = numSamples * 2;
+		size_t numClipped = 0;
+		size_t i = 0;
+		for (; i + 32 <= numValues; i += 32)
+		{
+			__m512 low = _mm512_mul_ps(_mm512_loadu_ps(in + i), scaleVector);
+			__m512 high = _mm512_mul_ps(_mm512_loadu_ps(in + i + 16), scaleVector);
+			__m512 lowClamped = _mm512_min_ps(_mm512_max_ps(low, minVector), maxVector);
+			__m512 highClamped = _mm512_min_ps(_mm512_max_ps(high, minVector), maxVector);
+			numClipped += _mm_popcnt_u32(_mm512_cmp_ps_mask(low, lowClamped, _CMP_NEQ_UQ) | ((uint32_t)_mm512_cmp_ps_mask(high, highClamped, _CMP_NEQ_UQ) << 16));
+			__m512i packed = _mm512_inserti64x4(_mm512_castsi256_si512(_mm512_cvtsepi32_epi16(_mm512_cvttps_epi32(lowClamped))),
+				_mm512_cvtsepi32_epi16(_mm512_cvttps_epi32(highClamped)), 1);
+			_mm512_storeu_si512((void*)(out + 2 * i), _mm512_shuffle_epi8(packed, swapMask));
+		}
+		return numClipped + ConvertFC32ToSC16BEScalar(in + i, out + 2 * i, (numValues - i) / 2, scale);
+	}
+
+	// 4 big endian sc16 samples as 4 complex floats, one per 64 bit lane
+	__attribute__((target("avx2")))
+	inline __m256d LoadSC16BEAsFC32AVX2(const uint8_t* in, __m128i swapMask, __m256 scaleVector)
+	{
+		__m128i values = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), swapMask);
+		return _mm256_castps_pd(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(values)), scaleVector));
+	}
+
+	void DeinterleaveFC32Tail2(const uint8_t* in, uint8_t* const* out, size_t numFrames, float scale);
+	void DeinterleaveFC32Tail4(const uint8_t* in, uint8_t* const* out, size_t numFrames, float scale);
+
+	__attribute__((target("avx2")))
+	void DeinterleaveSC16BEToFC32x2AVX2(const uint8_t* in, uint8_t* const* out, size_t numFrames, float scale)
+	{
+		const __m256 scaleVector = _mm256_set1_ps(scale);
+		const __m128i swapMask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		double* channel0 = (double*)out[0];
+		double* channel1 = (double*)out[1];
+		size_t frame = 0;
+		for (; frame + 4 <= numFrames; frame += 4)
+		{
+			// Each load holds 2 frames, channels alternating. Pair up the lanes of both loads, then put the frames back in order.
+			__m256d low = LoadSC16BEAsFC32AVX2(in + 8 * frame, swapMask, scaleVector);
+			__m256d high = LoadSC16BEAsFC32AVX2(in + 8 * frame + 16, swapMask, scaleVector);
+			_mm256_storeu_pd(channel0 + frame, _mm256_permute4x64_pd(_mm256_unpacklo_pd(low, high), 0xD8));
+			_mm256_storeu_pd(channel1 + frame, _mm256_permute4x64_pd(_mm256_unpackhi_pd(low, high), 0xD8));
+		}
+		uint8_t* tail[2] = { out[0] + 8 * frame, out[1] + 8 * frame };
+		DeinterleaveFC32Tail2(in + 8 * frame, tail, numFrames - frame, scale);
+	}
+
+	__attribute__((target("avx2")))
+	void DeinterleaveSC16BEToFC32x4AVX2(const uint8_t* in, uint8_t* const* out, size_t numFrames, float scale)
+	{
+		const __m256 scaleVector = _mm256_set1_ps(scale);
+		const __m128i swapMask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		size_t frame = 0;
+		for (; frame + 4 <= numFrames; frame += 4)
+		{
+			// One frame per load: a 4x4 transpose of 64 bit lanes
+			__m256d frame0 = LoadSC16BEAsFC32AVX2(in + 16 * frame, swapMask, scaleVector);
+			__m256d frame1 = LoadSC16BEAsFC32AVX2(in + 16 * frame + 16, swapMask, scaleVector);
+			__m256d frame2 = LoadSC16BEAsFC32AVX2(in + 16 * frame + 32, swapMask, scaleVector);
+			__m256d frame3 = LoadSC16BEAsFC32AVX2(in + 16 * frame + 48, swapMask, scaleVector);
+			__m256d even01 = _mm256_unpacklo_pd(frame0, frame1);
+			__m256d odd01 = _mm256_unpackhi_pd(frame0, frame1);
+			__m256d even23 = _mm256_unpacklo_pd(frame2, frame3);
+			__m256d odd23 = _mm256_unpackhi_pd(frame2, frame3);
+			_mm256_storeu_pd((double*)out[0] + frame, _mm256_permute2f128_pd(even01, even23, 0x20));
+			_mm256_storeu_pd((double*)out[1] + frame, _mm256_permute2f128_pd(odd01, odd23, 0x20));
+			_mm256_storeu_pd((double*)out[2] + frame, _mm256_permute2f128_pd(even01, even23, 0x31));
+			_mm256_storeu_pd((double*)out[3] + frame, _mm256_permute2f128_pd(odd01, odd23, 0x31));
+		}
+		uint8_t* tail[4] = { out[0] + 8 * frame, out[1] + 8 * frame, out[2] + 8 * frame, out[3] + 8 * frame };
+		DeinterleaveFC32Tail4(in + 16 * frame, tail, numFrames - frame, scale);
+	}
+
+	// 4 complex floats (one per 64 bit lane of each input) to 8 big endian sc16 samples, clamped like PackSC16BE()
+	__attribute__((target("avx2,popcnt")))
+	inline size_t StoreFC32AsSC16BEAVX2(__m256d low, __m256d high, uint8_t* out, __m256 scaleVector)
+	{
+		const __m256 minVector = _mm256_set1_ps(SC16_MIN);
+		const __m256 maxVector = _mm256_set1_ps(SC16_MAX);
+		const __m256i swapMask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		__m256 lowScaled = _mm256_mul_ps(_mm256_castpd_ps(low), scaleVector);
+		__m256 highScaled = _mm256_mul_ps(_mm256_castpd_ps(high), scaleVector);
+		__m256 lowClamped = _mm256_min_ps(_mm256_max_ps(lowScaled, minVector), maxVector);
+		__m256 highClamped = _mm256_min_ps(_mm256_max_ps(highScaled, minVector), maxVector);
+		size_t numClipped = _mm_popcnt_u32(_mm256_movemask_ps(_mm256_cmp_ps(lowScaled, lowClamped, _CMP_NEQ_UQ)) |
+			(_mm256_movemask_ps(_mm256_cmp_ps(highScaled, highClamped, _CMP_NEQ_UQ)) << 8));
+		__m256i packed = _mm256_packs_epi32(_mm256_cvttps_epi32(lowClamped), _mm256_cvttps_epi32(highClamped));
+		packed = _mm256_permute4x64_epi64(packed, 0xD8);
+		_mm256_storeu_si256((__m256i*)out, _mm256_shuffle_epi8(packed, swapMask));
+		return numClipped;
+	}
+
+	size_t InterleaveFC32Tail2(const uint8_t* const* in, uint8_t* out, size_t numFrames, float scale);
+	size_t InterleaveFC32Tail4(const uint8_t* const* in, uint8_t* out, size_t numFrames, float scale);
+
+	__attribute__((target("avx2,popcnt")))
+	size_t InterleaveFC32ToSC16BEx2AVX2(const uint8_t* const* in, uint8_t* out, size_t numFrames, float scale)
+	{
+		const __m256 scaleVector = _mm256_set1_ps(scale);
+		const double* channel0 = (const double*)in[0];
+		const double* channel1 = (const double*)in[1];
+		size_t numClipped = 0;
+		size_t frame = 0;
+		for (; frame + 4 <= numFrames; frame += 4)
+		{
+			// The reverse of DeinterleaveSC16BEToFC32x2AVX2(): spread the samples of each channel out, then pair them up frame by frame
+			__m256d samples0 = _mm256_permute4x64_pd(_mm256_loadu_pd(channel0 + frame), 0xD8);
+			__m256d samples1 = _mm256_permute4x64_pd(_mm256_loadu_pd(channel1 + frame), 0xD8);
+			numClipped += StoreFC32AsSC16BEAVX2(_mm256_unpacklo_pd(samples0, samples1), _mm256_unpackhi_pd(samples0, samples1), out + 8 * frame, scaleVector);
+		}
+		const uint8_t* tail[2] = { in[0] + 8 * frame, in[1] + 8 * frame };
+		return numClipped + InterleaveFC32Tail2(tail, out + 8 * frame, numFrames - frame, scale);
+	}
+
+	__attribute__((target("avx2,popcnt")))
+	size_t InterleaveFC32ToSC16BEx4AVX2(const uint8_t* const* in, uint8_t* out, size_t numFrames, float scale)
+	{
+		const __m256 scaleVector = _mm256_set1_ps(scale);
+		size_t numClipped = 0;
+		size_t frame = 0;
+		for (; frame + 4 <= numFrames; frame += 4)
+		{
+			// A 4x4 transpose of 64 bit lanes turns 4 samples of each channel into 4 frames
+			__m256d channel0 = _mm256_loadu_pd((const double*)in[0] + frame);
+			__m256d channel1 = _mm256_loadu_pd((const double*)in[1] + frame);
+			__m256d channel2 = _mm256_loadu_pd((const double*)in[2] + frame);
+			__m256d channel3 = _mm256_loadu_pd((const double*)in[3] + frame);
+			__m256d even01 = _mm256_unpacklo_pd(channel0, channel1);
+			__m256d odd01 = _mm256_unpackhi_pd(channel0, channel1);
+			__m256d even23 = _mm256_unpacklo_pd(channel2, channel3);
+			__m256d odd23 = _mm256_unpackhi_pd(channel2, channel3);
+			numClipped += StoreFC32AsSC16BEAVX2(_mm256_permute2f128_pd(even01, even23, 0x20), _mm256_permute2f128_pd(odd01, odd23, 0x20),
+				out + 16 * frame, scaleVector);
+			numClipped += StoreFC32AsSC16BEAVX2(_mm256_permute2f128_pd(even01, even23, 0x31), _mm256_permute2f128_pd(odd01, odd23, 0x31),
+				out + 16 * frame + 32, scaleVector);
+		}
+		const uint8_t* tail[4] = { in[0] + 8 * frame, in[1] + 8 * frame, in[2] + 8 * frame, in[3] + 8 * frame };
+		return numClipped + InterleaveFC32Tail4(tail, out + 16 * frame, numFrames - frame, scale);
+	}
+#endif
+
+#ifdef SAMPLE_CONVERSION_NEON
+	size_t ConvertFC32ToSC16BENEON(const float* in, uint8_t* out, size_t numSamples, float scale)
+	{
+		const float32x4_t minVector = vdupq_n_f32(SC16_MIN);
+		const float32x4_t maxVector = vdupq_n_f32(SC16_MAX);
+		size_t numValues = numSamples * 2;
+		size_t numClipped = 0;
+		size_t i = 0;
+		for (; i + 8 <= numValues; i += 8)
+		{
+			float32x4_t low = vmulq_n_f32(vld1q_f32(in + i), scale);
+			float32x4_t high = vmulq_n_f32(vld1q_f32(in + i + 4), scale);
+			// Compare and select rather than vmax/vmin, which would let NaN through
+			float32x4_t lowClamped = vbslq_f32(vcgtq_f32(low, minVector), low, minVector);
+			lowClamped = vbslq_f32(vcltq_f32(lowClamped, maxVector), lowClamped, maxVector);
+			float32x4_t highClamped = vbslq_f32(vcgtq_f32(high, minVector), high, minVector);
+			highClamped = vbslq_f32(vcltq_f32(highClamped, maxVector), highClamped, maxVector);
+			uint32x4_t clipped = vaddq_u32(vshrq_n_u32(vmvnq_u32(vceqq_f32(low, lowClamped)), 31), vshrq_n_u32(vmvnq_u32(vceqq_f32(high, highClamped)), 31));
+			uint32x2_t clippedPairs = vadd_u32(vget_low_u32(clipped), vget_high_u32(clipped));
+			numClipped += vget_lane_u32(clippedPairs, 0) + vget_lane_u32(clippedPairs, 1);
+			int16x8_t packed = vcombine_s16(vqmovn_s32(vcvtq_s32_f32(lowClamped)), vqmovn_s32(vcvtq_s32_f32(highClamped)));
+			vst1q_u8(out + 2 * i, vrev16q_u8(vreinterpretq_u8_s16(packed)));
+		}
+		return numClipped + ConvertFC32ToSC16BEScalar(in + i, out + 2 * i, (numValues - i) / 2, scale);
+	}
+
+	void SwapSC16NEON(const uint8_t* in, uint8_t* out, size_t numSamples)
+	{
+		size_t numBytes = numSamples * 4;
+		size_t i = 0;
+		for (; i + 16 <= numBytes; i += 16)
+		{
+			vst1q_u8(out + i, vrev16q_u8(vld1q_u8(in + i)));
+		}
+		SwapSC16Scalar(in + i, out + i, (numBytes - i) / 4);
+	}
+
+	void ConvertSC16BEToFC32NEON(const uint8_t* in, float* out, size_t numSamples, float scale)
+	{
+		size_t numValues = numSamples * 2;
+		size_t i = 0;
+		for (; i + 8 <= numValues; i += 8)
+		{
+			int16x8_t values = vreinterpretq_s16_u8(vrev16q_u8(vld1q_u8(in + 2 * i)));
+			vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(values))), scale));
+			vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(values))), scale));
+		}
+		ConvertSC16BEToFC32Scalar(in + 2 * i, out + i, (numValues - i) / 2, scale);
+	}
+#endif
+
+	bool IsKernelSupported(ConversionKernel kernel)
+	{
+		switch (kernel)
+		{
+#ifdef SAMPLE_CONVERSION_X86
+		case ConversionKernel::AVX512:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+		case ConversionKernel::AVX2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2");
+		case ConversionKernel::SSE2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("sse2");
+#endif
+#ifdef SAMPLE_CONVERSION_NEON
+		case ConversionKernel::NEON:
+			return true;
+#endif
+		case ConversionKernel::Scalar:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// Fastest first
+	ConversionKernel DetectKernel()
+	{
+		const ConversionKernel candidates[] = { ConversionKernel::AVX512, ConversionKernel::AVX2, ConversionKernel::SSE2, ConversionKernel::NEON };
+		for (ConversionKernel kernel : candidates)
+		{
+			if (IsKernelSupported(kernel))
+			{
+				return kernel;
+			}
+		}
+		return ConversionKernel::Scalar;
+	}
+
+	SC16BEToFC32Function GetSC16BEToFC32Function(ConversionKernel kernel)
+	{
+		switch (kernel)
+		{
+#ifdef SAMPLE_CONVERSION_X86
+		case ConversionKernel::AVX512:
+			return ConvertSC16BEToFC32AVX512;
+		case ConversionKernel::AVX2:
+			return ConvertSC16BEToFC32AVX2;
+		case ConversionKernel::SSE2:
+			return ConvertSC16BEToFC32SSE2;
+#endif
+#ifdef SAMPLE_CONVERSION_NEON
+		case ConversionKernel::NEON:
+			return ConvertSC16BEToFC32NEON;
+#endif
+		default:
+			return ConvertSC16BEToFC32Scalar;
+		}
+	}
+
+	FC32ToSC16BEFunction GetFC32ToSC16BEFunction(ConversionKernel kernel)
+	{
+		switch (kernel)
+		{
+#ifdef SAMPLE_CONVERSION_X86
+		case ConversionKernel::AVX512:
+			return ConvertFC32ToSC16BEAVX512;
+		case ConversionKernel::AVX2:
+			return ConvertFC32ToSC16BEAVX2;
+		case ConversionKernel::SSE2:
+			return ConvertFC32ToSC16BESSE2;
+#endif
+#ifdef SAMPLE_CONVERSION_NEON
+		case ConversionKernel::NEON:
+			return ConvertFC32ToSC16BENEON;
+#endif
+		default:
+			return ConvertFC32ToSC16BEScalar;
+		}
+	}
+
+	SwapSC16Function GetSwapSC16Function(ConversionKernel kernel)
+	{
+		switch (kernel)
+		{
+#ifdef SAMPLE_CONVERSION_X86
+		case ConversionKernel::AVX512:
+		case ConversionKernel::AVX2:
+			// A byte shuffle is already memory bound at 256 bits
+			return SwapSC16AVX2;
+		case ConversionKernel::SSE2:
+			return SwapSC16SSE2;
+#endif
+#ifdef SAMPLE_CONVERSION_NEON
+		case ConversionKernel::NEON:
+			return SwapSC16NEON;
+#endif
+		default:
+			return SwapSC16Scalar;
+		}
+	}
+
+	// Everything that is dispatched, resolved for one kernel
+	struct KernelFunctions
+	{
+		ConversionKernel kernel;
+		SC16BEToFC32Function sc16BEToFC32;
+		FC32ToSC16BEFunction fc32ToSC16BE;
+		SwapSC16Function swapSC16;
+		DeinterleaveFunction deinterleave[(int)StreamType::PlanarFC32 + 1][MAX_DEINTERLEAVE_CHANNELS + 1];
+		InterleaveFunction interleave[(int)StreamType::PlanarFC32 + 1][MAX_DEINTERLEAVE_CHANNELS + 1];
+	};
+
+	const KernelFunctions& GetKernelFunctions(ConversionKernel kernel);
+
+	// The detected kernel unless SetConversionKernel() picked another. Resolved on first use; function local statics are initialized thread safely.
+	std::atomic<const KernelFunctions*>& ActiveFunctions()
+	{
+		static std::atomic<const KernelFunctions*> functions(&GetKernelFunctions(DetectKernel()));
+		return functions;
+	}
+
+	inline const KernelFunctions& Active()
+	{
+		return *ActiveFunctions().load(std::memory_order_acquire);
+	}
+
+	// Frames converted per step by DeinterleaveBlocked(); small enough for the block to stay in L1
+	const size_t DEINTERLEAVE_BLOCK_FRAMES = 256;
+
+	// Copy every NumOutputs-th unit to the same output. NumOutputs is a compile time constant so the inner loop unrolls into straight moves.
+	template <int NumOutputs, size_t UnitBytes>
+	inline void ScatterFrames(const uint8_t* in, uint8_t* const* out, size_t numFrames)
+	{
+		for (size_t frame = 0; frame < numFrames; frame++)
+		{
+			for (int output = 0; output < NumOutputs; output++)
+			{
+				memcpy(out[output] + frame * UnitBytes, in + (frame * NumOutputs + output) * UnitBytes, UnitBytes);
+			}
+		}
+	}
+
+	// Convert a block of frames with the active SIMD kernel, then scatter it to the channels
+	template <int NumChannels, StreamType Type>
+	void DeinterleaveBlocked(const uint8_t* in, uint8_t* const* out, size_t numFrames, float scale)
+	{
+		const int numOutputs = Type == StreamType::PlanarFC32 ? 2 * NumChannels : NumChannels;
+		// I/Q float pairs are the widest unit
+		float block[DEINTERLEAVE_BLOCK_FRAMES * NumChannels * 2];
+		uint8_t* blockOut[2 * NumChannels];
+		for (size_t done = 0; done < numFrames; done += DEINTERLEAVE_BLOCK_FRAMES)
+		{
+			size_t numBlockFrames = std::min(DEINTERLEAVE_BLOCK_FRAMES, numFrames - done);
+			const uint8_t* raw = in + done * NumChannels * 4;
+			size_t unitBytes = Type == StreamType::SC8 ? 2 : Type == StreamType::FC32 ? 8 : 4;
+			for (int output = 0; output < numOutputs; output++)
+			{
+				blockOut[output] = out[output] + done * unitBytes;
+			}
+			switch (Type)
+			{
+			case StreamType::SC16:
+				Active().swapSC16(raw, (uint8_t*)block, numBlockFrames * NumChannels);
+				ScatterFrames<NumChannels, 4>((const uint8_t*)block, blockOut, numBlockFrames);
+				break;
+			case StreamType::SC8:
+				ConvertSC16BEToSC8(raw, (int8_t*)block, numBlockFrames * NumChannels);
+				ScatterFrames<NumChannels, 2>((const uint8_t*)block, blockOut, numBlockFrames);
+				break;
+			case StreamType::PlanarFC32:
+				Active().sc16BEToFC32(raw, block, numBlockFrames * NumChannels, scale);
+				ScatterFrames<2 * NumChannels, 4>((const uint8_t*)block, blockOut, numBlockFrames);
+				break;
+			default:
+				Active().sc16BEToFC32(raw, block, numBlockFrames * NumChannels, scale);
+				ScatterFrames<NumChannels, 8>((const uint8_t*)block, blockOut, numBlockFrames);
+				break;
+			}
+		}
+	}
+
+	// The reverse of ScatterFrames(): take one unit from every input in turn
+	template <int NumInputs, size_t UnitBytes>
+	inline void GatherFrames(const uint8_t* const* in, uint8_t* out, size_t numFrames)
+	{
+		for (size_t frame = 0; frame < numFrames; frame++)
+		{
+			for (int input = 0; input < NumInputs; input++)
+			{
+				memcpy(out + (frame * NumInputs + input) * UnitBytes, in[input] + frame * UnitBytes, UnitBytes);
+			}
+		}
+	}
+
+	// Gather a block of frames, then convert it with the active SIMD kernel. Returns the number of clipped values.
+	template <int NumChannels, StreamType Type>
+	size_t InterleaveBlocked(const uint8_t* const* in, uint8_t* out, size_t numFrames, float scale)
+	{
+		const int numInputs = Type == StreamType::PlanarFC32 ? 2 * NumChannels : NumChannels;
+		float block[DEINTERLEAVE_BLOCK_FRAMES * NumChannels * 2];
+		const uint8_t* blockIn[2 * NumChannels];
+		size_t numClipped = 0;
+		for (size_t done = 0; done < numFrames; done += DEINTERLEAVE_BLOCK_FRAMES)
+		{
+			size_t numBlockFrames = std::min(DEINTERLEAVE_BLOCK_FRAMES, numFrames - done);
+			uint8_t* raw = out + done * NumChannels * 4;
+			size_t unitBytes = Type == StreamType::SC8 ? 2 : Type == StreamType::FC32 ? 8 : 4;
+			for (int input = 0; input < numInputs; input++)
+			{
+				blockIn[input] = in[input] + done * unitBytes;
+			}
+			switch (Type)
+			{
+			case StreamType::SC16:
+				// Same size on both sides, so gather straight into the output and swap it in place
+				GatherFrames<NumChannels, 4>(blockIn, raw, numBlockFrames);
+				Active().swapSC16(raw, raw, numBlockFrames * NumChannels);
+				break;
+			case StreamType::SC8:
+				GatherFrames<NumChannels, 2>(blockIn, (uint8_t*)block, numBlockFrames);
+				ConvertSC8ToSC16BE((const int8_t*)block, raw, numBlockFrames * NumChannels);
+				break;
+			case StreamType::PlanarFC32:
+				GatherFrames<2 * NumChannels, 4>(blockIn, (uint8_t*)block, numBlockFrames);
+				numClipped += Active().fc32ToSC16BE(block, raw, numBlockFrames * NumChannels, scale);
+				break;
+			default:
+				GatherFrames<NumChannels, 8>(blockIn, (uint8_t*)block, numBlockFrames);
+				numClipped += Active().fc32ToSC16BE(block, raw, numBlockFrames * NumChannels, scale);
+				break;
+			}
+		}
+		return numClipped;
+	}
+
+#ifdef SAMPLE_CONVERSION_X86
+	void DeinterleaveFC32Tail2(const uint8_t* in, uint8_t* const* out, size_t numFrames, float scale)
+	{
+		DeinterleaveBlocked<2, StreamType::FC32>(in, out, numFrames, scale);
+	}
+
+	void DeinterleaveFC32Tail4(const uint8_t* in, uint8_t* const* out, size_t numFrames, float scale)
+	{
+		DeinterleaveBlocked<4, StreamType::FC32>(in, out, numFrames, scale);
+	}
+
+	size_t InterleaveFC32Tail2(const uint8_t* const* in, uint8_t* out, size_t numFrames, float scale)
+	{
+		return InterleaveBlocked<2, StreamType::FC32>(in, out, numFrames, scale);
+	}
+
+	size_t InterleaveFC32Tail4(const uint8_t* const* in, uint8_t* out, size_t numFrames, float scale)
+	{
+		return InterleaveBlocked<4, StreamType::FC32>(in, out, numFrames, scale);
+	}
+#endif
+
+	template <int NumChannels>
+	DeinterleaveFunction GetBlockedDeinterleaveFunction(StreamType type)
+	{
+		switch (type)
+		{
+		case StreamType::SC16:
+			return DeinterleaveBlocked<NumChannels, StreamType::SC16>;
+		case StreamType::SC8:
+			return DeinterleaveBlocked<NumChannels, StreamType::SC8>;
+		case StreamType::PlanarFC32:
+			return DeinterleaveBlocked<NumChannels, StreamType::PlanarFC32>;
+		default:
+			return DeinterleaveBlocked<NumChannels, StreamType::FC32>;
+		}
+	}
+
+	DeinterleaveFunction GetDeinterleaveFunction(ConversionKernel kernel, StreamType type, int numChannels)
+	{
+#ifdef SAMPLE_CONVERSION_X86
+		if (type == StreamType::FC32 && (kernel == ConversionKernel::AVX2 || kernel == ConversionKernel::AVX512))
+		{
+			if (numChannels == 2)
+			{
+				return DeinterleaveSC16BEToFC32x2AVX2;
+			}
+			if (numChannels == 4)
+			{
+				return DeinterleaveSC16BEToFC32x4AVX2;
+			}
+		}
+#endif
+		switch (numChannels)
+		{
+		case 2:
+			return GetBlockedDeinterleaveFunction<2>(type);
+		case 3:
+			return GetBlockedDeinterleaveFunction<3>(type);
+		default:
+			return GetBlockedDeinterleaveFunction<4>(type);
+		}
+	}
+
+	template <int NumChannels>
+	InterleaveFunction GetBlockedInterleaveFunction(StreamType type)
+	{
+		switch (type)
+		{
+		case StreamType::SC16:
+			return InterleaveBlocked<NumChannels, StreamType::SC16>;
+		case StreamType::SC8:
+			return InterleaveBlocked<NumChannels, StreamType::SC8>;
+		case StreamType::PlanarFC32:
+			return InterleaveBlocked<NumChannels, StreamType::PlanarFC32>;
+		default:
+			return InterleaveBlocked<NumChannels, StreamType::FC32>;
+		}
+	}
+
+	InterleaveFunction GetInterleaveFunction(ConversionKernel kernel, StreamType type, int numChannels)
+	{
+#ifdef SAMPLE_CONVERSION_X86
+		if (type == StreamType::FC32 && (kernel == ConversionKernel::AVX2 || kernel == ConversionKernel::AVX512))
+		{
+			if (numChannels == 2)
+			{
+				return InterleaveFC32ToSC16BEx2AVX2;
+			}
+			if (numChannels == 4)
+			{
+				return InterleaveFC32ToSC16BEx4AVX2;
+			}
+		}
+#endif
+		switch (numChannels)
+		{
+		case 2:
+			return GetBlockedInterleaveFunction<2>(type);
+		case 3:
+			return GetBlockedInterleaveFunction<3>(type);
+		default:
+			return GetBlockedInterleaveFunction<4>(type);
+		}
+	}
+
+	struct KernelTable
+	{
+		KernelFunctions kernels[(int)ConversionKernel::NEON + 1];
+
+		KernelTable()
+		{
+			for (int kernel = 0; kernel <= (int)ConversionKernel::NEON; kernel++)
+			{
+				KernelFunctions& functions = kernels[kernel];
+				functions.kernel = (ConversionKernel)kernel;
+				functions.sc16BEToFC32 = GetSC16BEToFC32Function(functions.kernel);
+				functions.fc32ToSC16BE = GetFC32ToSC16BEFunction(functions.kernel);
+				functions.swapSC16 = GetSwapSC16Function(functions.kernel);
+				for (int type = 0; type <= (int)StreamType::PlanarFC32; type++)
+				{
+					for (int numChannels = 2; numChannels <= MAX_DEINTERLEAVE_CHANNELS; numChannels++)
+					{
+						functions.deinterleave[type][numChannels] = GetDeinterleaveFunction(functions.kernel, (StreamType)type, numChannels);
+						functions.interleave[type][numChannels] = GetInterleaveFunction(functions.kernel, (StreamType)type, numChannels);
+					}
+				}
+			}
+		}
+	};
+
+	const KernelFunctions& GetKernelFunctions(ConversionKernel kernel)
+	{
+		static const KernelTable table;
+		return table.kernels[(int)kernel];
+	}
+}
+
+size_t THR::GetStreamItemSize(StreamType type)
+{
+	switch (type)
+	{
+	case StreamType::SC16:
+		return 2 * sizeof(int16_t);
+	case StreamType::SC8:
+		return 2 * sizeof(int8_t);
+	case StreamType::PlanarFC32:
+		return sizeof(float);
+	default:
+		return 2 * sizeof(float);
+	}
+}
+
+int THR::GetStreamPortCount(StreamType type)
+{
+	return type == StreamType::PlanarFC32 ? 2 : 1;
+}
+
+ConversionKernel THR::GetConversionKernel()
+{
+	return Active().kernel;
+}
+
+bool THR::IsConversionKernelAvailable(ConversionKernel kernel)
+{
+	return IsKernelSupported(kernel);
+}
+
+bool THR::SetConversionKernel(ConversionKernel kernel)
+{
+	if (!IsKernelSupported(kernel))
+	{
+		return false;
+	}
+	ActiveFunctions().store(&GetKernelFunctions(kernel), std::memory_order_release);
+	return true;
+}
+
+const char* THR::GetConversionKernelName(ConversionKernel kernel)
+{
+	switch (kernel)
+	{
+	case ConversionKernel::SSE2:
+		return "SSE2";
+	case ConversionKernel::AVX2:
+		return "AVX2";
+	case ConversionKernel::AVX512:
+		return "AVX-512";
+	case ConversionKernel::NEON:
+		return "NEON";
+	default:
+		return "scalar";
+	}
+}
+
+void THR::ConvertSC16BEToFC32(const uint8_t* in, float* out, size_t numSamples, float scale)
+{
+	Active().sc16BEToFC32(in, out, numSamples, scale);
+}
+
+size_t THR::ConvertFC32ToSC16BE(const float* in, uint8_t* out, size_t numSamples, float scale)
+{
+	return Active().fc32ToSC16BE(in, out, numSamples, scale);
+}
+
+void THR::SwapSC16(const uint8_t* in, uint8_t* out, size_t numSamples)
+{
+	Active().swapSC16(in, out, numSamples);
+}
+
+void THR::DeinterleaveSC16BE(const uint8_t* in, void* const* out, StreamType type, int numChannels, size_t numFrames, float scale)
+{
+	if (numChannels <= 1)
+	{
+		switch (type)
+		{
+		case StreamType::SC16:
+			SwapSC16(in, (uint8_t*)out[0], numFrames);
+			break;
+		case StreamType::SC8:
+			ConvertSC16BEToSC8(in, (int8_t*)out[0], numFrames);
+			break;
+		case StreamType::PlanarFC32:
+			ConvertSC16BEToPlanarFC32(in, (float*)out[0], (float*)out[1], numFrames, scale);
+			break;
+		default:
+			ConvertSC16BEToFC32(in, (float*)out[0], numFrames, scale);
+			break;
+		}
+		return;
+	}
+	numChannels = std::min(numChannels, MAX_DEINTERLEAVE_CHANNELS);
+	Active().deinterleave[(int)type][numChannels](in, (uint8_t* const*)out, numFrames, scale);
+}
+
+size_t THR::InterleaveSC16BE(const void* const* in, uint8_t* out, StreamType type, int numChannels, size_t numFrames, float scale)
+{
+	if (numChannels <= 1)
+	{
+		switch (type)
+		{
+		case StreamType::SC16:
+			SwapSC16((const uint8_t*)in[0], out, numFrames);
+			return 0;
+		case StreamType::SC8:
+			ConvertSC8ToSC16BE((const int8_t*)in[0], out, numFrames);
+			return 0;
+		case StreamType::PlanarFC32:
+			return ConvertPlanarFC32ToSC16BE((const float*)in[0], (const float*)in[1], out, numFrames, scale);
+		default:
+			return ConvertFC32ToSC16BE((const float*)in[0], out, numFrames, scale);
+		}
+	}
+	numChannels = std::min(numChannels, MAX_DEINTERLEAVE_CHANNELS);
+	return Active().interleave[(int)type][numChannels]((const uint8_t* const*)in, out, numFrames, scale);
+}
+
+// The remaining conversions are plain loops the compiler vectorizes on its own; they only touch half the bytes of the float paths anyway.
+void THR::ConvertSC16BEToSC8(const uint8_t* in, int8_t* out, size_t numSamples)
+{
+	size_t numValues = numSamples * 2;
+	for (size_t i = 0; i < numValues; i++)
+	{
+		out[i] = (int8_t)in[2 * i];
+	}
+}
+
+void THR::ConvertSC8ToSC16BE(const int8_t* in, uint8_t* out, size_t numSamples)
+{
+	size_t numValues = numSamples * 2;
+	for (size_t i = 0; i < numValues; i++)
+	{
+		out[2 * i] = (uint8_t)in[i];
+		out[2 * i + 1] = 0;
+	}
+}
+
+void THR::ConvertSC16BEToPlanarFC32(const uint8_t* in, float* outI, float* outQ, size_t numSamples, float scale)
+{
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		outI[i] = (float)(int16_t)(((uint16_t)in[4 * i] << 8) | (uint16_t)in[4 * i + 1]) * scale;
+		outQ[i] = (float)(int16_t)(((uint16_t)in[4 * i + 2] << 8) | (uint16_t)in[4 * i + 3]) * scale;
+	}
+}
+
+size_t THR::ConvertPlanarFC32ToSC16BE(const float* inI, const float* inQ, uint8_t* out, size_t numSamples, float scale)
+{
+	size_t numClipped = 0;
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		PackSC16BE(inI[i] * scale, out + 4 * i, numClipped);
+		PackSC16BE(inQ[i] * scale, out + 4 * i + 2, numClipped);
+	}
+	return numClipped;
+}
@@ -0,0 +1,154 @@
+#ifndef SAMPLECONVERSION_H
+#define SAMPLECONVERSION_H
+#include <cstddef>
+#include <cstdint>
+
+namespace THR
+{
+	/// <summary>
+	/// Instruction set used by the sample conversion kernels. Picked once at runtime from what the CPU supports.
+	/// </summary>
+	enum class ConversionKernel
+	{
+		Scalar = 0,
+		SSE2,
+		AVX2,
+		AVX512,
+		NEON
+	};
+
+	/// <summary>
+	/// Sample format of the GNU Radio side of sabr_source/sabr_sink. The device itself always streams big endian sc16.
+	/// </summary>
+	enum class StreamType
+	{
+		/// <summary>
+		/// gr_complex, one port.
+		/// </summary>
+		FC32 = 0,
+		/// <summary>
+		/// Interleaved host endian int16 I/Q (4 bytes per sample), one port.
+		/// </summary>
+		SC16,
+		/// <summary>
+		/// Interleaved int8 I/Q (2 bytes per sample) holding the top 8 bits of each 16 bit value, one port.
+		/// </summary>
+		SC8,
+		/// <summary>
+		/// Two float ports, I on the first and Q on the second.
+		/// </summary>
+		PlanarFC32
+	};
+
+	/// <summary>
+	/// Size in bytes of one item on each port of the given stream type.
+	/// </summary>
+	size_t GetStreamItemSize(StreamType type);
+
+	/// <summary>
+	/// Number of ports the given stream type uses.
+	/// </summary>
+	int GetStreamPortCount(StreamType type);
+
+	/// <summary>
+	/// Convert big endian sc16 samples (the device wire format, I then Q) to interleaved 32 bit float I/Q, which is the memory layout of gr_complex.
+	/// Every kernel gives bit-identical output to the scalar version.
+	/// </summary>
+	/// <param name="in">Raw device bytes, 4 per sample. No alignment requirement.</param>
+	/// <param name="out">2 floats per sample. No alignment requirement.</param>
+	/// <param name="numSamples">Number of IQ samples to convert.</param>
+	/// <param name="scale">Applied to every value as part of the conversion, for instance 1/32768 to normalize to +/-1.0.</param>
+	void ConvertSC16BEToFC32(const uint8_t* in, float* out, size_t numSamples, float scale = 1.0f);
+
+	/// <summary>
+	/// Convert interleaved 32 bit float I/Q (gr_complex layout) to big endian sc16 for the device. Values are scaled, clamped to the int16 range and
+	/// then truncated toward zero, so out of range input saturates instead of wrapping. Every kernel gives bit-identical output to the scalar version.
+	/// </summary>
+	/// <param name="in">2 floats per sample. No alignment requirement.</param>
+	/// <param name="out">Device bytes, 4 per sample. No alignment requirement.</param>
+	/// <param name="numSamples">Number of IQ samples to convert.</param>
+	/// <param name="scale">Applied to every value before it is clamped, for instance 32767 for +/-1.0 input.</param>
+	/// <returns>Number of I or Q values that had to be clamped (NaN counts as clamped and comes out as -32768).</returns>
+	size_t ConvertFC32ToSC16BE(const float* in, uint8_t* out, size_t numSamples, float scale = 1.0f);
+
+	/// <summary>
+	/// Swap the bytes of every 16 bit value, which converts big endian sc16 to host endian sc16 and back. in and out may be the same buffer.
+	/// </summary>
+	void SwapSC16(const uint8_t* in, uint8_t* out, size_t numSamples);
+
+	/// <summary>
+	/// Keep the top 8 bits of every big endian sc16 value.
+	/// </summary>
+	void ConvertSC16BEToSC8(const uint8_t* in, int8_t* out, size_t numSamples);
+
+	/// <summary>
+	/// Widen sc8 samples to big endian sc16 (the value goes in the top 8 bits).
+	/// </summary>
+	void ConvertSC8ToSC16BE(const int8_t* in, uint8_t* out, size_t numSamples);
+
+	/// <summary>
+	/// Same as ConvertSC16BEToFC32() but writes I and Q to separate buffers.
+	/// </summary>
+	void ConvertSC16BEToPlanarFC32(const uint8_t* in, float* outI, float* outQ, size_t numSamples, float scale = 1.0f);
+
+	/// <summary>
+	/// Same as ConvertFC32ToSC16BE() but reads I and Q from separate buffers.
+	/// </summary>
+	size_t ConvertPlanarFC32ToSC16BE(const float* inI, const float* inQ, uint8_t* out, size_t numSamples, float scale = 1.0f);
+
+	/// <summary>
+	/// Most channels DeinterleaveSC16BE() can split and InterleaveSC16BE() can merge.
+	/// </summary>
+	const int MAX_DEINTERLEAVE_CHANNELS = 4;
+
+	/// <summary>
+	/// Split the device's multi-channel stream, which carries one big endian sc16 sample of each active channel in turn, into one output per
+	/// channel and convert it to the given stream type on the way. Specialized per channel count; 2 and 4 channel gr_complex output is done
+	/// in registers on AVX2 machines, everything else is converted a few hundred frames at a time and then scattered.
+	/// </summary>
+	/// <param name="in">numFrames * numChannels samples, 4 bytes each. No alignment requirement.</param>
+	/// <param name="out">GetStreamPortCount(type) buffers per channel, channel by channel (PlanarFC32: I of channel 0, Q of channel 0, I of channel 1...).</param>
+	/// <param name="type">Output format.</param>
+	/// <param name="numChannels">1 to MAX_DEINTERLEAVE_CHANNELS.</param>
+	/// <param name="numFrames">Number of samples per channel.</param>
+	/// <param name="scale">Applied to every value of the float stream types.</param>
+	void DeinterleaveSC16BE(const uint8_t* in, void* const* out, StreamType type, int numChannels, size_t numFrames, float scale = 1.0f);
+
+	/// <summary>
+	/// The reverse of DeinterleaveSC16BE(): merge one input per transmit channel into the device's multi-channel stream, converting to big endian
+	/// sc16 on the way. Every frame holds one sample of each channel, so the channels stay aligned sample for sample.
+	/// </summary>
+	/// <param name="in">GetStreamPortCount(type) buffers per channel, channel by channel.</param>
+	/// <param name="out">numFrames * numChannels samples, 4 bytes each. No alignment requirement.</param>
+	/// <param name="type">Input format.</param>
+	/// <param name="numChannels">1 to MAX_DEINTERLEAVE_CHANNELS.</param>
+	/// <param name="numFrames">Number of samples per channel.</param>
+	/// <param name="scale">Applied to every value of the float stream types before it is clamped.</param>
+	/// <returns>Number of I or Q values that had to be clamped, as for ConvertFC32ToSC16BE().</returns>
+	size_t InterleaveSC16BE(const void* const* in, uint8_t* out, StreamType type, int numChannels, size_t numFrames, float scale = 1.0f);
+
+	/// <summary>
+	/// Kernel ConvertSC16BEToFC32(), ConvertFC32ToSC16BE(), SwapSC16() and the multi-channel conversions dispatch to. The fastest one this CPU
+	/// supports unless SetConversionKernel() picked another.
+	/// </summary>
+	ConversionKernel GetConversionKernel();
+
+	/// <summary>
+	/// Whether this build and CPU can run a kernel. Scalar always can.
+	/// </summary>
+	bool IsConversionKernelAvailable(ConversionKernel kernel);
+
+	/// <summary>
+	/// Dispatch every conversion to a kernel other than the detected one, so the kernels can be checked against the scalar reference.
+	/// Conversions already running on other threads finish on the kernel they started with.
+	/// </summary>
+	/// <returns>false, leaving the kernel as it was, if the kernel isn't available.</returns>
+	bool SetConversionKernel(ConversionKernel kernel);
+
+	/// <summary>
+	/// Printable name of a ConversionKernel.
+	/// </summary>
+	const char* GetConversionKernelName(ConversionKernel kernel);
+}
+
+#endif
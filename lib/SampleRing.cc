@@ -0,0 +1,249 @@
+#include "SampleRing.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+using namespace THR;
+
+namespace
+{
+	// Slots start on a cache line so the SIMD converters and the USB driver get aligned buffers
+	const uintptr_t SLOT_ALIGNMENT = 64;
+	// Upper bound on a single sleep so a missed wakeup only costs a little latency
+	const uint32_t MAX_WAIT_SLICE_MS = 10;
+}
+
+const uint64_t SampleRing::NO_SLOT;
+
+SampleRing::SampleRing(uint32_t numSlots, uint32_t slotBytes, OverflowPolicy policy, uint32_t maxPendingWrites)
+	: numSlots(max(maxPendingWrites + 1, max(2u, numSlots))), slotBytes(slotBytes), maxPendingWrites(max(1u, maxPendingWrites)), policy(policy), head(0), tail(0),
+	claimed(NO_SLOT), overflowCount(0), droppedBytes(0), isShutdown(false), pendingWriteStart(0), numPendingWrites(0), nextWriteSlot(0), nextScratch(0),
+	pendingFlags(0), readSlot(NO_SLOT), readOffset(0), nextExpectedSlot(0), carriedFlags(0), isConsumerWaiting(false), isProducerWaiting(false)
+{
+	uint64_t alignedSlotBytes = (slotBytes + SLOT_ALIGNMENT - 1) & ~(SLOT_ALIGNMENT - 1);
+	storage.reset(new uint8_t[alignedSlotBytes * this->numSlots + SLOT_ALIGNMENT]);
+	uint8_t* base = (uint8_t*)(((uintptr_t)storage.get() + SLOT_ALIGNMENT - 1) & ~(SLOT_ALIGNMENT - 1));
+	slots.resize(this->numSlots);
+	for (uint32_t i = 0; i < this->numSlots; i++)
+	{
+		slots[i].data = base + i * alignedSlotBytes;
+		slots[i].length = 0;
+		slots[i].flags = 0;
+		slots[i].timestamp = 0;
+	}
+	scratch.resize(this->maxPendingWrites, vector<uint8_t>(slotBytes));
+	pendingWrites.resize(this->maxPendingWrites, NO_SLOT);
+}
+
+uint8_t* SampleRing::AcquireWrite()
+{
+	if (numPendingWrites == maxPendingWrites)
+	{
+		return NULL;
+	}
+	uint64_t currHead = nextWriteSlot;
+	// Nothing to reuse during the first pass over the ring
+	bool isReuse = currHead >= numSlots;
+	uint64_t reuseSlot = currHead - numSlots;
+	uint32_t pendingIndex = (pendingWriteStart + numPendingWrites) % maxPendingWrites;
+	numPendingWrites++;
+	while (true)
+	{
+		uint64_t currTail = tail.load();
+		// The slot we'd write over must have been read (or dropped) and the consumer must not still be holding it
+		if (currHead - currTail < numSlots && (!isReuse || claimed.load() != reuseSlot))
+		{
+			pendingWrites[pendingIndex] = currHead;
+			nextWriteSlot++;
+			return slots[currHead % numSlots].data;
+		}
+
+		if (policy == OverflowPolicy::DropOldest && currHead - currTail >= numSlots)
+		{
+			// Take the oldest slot away from the consumer. If the consumer claims it first the CAS fails and we look again.
+			if (tail.compare_exchange_strong(currTail, currTail + 1))
+			{
+				overflowCount++;
+				droppedBytes += slots[currTail % numSlots].length;
+			}
+			else
+			{
+				this_thread::yield();
+			}
+			continue;
+		}
+
+		if (policy == OverflowPolicy::Block && !isShutdown.load())
+		{
+			unique_lock<mutex> lock(waitMutex);
+			isProducerWaiting = true;
+			if (currHead - tail.load() >= numSlots || (isReuse && claimed.load() == reuseSlot))
+			{
+				spaceReady.wait_for(lock, chrono::milliseconds(MAX_WAIT_SLICE_MS));
+			}
+			isProducerWaiting = false;
+			continue;
+		}
+
+		// DropNewest, or DropOldest while the consumer still holds the slot we need
+		pendingWrites[pendingIndex] = NO_SLOT;
+		return &scratch[nextScratch++ % maxPendingWrites][0];
+	}
+}
+
+void SampleRing::CommitWrite(uint32_t length, uint32_t flags, uint64_t timestamp)
+{
+	if (numPendingWrites == 0)
+	{
+		return;
+	}
+	uint64_t writeSlot = pendingWrites[pendingWriteStart];
+	pendingWriteStart = (pendingWriteStart + 1) % maxPendingWrites;
+	numPendingWrites--;
+	if (writeSlot == NO_SLOT)
+	{
+		if (length > 0)
+		{
+			overflowCount++;
+			droppedBytes += length;
+			pendingFlags |= RING_SLOT_DATA_LOST;
+		}
+		// Whatever the producer flagged still applies to the next slot that makes it through
+		pendingFlags |= flags;
+		return;
+	}
+	Slot& slot = slots[writeSlot % numSlots];
+	slot.length = min(length, slotBytes);
+	slot.flags = flags | pendingFlags;
+	slot.timestamp = timestamp;
+	pendingFlags = 0;
+	head.store(writeSlot + 1);
+	if (isConsumerWaiting.load())
+	{
+		lock_guard<mutex> lock(waitMutex);
+		dataReady.notify_one();
+	}
+}
+
+bool SampleRing::AcquireRead(const uint8_t*& data, uint32_t& length, uint32_t& flags, uint64_t& timestamp, uint32_t timeoutMs)
+{
+	flags = 0;
+	if (readSlot != NO_SLOT)
+	{
+		const Slot& slot = slots[readSlot % numSlots];
+		data = slot.data + readOffset;
+		length = slot.length - readOffset;
+		timestamp = slot.timestamp;
+		return true;
+	}
+
+	chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+	while (true)
+	{
+		uint64_t currTail = tail.load();
+		if (currTail < head.load())
+		{
+			// Announce the claim before taking the slot so the producer never reuses it underneath us
+			claimed.store(currTail);
+			if (tail.compare_exchange_strong(currTail, currTail + 1))
+			{
+				const Slot& slot = slots[currTail % numSlots];
+				if (currTail != nextExpectedSlot)
+				{
+					// The producer dropped the slot(s) in between
+					carriedFlags |= RING_SLOT_DATA_LOST;
+				}
+				nextExpectedSlot = currTail + 1;
+				if (slot.length == 0)
+				{
+					// Empty transfer: keep its flags for the next slot with data and give it straight back
+					carriedFlags |= slot.flags;
+					readSlot = currTail;
+					ReleaseRead(0);
+					continue;
+				}
+				readSlot = currTail;
+				readOffset = 0;
+				data = slot.data;
+				length = slot.length;
+				timestamp = slot.timestamp;
+				flags = slot.flags | carriedFlags;
+				carriedFlags = 0;
+				return true;
+			}
+			continue;
+		}
+
+		claimed.store(NO_SLOT);
+		if (isShutdown.load() || chrono::steady_clock::now() >= deadline)
+		{
+			return false;
+		}
+		unique_lock<mutex> lock(waitMutex);
+		isConsumerWaiting = true;
+		if (tail.load() >= head.load())
+		{
+			dataReady.wait_until(lock, min(deadline, chrono::steady_clock::now() + chrono::milliseconds(MAX_WAIT_SLICE_MS)));
+		}
+		isConsumerWaiting = false;
+	}
+}
+
+void SampleRing::ReleaseRead(uint32_t numBytes)
+{
+	if (readSlot == NO_SLOT)
+	{
+		return;
+	}
+	readOffset += numBytes;
+	if (readOffset >= slots[readSlot % numSlots].length)
+	{
+		readSlot = NO_SLOT;
+		readOffset = 0;
+		claimed.store(NO_SLOT);
+		if (isProducerWaiting.load())
+		{
+			lock_guard<mutex> lock(waitMutex);
+			spaceReady.notify_one();
+		}
+	}
+}
+
+void SampleRing::Shutdown()
+{
+	isShutdown = true;
+	lock_guard<mutex> lock(waitMutex);
+	dataReady.notify_all();
+	spaceReady.notify_all();
+}
+
+FrameCarry::FrameCarry(uint32_t frameBytes)
+	: frameBytes(frameBytes), frame(frameBytes), numBytes(0)
+{
+}
+
+uint32_t FrameCarry::Fill(const uint8_t* data, uint32_t length)
+{
+	uint32_t numCopied = min(frameBytes - numBytes, length);
+	memcpy(&frame[numBytes], data, numCopied);
+	numBytes += numCopied;
+	return numCopied;
+}
+
+uint32_t FrameCarry::Take(uint8_t* dest)
+{
+	uint32_t numCopied = numBytes;
+	memcpy(dest, &frame[0], numCopied);
+	numBytes = 0;
+	return numCopied;
+}
+
+void FrameCarry::OnGap(uint32_t flags)
+{
+	if (flags & RING_SLOT_DATA_LOST)
+	{
+		numBytes = 0;
+	}
+}
@@ -0,0 +1,229 @@
+#ifndef SAMPLERING_H
+#define SAMPLERING_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace THR
+{
+	/// <summary>
+	/// What a SampleRing producer does when the consumer has fallen behind and every slot is full.
+	/// </summary>
+	enum class OverflowPolicy
+	{
+		/// <summary>
+		/// Discard the oldest unread slot so the consumer always sees the freshest samples.
+		/// </summary>
+		DropOldest = 0,
+		/// <summary>
+		/// Discard the incoming transfer and keep what is already queued.
+		/// </summary>
+		DropNewest,
+		/// <summary>
+		/// Wait for the consumer to free a slot. Nothing is dropped on the host but the device FIFO can overflow instead.
+		/// </summary>
+		Block
+	};
+
+	/// <summary>
+	/// Set on the first slot handed to the consumer after samples were discarded.
+	/// </summary>
+	const uint32_t RING_SLOT_DATA_LOST = 0x00000001;
+
+	/// <summary>
+	/// Set by RadioDevice on the first slot after a USB read timed out. The device may have dropped samples while nothing was reading it.
+	/// </summary>
+	const uint32_t RING_SLOT_READ_TIMEOUT = 0x00000002;
+
+	/// <summary>
+	/// Set by RadioDevice on the first slot after a USB read failed for any other reason.
+	/// </summary>
+	const uint32_t RING_SLOT_READ_ERROR = 0x00000004;
+
+	/// <summary>
+	/// TX: the slot starts a burst. The slot timestamp holds the requested start time (host clock, ns since the epoch), 0 to start right away.
+	/// </summary>
+	const uint32_t RING_SLOT_START_OF_BURST = 0x00000008;
+
+	/// <summary>
+	/// TX: the slot ends a burst.
+	/// </summary>
+	const uint32_t RING_SLOT_END_OF_BURST = 0x00000010;
+
+	/// <summary>
+	/// Preallocated lock-free single producer/single consumer ring of fixed size slots. Each slot holds one USB transfer so the producer can read
+	/// straight into ring memory and the consumer can convert straight out of it.
+	/// The consumer owns at most one slot at a time (from AcquireRead until it has released every byte of it), the producer owns the slots between
+	/// AcquireWrite and CommitWrite. The producer can hold up to maxPendingWrites slots so several USB transfers can be queued into the ring at once.
+	/// </summary>
+	class SampleRing
+	{
+	private:
+		struct Slot
+		{
+			uint8_t* data;
+			uint32_t length;
+			uint32_t flags;
+			uint64_t timestamp;
+		};
+
+		static const uint64_t NO_SLOT = UINT64_MAX;
+
+		const uint32_t numSlots;
+		const uint32_t slotBytes;
+		const uint32_t maxPendingWrites;
+		const OverflowPolicy policy;
+		std::unique_ptr<uint8_t[]> storage;
+		std::vector<Slot> slots;
+		// One throw-away buffer per pending write, handed out when the incoming data is being dropped
+		std::vector<std::vector<uint8_t>> scratch;
+
+		// Number of slots published by the producer
+		std::atomic<uint64_t> head;
+		// Next slot to be read. Advanced by the consumer, and by the producer when dropping the oldest slot
+		std::atomic<uint64_t> tail;
+		// Slot the consumer is currently reading from
+		std::atomic<uint64_t> claimed;
+		std::atomic<uint64_t> overflowCount;
+		std::atomic<uint64_t> droppedBytes;
+		std::atomic<bool> isShutdown;
+
+		// Producer only. Slot index (or NO_SLOT for scratch) of every buffer handed out by AcquireWrite, oldest first
+		std::vector<uint64_t> pendingWrites;
+		uint32_t pendingWriteStart;
+		uint32_t numPendingWrites;
+		uint64_t nextWriteSlot;
+		uint32_t nextScratch;
+		uint32_t pendingFlags;
+
+		// Consumer only
+		uint64_t readSlot;
+		uint32_t readOffset;
+		uint64_t nextExpectedSlot;
+		// Flags of empty slots skipped since the last slot handed out
+		uint32_t carriedFlags;
+
+		// Only used to sleep when the ring is empty (consumer) or full with OverflowPolicy::Block (producer)
+		std::mutex waitMutex;
+		std::condition_variable dataReady;
+		std::condition_variable spaceReady;
+		std::atomic<bool> isConsumerWaiting;
+		std::atomic<bool> isProducerWaiting;
+
+	public:
+		/// <summary>
+		/// Allocate the ring up front.
+		/// </summary>
+		/// <param name="numSlots">Number of transfers the ring can hold. At least 2.</param>
+		/// <param name="slotBytes">Size of each transfer in bytes.</param>
+		/// <param name="policy">What to do when the ring is full.</param>
+		/// <param name="maxPendingWrites">How many buffers the producer may acquire before committing the first one. Less than numSlots.</param>
+		SampleRing(uint32_t numSlots, uint32_t slotBytes, OverflowPolicy policy, uint32_t maxPendingWrites = 1);
+
+		uint32_t GetSlotBytes() const { return slotBytes; }
+		uint32_t GetNumSlots() const { return numSlots; }
+
+		/// <summary>
+		/// Number of overflow events (slots or transfers discarded) since the ring was created.
+		/// </summary>
+		uint64_t GetOverflowCount() const { return overflowCount.load(); }
+
+		/// <summary>
+		/// Number of bytes discarded because of overflows.
+		/// </summary>
+		uint64_t GetDroppedBytes() const { return droppedBytes.load(); }
+
+		/// <summary>
+		/// Number of committed slots the consumer hasn't started on yet. Only a snapshot while the other side is running.
+		/// </summary>
+		uint32_t GetNumQueuedSlots() const { return (uint32_t)(head.load() - tail.load()); }
+
+		/// <summary>
+		/// Producer: get the buffer the next transfer should be written to (always GetSlotBytes() long). If the ring is full and the policy drops
+		/// the incoming data this is a scratch buffer that is thrown away on CommitWrite. With OverflowPolicy::Block this waits for room, and gives
+		/// back the scratch buffer if Shutdown() is called while waiting. Returns NULL if maxPendingWrites buffers are already pending.
+		/// </summary>
+		uint8_t* AcquireWrite();
+
+		/// <summary>
+		/// Producer: publish the oldest buffer returned by AcquireWrite(). Buffers are always committed in the order they were acquired.
+		/// </summary>
+		/// <param name="length">Number of valid bytes in the buffer. 0 hands the slot back without giving the consumer anything.</param>
+		/// <param name="flags">RING_SLOT_* flags to pass on to the consumer.</param>
+		/// <param name="timestamp">Opaque value passed on to the consumer with the slot, e.g. when the data arrived.</param>
+		void CommitWrite(uint32_t length, uint32_t flags, uint64_t timestamp = 0);
+
+		/// <summary>
+		/// Consumer: get the unread part of the oldest slot, waiting up to timeoutMs for one to be published.
+		/// </summary>
+		/// <param name="data">Start of the unread bytes.</param>
+		/// <param name="length">Number of unread bytes in the slot.</param>
+		/// <param name="flags">RING_SLOT_* flags for the slot; only reported the first time a slot is acquired, 0 afterwards.</param>
+		/// <param name="timestamp">Value the slot was committed with.</param>
+		/// <param name="timeoutMs">How long to wait for data. 0 to return immediately.</param>
+		/// <returns>true if data is available; false on timeout or shutdown.</returns>
+		bool AcquireRead(const uint8_t*& data, uint32_t& length, uint32_t& flags, uint64_t& timestamp, uint32_t timeoutMs);
+
+		/// <summary>
+		/// Consumer: mark bytes from the slot returned by AcquireRead() as used. The slot goes back to the producer once all of it is released.
+		/// </summary>
+		void ReleaseRead(uint32_t numBytes);
+
+		/// <summary>
+		/// Wake up and fail any waiting AcquireRead()/AcquireWrite().
+		/// </summary>
+		void Shutdown();
+	};
+
+	/// <summary>
+	/// Consumer side of a stream of multi-channel frames (one IQ sample per channel). Transfers and ring slots don't have to end on a frame
+	/// boundary, so the start of a frame split across two of them is held here until the rest of it arrives.
+	/// </summary>
+	class FrameCarry
+	{
+	private:
+		const uint32_t frameBytes;
+		std::vector<uint8_t> frame;
+		uint32_t numBytes;
+
+	public:
+		explicit FrameCarry(uint32_t frameBytes);
+
+		/// <summary>
+		/// Number of bytes of the frame held so far.
+		/// </summary>
+		uint32_t GetBytes() const { return numBytes; }
+
+		bool IsComplete() const { return numBytes == frameBytes; }
+
+		/// <summary>
+		/// The frame put together by Fill(), once IsComplete().
+		/// </summary>
+		const uint8_t* GetFrame() const { return &frame[0]; }
+
+		/// <summary>
+		/// Append bytes from the start of data until the frame is complete.
+		/// </summary>
+		/// <returns>Number of bytes taken from data.</returns>
+		uint32_t Fill(const uint8_t* data, uint32_t length);
+
+		/// <summary>
+		/// Copy the bytes held to dest, so the next read can go in right behind them, and start over.
+		/// </summary>
+		/// <returns>Number of bytes copied.</returns>
+		uint32_t Take(uint8_t* dest);
+
+		/// <summary>
+		/// Account for the RING_SLOT_* flags of a gap in the stream. Only RING_SLOT_DATA_LOST drops the bytes held: a timed out or failed read
+		/// loses nothing that was already read, so the rest of the frame is still at the head of the next data.
+		/// </summary>
+		void OnGap(uint32_t flags);
+
+		void Clear() { numBytes = 0; }
+	};
+}
+
+#endif
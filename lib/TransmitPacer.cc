@@ -0,0 +1,108 @@
+#include "TransmitPacer.h"
+#include <chrono>
+#include <thread>
+
+using namespace std;
+using namespace THR;
+
+namespace
+{
+	const uint64_t NS_PER_SECOND = 1000000000;
+	// Sleeps wake up late by tens of microseconds, so sleep until shortly before the deadline and spin the rest
+	const uint64_t SPIN_TAIL_NS = 50000;
+	// Lateness below this is scheduling noise rather than a missed sample
+	const uint64_t LATE_TOLERANCE_NS = 100000;
+}
+
+TransmitPacer::TransmitPacer()
+	: sampleRate(0), leadNs(0), isStarted(false), startNs(0), numSamplesReleased(0), lateCount(0)
+{
+}
+
+uint64_t TransmitPacer::GetMonotonicNs()
+{
+	return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t TransmitPacer::SamplesToNs(uint64_t numSamples) const
+{
+	return sampleRate > 0 ? (uint64_t)((double)numSamples * NS_PER_SECOND / sampleRate) : 0;
+}
+
+void TransmitPacer::SetSampleRate(double sampleRate)
+{
+	// Rebase so the samples already released stay on the old rate's timeline
+	startNs += SamplesToNs(numSamplesReleased);
+	numSamplesReleased = 0;
+	this->sampleRate = sampleRate;
+}
+
+void TransmitPacer::SetLeadTime(double leadSeconds)
+{
+	leadNs = leadSeconds > 0 ? (uint64_t)(leadSeconds * NS_PER_SECOND) : 0;
+}
+
+void TransmitPacer::Reset()
+{
+	isStarted = false;
+	numSamplesReleased = 0;
+	lateCount = 0;
+}
+
+void TransmitPacer::StartAt(uint64_t startNs)
+{
+	isStarted = true;
+	this->startNs = startNs;
+	numSamplesReleased = 0;
+}
+
+void TransmitPacer::SleepUntil(uint64_t wakeNs)
+{
+	uint64_t now = GetMonotonicNs();
+	if (now < wakeNs && wakeNs - now > SPIN_TAIL_NS)
+	{
+		// An absolute wake time, so a sleep that starts late doesn't push the deadline back
+		this_thread::sleep_until(chrono::steady_clock::time_point(chrono::duration_cast<chrono::steady_clock::duration>(chrono::nanoseconds(wakeNs - SPIN_TAIL_NS))));
+	}
+	while (GetMonotonicNs() < wakeNs)
+	{
+	}
+}
+
+uint64_t TransmitPacer::Wait(uint64_t numSamples)
+{
+	uint64_t now = GetMonotonicNs();
+	if (!isStarted)
+	{
+		isStarted = true;
+		startNs = now;
+		numSamplesReleased = 0;
+	}
+	// The write for these samples is due when the device has played everything before them, minus the allowed lead
+	uint64_t dueNs = startNs + SamplesToNs(numSamplesReleased);
+	uint64_t deadline = dueNs > leadNs ? dueNs - leadNs : 0;
+	uint64_t lateNs = 0;
+	if (now < deadline)
+	{
+		SleepUntil(deadline);
+	}
+	else if (now > dueNs + LATE_TOLERANCE_NS)
+	{
+		// Past deadline but within the lead just means the lead is being refilled. Past due means the device has run dry: restart the schedule from
+		// now rather than bursting to catch up.
+		lateNs = now - dueNs;
+		lateCount++;
+		startNs = now;
+		numSamplesReleased = 0;
+	}
+	numSamplesReleased += numSamples;
+	return lateNs;
+}
+
+void TransmitPacer::WaitForDrain()
+{
+	if (isStarted)
+	{
+		SleepUntil(startNs + SamplesToNs(numSamplesReleased));
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef TRANSMITPACER_H
+#define TRANSMITPACER_H
+#include <cstdint>
+
+namespace THR
+{
+	/// <summary>
+	/// Releases TX samples to the device at the sample rate. Every write has an absolute deadline computed from the number of samples released since
+	/// the schedule started, so timing error never accumulates. Waiting sleeps on std::chrono::steady_clock and only spins for the last few microseconds.
+	/// </summary>
+	class TransmitPacer
+	{
+	private:
+		double sampleRate;
+		// How far ahead of the sample clock writes may run
+		uint64_t leadNs;
+		bool isStarted;
+		uint64_t startNs;
+		uint64_t numSamplesReleased;
+		uint64_t lateCount;
+
+		uint64_t SamplesToNs(uint64_t numSamples) const;
+		static void SleepUntil(uint64_t wakeNs);
+
+	public:
+		TransmitPacer();
+
+		/// <summary>
+		/// Current std::chrono::steady_clock time in nanoseconds.
+		/// </summary>
+		static uint64_t GetMonotonicNs();
+
+		/// <summary>
+		/// Change the rate samples are released at. Samples already released keep their old timing.
+		/// </summary>
+		void SetSampleRate(double sampleRate);
+
+		/// <summary>
+		/// Let writes run up to leadSeconds ahead of the sample clock, so that much data sits buffered in the USB stack and the device.
+		/// </summary>
+		void SetLeadTime(double leadSeconds);
+
+		/// <summary>
+		/// Start a new schedule; the next Wait() returns immediately and becomes time zero.
+		/// </summary>
+		void Reset();
+
+		/// <summary>
+		/// Start a new schedule whose first sample is due at the given GetMonotonicNs() time.
+		/// </summary>
+		void StartAt(uint64_t startNs);
+
+		/// <summary>
+		/// Wait until numSamples more samples are due to be written, then count them as released.
+		/// A write that is late but still within the lead time goes out immediately to refill the lead. Once even the lead is used up the device has
+		/// run dry, and the schedule restarts from now instead of rushing to catch up.
+		/// </summary>
+		/// <param name="numSamples">Number of samples about to be written.</param>
+		/// <returns>How many nanoseconds after its samples were due to be played the write is, 0 if it was in time.</returns>
+		uint64_t Wait(uint64_t numSamples);
+
+		/// <summary>
+		/// Wait until every sample released so far is due to have been played, ignoring the lead time.
+		/// </summary>
+		void WaitForDrain();
+
+		/// <summary>
+		/// Number of writes that came after their samples were due to be played since the last Reset().
+		/// </summary>
+		uint64_t GetLateCount() const { return lateCount; }
+	};
+}
+
+#endif
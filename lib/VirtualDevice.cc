@@ -0,0 +1,1086 @@
+#include "VirtualDevice.h"
+#include "RadioDevice.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+using namespace THR;
+
+namespace
+{
+	const UCHAR IQ_READ_PIPE = 0x82;
+	const UCHAR IQ_WRITE_PIPE = 0x02;
+	const UCHAR CMD_READ_PIPE = 0x83;
+	const UCHAR CMD_WRITE_PIPE = 0x03;
+	const uint32_t FRAME_LENGTH_BYTES = 16;
+	const uint32_t PACKET_PREFIX = 0x5A000000;
+	const uint32_t PACKET_SUFFIX = 0xA5000000;
+	const uint32_t PACKET_DELIMITER_MASK = 0xFF000000;
+	const uint32_t DEV_ACK_RESP = 0x00800000;
+	const uint32_t SET_CMD_BIT = 0x00008000;
+	const uint32_t CMD_ID_FIELD_MASK = 0x00007FF0;
+	const uint32_t CMD_CHANNEL_FIELD_MASK = 0x0000000F;
+	const uint32_t NUM_CHANNELS = 4;
+	const uint32_t TONE_TABLE_SAMPLES = 4096;
+	const uint32_t NOISE_TABLE_SAMPLES = 65536;
+	const DWORD DEFAULT_PIPE_TIMEOUT_MS = 5000;
+	// Reported through ERMVersion: software 2.4, hardware 1.0, FPGA type 1
+	const uint64_t ERM_VERSION_WORD = ((uint64_t)((1u << 16) | 0x0204) << 32) | 0x0100;
+	// Reported through Temperature, in milli-degrees C
+	const uint64_t TEMPERATURE_MDEG = 41500;
+
+	uint32_t ReadWord(const uint8_t* bytes)
+	{
+		return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
+	}
+
+	void WriteWord(uint8_t* bytes, uint32_t value)
+	{
+		bytes[0] = (uint8_t)(value >> 24);
+		bytes[1] = (uint8_t)(value >> 16);
+		bytes[2] = (uint8_t)(value >> 8);
+		bytes[3] = (uint8_t)value;
+	}
+
+	void WriteSample(vector<uint8_t>& pattern, double i, double q)
+	{
+		int16_t currI = (int16_t)max(-32768.0, min(32767.0, round(i)));
+		int16_t currQ = (int16_t)max(-32768.0, min(32767.0, round(q)));
+		pattern.push_back((uint8_t)((uint16_t)currI >> 8));
+		pattern.push_back((uint8_t)currI);
+		pattern.push_back((uint8_t)((uint16_t)currQ >> 8));
+		pattern.push_back((uint8_t)currQ);
+	}
+
+	uint32_t RegisterKey(CommandType commandType, uint32_t channel)
+	{
+		return ((uint32_t)commandType << 4) | channel;
+	}
+}
+
+VirtualDeviceConfig::VirtualDeviceConfig()
+	: signal(VirtualSignal::Tone), toneOffsetHz(100000.0), amplitude(8192), latencyUs(0), shortReadProbability(0.0),
+	timeoutProbability(0.0), fifoBytes(1048576), numDevices(1), realTime(true)
+{
+}
+
+VirtualDeviceConfig VirtualDeviceConfig::FromString(const string& args)
+{
+	VirtualDeviceConfig config;
+	stringstream argStream(args);
+	string item;
+	while (getline(argStream, item, ','))
+	{
+		size_t separator = item.find('=');
+		string key = item.substr(0, separator);
+		string value = separator == string::npos ? "" : item.substr(separator + 1);
+		if (key.empty() || key == "1")
+		{
+			continue;
+		}
+		else if (key == "signal")
+		{
+			if (value == "tone")
+			{
+				config.signal = VirtualSignal::Tone;
+			}
+			else if (value == "noise")
+			{
+				config.signal = VirtualSignal::Noise;
+			}
+			else if (value == "file")
+			{
+				config.signal = VirtualSignal::File;
+			}
+			else
+			{
+				cerr << "Virtual SABR: unknown signal '" << value << "', using tone" << endl;
+			}
+		}
+		else if (key == "tone")
+		{
+			config.toneOffsetHz = strtod(value.c_str(), NULL);
+		}
+		else if (key == "amplitude")
+		{
+			config.amplitude = (int16_t)min(32767L, max(0L, strtol(value.c_str(), NULL, 0)));
+		}
+		else if (key == "file")
+		{
+			config.filePath = value;
+			config.signal = VirtualSignal::File;
+		}
+		else if (key == "tx_file")
+		{
+			config.txFilePath = value;
+		}
+		else if (key == "latency_us")
+		{
+			config.latencyUs = (uint32_t)strtoul(value.c_str(), NULL, 0);
+		}
+		else if (key == "short_read")
+		{
+			config.shortReadProbability = strtod(value.c_str(), NULL);
+		}
+		else if (key == "timeout")
+		{
+			config.timeoutProbability = strtod(value.c_str(), NULL);
+		}
+		else if (key == "fifo")
+		{
+			config.fifoBytes = (uint32_t)strtoul(value.c_str(), NULL, 0);
+		}
+		else if (key == "devices")
+		{
+			config.numDevices = max(1UL, strtoul(value.c_str(), NULL, 0));
+		}
+		else if (key == "realtime")
+		{
+			config.realTime = value != "0";
+		}
+		else
+		{
+			cerr << "Virtual SABR: ignoring unknown option '" << key << "'" << endl;
+		}
+	}
+	return config;
+}
+
+VirtualSABR::VirtualSABR(const VirtualDeviceConfig& config, const string& serialNumber)
+	: config(config), serialNumber(serialNumber), isOpen(false), readRandom(random_device()()), writeRandom(random_device()())
+{
+	ResetRegisters();
+}
+
+VirtualSABR::~VirtualSABR()
+{
+	StopAsync();
+}
+
+void VirtualSABR::ResetRegisters()
+{
+	registers.clear();
+	for (uint32_t channel = 0; channel < NUM_CHANNELS; channel++)
+	{
+		registers[RegisterKey(CommandType::LOFrequency, channel)] = 470000000;
+		registers[RegisterKey(CommandType::Gain, channel)] = 0;
+		registers[RegisterKey(CommandType::GainMode, channel)] = 0;
+		registers[RegisterKey(CommandType::Bandwidth, channel)] = 1920000;
+	}
+	registers[RegisterKey(CommandType::MultiplexMode, 0)] = 0;
+	isCaptureEnabled = false;
+	isTransmitEnabled = false;
+	sampleRate = 1920000;
+	rxChannelCount = 1;
+	txChannelCount = 1;
+	captureGeneration++;
+	transmitGeneration++;
+}
+
+void VirtualSABR::Open()
+{
+	isOpen = true;
+	rxTotalBytes = rxOverflowEvents = rxDroppedBytes = rxTimeouts = rxShortReads = 0;
+	txTotalBytes = txUnderflows = txTimeouts = 0;
+	if (!config.txFilePath.empty())
+	{
+		txFile.open(config.txFilePath.c_str(), ios::binary | ios::app);
+	}
+	isAsyncRunning = true;
+	asyncThread = thread(&VirtualSABR::AsyncLoop, this);
+}
+
+void VirtualSABR::Close()
+{
+	StopAsync();
+	PrintStatistics();
+	if (txFile.is_open())
+	{
+		txFile.close();
+	}
+	isOpen = false;
+}
+
+void VirtualSABR::SetGPIO(DWORD mask, DWORD levels)
+{
+	gpioLevels = (gpioLevels & ~mask) | (levels & mask);
+}
+
+void VirtualSABR::SetPipeTimeout(UCHAR pipe, DWORD timeoutMs)
+{
+	lock_guard<mutex> lock(stateMutex);
+	pipeTimeouts[pipe] = timeoutMs;
+}
+
+DWORD VirtualSABR::GetPipeTimeout(UCHAR pipe)
+{
+	lock_guard<mutex> lock(stateMutex);
+	map<UCHAR, DWORD>::iterator found = pipeTimeouts.find(pipe);
+	return found == pipeTimeouts.end() ? DEFAULT_PIPE_TIMEOUT_MS : found->second;
+}
+
+double VirtualSABR::GetByteRate(uint64_t rate, uint32_t channels)
+{
+	return (double)rate * channels * 4.0;
+}
+
+void VirtualSABR::Delay()
+{
+	if (config.latencyUs > 0)
+	{
+		this_thread::sleep_for(chrono::microseconds(config.latencyUs));
+	}
+}
+
+vector<uint8_t> VirtualSABR::ProcessFrame(const uint8_t* frame)
+{
+	uint32_t header = ReadWord(frame);
+	uint64_t value = ((uint64_t)ReadWord(frame + 4) << 32) | ReadWord(frame + 8);
+	uint32_t footer = ReadWord(frame + 12);
+	bool isSetCommand = (header & SET_CMD_BIT) == SET_CMD_BIT;
+	CommandType commandType = (CommandType)((header & CMD_ID_FIELD_MASK) >> 4);
+	uint32_t channel = header & CMD_CHANNEL_FIELD_MASK;
+	bool isAcknowledged = (header & PACKET_DELIMITER_MASK) == PACKET_PREFIX && (footer & PACKET_DELIMITER_MASK) == PACKET_SUFFIX && channel < NUM_CHANNELS;
+
+	if (isAcknowledged)
+	{
+		lock_guard<mutex> lock(stateMutex);
+		switch (commandType)
+		{
+		case CommandType::InitDevice:
+		case CommandType::Nop:
+		case CommandType::DebugA:
+		case CommandType::DebugB:
+			break;
+		case CommandType::Reset:
+			ResetRegisters();
+			break;
+		case CommandType::CaptureEnable:
+			if (isSetCommand)
+			{
+				isCaptureEnabled = value != 0;
+				captureGeneration++;
+			}
+			value = isCaptureEnabled;
+			break;
+		case CommandType::TransmitEnable:
+			if (isSetCommand)
+			{
+				isTransmitEnabled = value != 0;
+				transmitGeneration++;
+			}
+			value = isTransmitEnabled;
+			break;
+		case CommandType::SampleRate:
+			if (isSetCommand)
+			{
+				if (value == 0)
+				{
+					isAcknowledged = false;
+					break;
+				}
+				sampleRate = value;
+				captureGeneration++;
+				transmitGeneration++;
+			}
+			value = sampleRate;
+			break;
+		case CommandType::MultiplexMode:
+			if (isSetCommand)
+			{
+				registers[RegisterKey(commandType, 0)] = value;
+				rxChannelCount = (uint32_t)RadioDevice::GetReceiveChannelCount((IQChannelConfig)(value >> 32));
+				txChannelCount = (uint32_t)max(1, RadioDevice::GetTransmitChannelCount((IQChannelConfig)(value >> 32)));
+				captureGeneration++;
+				transmitGeneration++;
+			}
+			value = registers[RegisterKey(commandType, 0)];
+			break;
+		case CommandType::LOFrequency:
+		case CommandType::Gain:
+		case CommandType::GainMode:
+		case CommandType::Bandwidth:
+		case CommandType::IRFilterCfg:
+		case CommandType::IRFilterUse:
+			if (isSetCommand)
+			{
+				registers[RegisterKey(commandType, channel)] = value;
+			}
+			value = registers[RegisterKey(commandType, channel)];
+			break;
+		case CommandType::DeviceStatus:
+			isAcknowledged = !isSetCommand;
+			value = isCaptureEnabled ? DeviceStatus::Receiving : isTransmitEnabled ? DeviceStatus::Transmitting : DeviceStatus::IdleInitialized;
+			break;
+		case CommandType::Temperature:
+			isAcknowledged = !isSetCommand;
+			value = TEMPERATURE_MDEG;
+			break;
+		case CommandType::ERMVersion:
+			isAcknowledged = !isSetCommand;
+			value = ERM_VERSION_WORD;
+			break;
+		default:
+			isAcknowledged = false;
+			break;
+		}
+	}
+
+	vector<uint8_t> response(FRAME_LENGTH_BYTES);
+	header = (header & ~(PACKET_DELIMITER_MASK | DEV_ACK_RESP)) | PACKET_PREFIX;
+	if (isAcknowledged)
+	{
+		header |= DEV_ACK_RESP;
+	}
+	WriteWord(&response[0], header);
+	WriteWord(&response[4], (uint32_t)(value >> 32));
+	WriteWord(&response[8], (uint32_t)value);
+	WriteWord(&response[12], PACKET_SUFFIX);
+	return response;
+}
+
+FT_STATUS VirtualSABR::CommandWrite(const uint8_t* buffer, ULONG length, PULONG bytesTransferred)
+{
+	Delay();
+	if (length % FRAME_LENGTH_BYTES != 0)
+	{
+		*bytesTransferred = 0;
+		return FT_INVALID_PARAMETER;
+	}
+	for (ULONG offset = 0; offset < length; offset += FRAME_LENGTH_BYTES)
+	{
+		vector<uint8_t> response = ProcessFrame(buffer + offset);
+		lock_guard<mutex> lock(commandMutex);
+		pendingResponses.push_back(response);
+	}
+	responseReady.notify_all();
+	*bytesTransferred = length;
+	return FT_OK;
+}
+
+FT_STATUS VirtualSABR::CommandRead(uint8_t* buffer, ULONG length, PULONG bytesTransferred)
+{
+	Delay();
+	*bytesTransferred = 0;
+	unique_lock<mutex> lock(commandMutex);
+	if (!responseReady.wait_for(lock, chrono::milliseconds(GetPipeTimeout(CMD_READ_PIPE)), [this] { return !pendingResponses.empty(); }))
+	{
+		return FT_TIMEOUT;
+	}
+	while (!pendingResponses.empty() && *bytesTransferred + FRAME_LENGTH_BYTES <= length)
+	{
+		memcpy(buffer + *bytesTransferred, &pendingResponses.front()[0], FRAME_LENGTH_BYTES);
+		pendingResponses.pop_front();
+		*bytesTransferred += FRAME_LENGTH_BYTES;
+	}
+	return FT_OK;
+}
+
+void VirtualSABR::BuildRxPattern(uint64_t rate, uint32_t channels)
+{
+	rxPattern.clear();
+	rxPatternIndex = 0;
+	rxPatternRate = rate;
+	rxPatternChannels = channels;
+	if (config.signal == VirtualSignal::File)
+	{
+		ifstream sampleFile(config.filePath.c_str(), ios::binary);
+		rxPattern.assign(istreambuf_iterator<char>(sampleFile), istreambuf_iterator<char>());
+		rxPattern.resize(rxPattern.size() - rxPattern.size() % 4);
+		if (!rxPattern.empty())
+		{
+			return;
+		}
+		cerr << "Virtual SABR: couldn't read samples from '" << config.filePath << "', using tone" << endl;
+	}
+	else if (config.signal == VirtualSignal::Noise)
+	{
+		normal_distribution<double> noise(0.0, config.amplitude / 3.0);
+		rxPattern.reserve(NOISE_TABLE_SAMPLES * 4);
+		for (uint32_t i = 0; i < NOISE_TABLE_SAMPLES; i++)
+		{
+			WriteSample(rxPattern, noise(readRandom), noise(readRandom));
+		}
+		return;
+	}
+
+	// The tone is snapped to a whole number of cycles per table so the table can simply be repeated. With several channels the samples are
+	// interleaved like the real device does, and each channel gets its own multiple of the tone offset so they can be told apart.
+	rxPattern.reserve(TONE_TABLE_SAMPLES * 4 * channels);
+	for (uint32_t i = 0; i < TONE_TABLE_SAMPLES; i++)
+	{
+		for (uint32_t channel = 0; channel < channels; channel++)
+		{
+			double cycles = round(config.toneOffsetHz * (channel + 1) / (double)rate * TONE_TABLE_SAMPLES);
+			double phase = 2.0 * M_PI * cycles * i / TONE_TABLE_SAMPLES;
+			WriteSample(rxPattern, config.amplitude * cos(phase), config.amplitude * sin(phase));
+		}
+	}
+}
+
+FT_STATUS VirtualSABR::IQRead(uint8_t* buffer, ULONG length, PULONG bytesTransferred, bool isQueued)
+{
+	lock_guard<mutex> lock(readMutex);
+	if (!isQueued)
+	{
+		Delay();
+	}
+	*bytesTransferred = 0;
+	DWORD timeoutMs = GetPipeTimeout(IQ_READ_PIPE);
+	bool captureEnabled;
+	uint64_t rate;
+	uint32_t channels;
+	uint64_t generation;
+	{
+		lock_guard<mutex> stateLock(stateMutex);
+		captureEnabled = isCaptureEnabled;
+		rate = sampleRate;
+		channels = rxChannelCount;
+		generation = captureGeneration;
+	}
+	uniform_real_distribution<double> chance(0.0, 1.0);
+	if (!captureEnabled || (config.timeoutProbability > 0 && chance(readRandom) < config.timeoutProbability))
+	{
+		this_thread::sleep_for(chrono::milliseconds(timeoutMs));
+		rxTimeouts++;
+		return FT_TIMEOUT;
+	}
+	if (generation != rxGeneration)
+	{
+		// Capture (re)started or the stream layout changed: restart the sample clock
+		rxGeneration = generation;
+		rxStart = Clock::now();
+		rxBytesProduced = 0;
+		if (rate != rxPatternRate || channels != rxPatternChannels)
+		{
+			BuildRxPattern(rate, channels);
+		}
+	}
+
+	ULONG numBytes = length - length % 4;
+	if (numBytes > 4 && config.shortReadProbability > 0 && chance(readRandom) < config.shortReadProbability)
+	{
+		numBytes = 4 * (1 + readRandom() % (numBytes / 4 - 1));
+		rxShortReads++;
+	}
+
+	FT_STATUS status = FT_OK;
+	if (config.realTime)
+	{
+		double byteRate = GetByteRate(rate, channels);
+		Clock::time_point now = Clock::now();
+		uint64_t producedByNow = (uint64_t)(chrono::duration<double>(now - rxStart).count() * byteRate) & ~3ULL;
+		uint64_t backlog = producedByNow - min(producedByNow, rxBytesProduced);
+		if (config.fifoBytes > 0 && backlog > config.fifoBytes)
+		{
+			// Host fell behind; the device FIFO has overflowed and the oldest samples are gone
+			uint64_t dropped = (backlog - config.fifoBytes) & ~3ULL;
+			rxBytesProduced += dropped;
+			rxPatternIndex = (size_t)((rxPatternIndex + dropped) % rxPattern.size());
+			rxOverflowEvents++;
+			rxDroppedBytes += dropped;
+		}
+		Clock::time_point ready = rxStart + chrono::duration_cast<Clock::duration>(chrono::duration<double>((rxBytesProduced + numBytes) / byteRate));
+		Clock::time_point deadline = now + chrono::milliseconds(timeoutMs);
+		if (ready > deadline)
+		{
+			this_thread::sleep_until(deadline);
+			uint64_t producedByDeadline = (uint64_t)(chrono::duration<double>(deadline - rxStart).count() * byteRate) & ~3ULL;
+			numBytes = (ULONG)min((uint64_t)numBytes, producedByDeadline - min(producedByDeadline, rxBytesProduced));
+			status = FT_TIMEOUT;
+			rxTimeouts++;
+		}
+		else
+		{
+			this_thread::sleep_until(ready);
+		}
+	}
+
+	ULONG copied = 0;
+	while (copied < numBytes)
+	{
+		size_t chunk = min((size_t)(numBytes - copied), rxPattern.size() - rxPatternIndex);
+		memcpy(buffer + copied, &rxPattern[rxPatternIndex], chunk);
+		copied += (ULONG)chunk;
+		rxPatternIndex = (rxPatternIndex + chunk) % rxPattern.size();
+	}
+	rxBytesProduced += numBytes;
+	rxTotalBytes += numBytes;
+	*bytesTransferred = numBytes;
+	return status;
+}
+
+FT_STATUS VirtualSABR::IQWrite(const uint8_t* buffer, ULONG length, PULONG bytesTransferred, bool isQueued)
+{
+	lock_guard<mutex> lock(writeMutex);
+	if (!isQueued)
+	{
+		Delay();
+	}
+	*bytesTransferred = 0;
+	DWORD timeoutMs = GetPipeTimeout(IQ_WRITE_PIPE);
+	bool transmitEnabled;
+	uint64_t rate;
+	uint32_t channels;
+	uint64_t generation;
+	{
+		lock_guard<mutex> stateLock(stateMutex);
+		transmitEnabled = isTransmitEnabled;
+		rate = sampleRate;
+		channels = txChannelCount;
+		generation = transmitGeneration;
+	}
+	uniform_real_distribution<double> chance(0.0, 1.0);
+	if (!transmitEnabled || (config.timeoutProbability > 0 && chance(writeRandom) < config.timeoutProbability))
+	{
+		this_thread::sleep_for(chrono::milliseconds(timeoutMs));
+		txTimeouts++;
+		return FT_TIMEOUT;
+	}
+	Clock::time_point now = Clock::now();
+	if (generation != txGeneration)
+	{
+		txGeneration = generation;
+		txStart = now;
+		txBytesAccepted = 0;
+	}
+
+	ULONG numBytes = length;
+	FT_STATUS status = FT_OK;
+	if (config.realTime && config.fifoBytes > 0)
+	{
+		double byteRate = GetByteRate(rate, channels);
+		uint64_t consumedByNow = (uint64_t)(chrono::duration<double>(now - txStart).count() * byteRate);
+		if (txBytesAccepted > 0 && consumedByNow > txBytesAccepted)
+		{
+			// The DAC ran dry before this write showed up
+			txUnderflows++;
+			txStart = now;
+			txBytesAccepted = 0;
+		}
+		// Back pressure: wait until the device has room for the whole transfer
+		uint64_t needConsumed = txBytesAccepted + numBytes > config.fifoBytes ? txBytesAccepted + numBytes - config.fifoBytes : 0;
+		Clock::time_point ready = txStart + chrono::duration_cast<Clock::duration>(chrono::duration<double>(needConsumed / byteRate));
+		Clock::time_point deadline = now + chrono::milliseconds(timeoutMs);
+		if (ready > deadline)
+		{
+			this_thread::sleep_until(deadline);
+			uint64_t consumedByDeadline = (uint64_t)(chrono::duration<double>(deadline - txStart).count() * byteRate);
+			uint64_t room = consumedByDeadline + config.fifoBytes - min(consumedByDeadline + config.fifoBytes, txBytesAccepted);
+			numBytes = (ULONG)min((uint64_t)numBytes, room);
+			status = FT_TIMEOUT;
+			txTimeouts++;
+		}
+		else
+		{
+			this_thread::sleep_until(ready);
+		}
+	}
+
+	if (txFile.is_open())
+	{
+		txFile.write((const char*)buffer, numBytes);
+	}
+	txBytesAccepted += numBytes;
+	txTotalBytes += numBytes;
+	*bytesTransferred = numBytes;
+	return status;
+}
+
+void VirtualSABR::PrintStatistics()
+{
+	cout << "Virtual SABR " << serialNumber << ": RX " << rxTotalBytes << " bytes, " << rxOverflowEvents << " overflows (" << rxDroppedBytes << " bytes dropped), "
+		<< rxShortReads << " short reads, " << rxTimeouts << " timeouts; TX " << txTotalBytes << " bytes, " << txUnderflows << " underflows, "
+		<< txTimeouts << " timeouts" << endl;
+}
+
+FT_STATUS VirtualSABR::Transfer(UCHAR pipe, PUCHAR buffer, ULONG length, PULONG bytesTransferred, bool isQueued)
+{
+	switch (pipe)
+	{
+	case CMD_WRITE_PIPE:
+		return CommandWrite(buffer, length, bytesTransferred);
+	case CMD_READ_PIPE:
+		return CommandRead(buffer, length, bytesTransferred);
+	case IQ_WRITE_PIPE:
+		return IQWrite(buffer, length, bytesTransferred, isQueued);
+	case IQ_READ_PIPE:
+		return IQRead(buffer, length, bytesTransferred, isQueued);
+	default:
+		return FT_INVALID_PARAMETER;
+	}
+}
+
+void VirtualSABR::AsyncLoop()
+{
+	unique_lock<mutex> lock(asyncMutex);
+	bool isQueued = false;
+	while (isAsyncRunning)
+	{
+		if (asyncQueue.empty())
+		{
+			// The bus goes idle; the next request pays the full latency again
+			isQueued = false;
+			asyncQueued.wait(lock);
+			continue;
+		}
+		LPOVERLAPPED overlapped = asyncQueue.front();
+		asyncQueue.pop_front();
+		AsyncTransfer transfer = asyncTransfers[overlapped];
+		lock.unlock();
+		ULONG bytesTransferred = 0;
+		FT_STATUS status = Transfer(transfer.pipe, transfer.buffer, transfer.length, &bytesTransferred, isQueued);
+		lock.lock();
+		map<LPOVERLAPPED, AsyncTransfer>::iterator found = asyncTransfers.find(overlapped);
+		if (found != asyncTransfers.end())
+		{
+			found->second.bytesTransferred = bytesTransferred;
+			found->second.status = status;
+			found->second.isPending = false;
+		}
+		asyncCompleted.notify_all();
+		isQueued = true;
+	}
+}
+
+void VirtualSABR::StopAsync()
+{
+	{
+		lock_guard<mutex> lock(asyncMutex);
+		isAsyncRunning = false;
+		for (size_t i = 0; i < asyncQueue.size(); i++)
+		{
+			asyncTransfers[asyncQueue[i]].status = FT_OPERATION_ABORTED;
+			asyncTransfers[asyncQueue[i]].isPending = false;
+		}
+		asyncQueue.clear();
+		asyncQueued.notify_all();
+		asyncCompleted.notify_all();
+	}
+	if (asyncThread.joinable())
+	{
+		asyncThread.join();
+	}
+}
+
+FT_STATUS VirtualSABR::InitializeOverlapped(LPOVERLAPPED overlapped)
+{
+	lock_guard<mutex> lock(asyncMutex);
+	AsyncTransfer& transfer = asyncTransfers[overlapped];
+	transfer.isPending = false;
+	transfer.status = FT_OK;
+	transfer.bytesTransferred = 0;
+	return FT_OK;
+}
+
+FT_STATUS VirtualSABR::ReleaseOverlapped(LPOVERLAPPED overlapped)
+{
+	lock_guard<mutex> lock(asyncMutex);
+	map<LPOVERLAPPED, AsyncTransfer>::iterator found = asyncTransfers.find(overlapped);
+	if (found == asyncTransfers.end() || found->second.isPending)
+	{
+		return FT_INVALID_PARAMETER;
+	}
+	asyncTransfers.erase(found);
+	return FT_OK;
+}
+
+FT_STATUS VirtualSABR::SubmitOverlapped(LPOVERLAPPED overlapped, UCHAR pipe, PUCHAR buffer, ULONG length)
+{
+	lock_guard<mutex> lock(asyncMutex);
+	map<LPOVERLAPPED, AsyncTransfer>::iterator found = asyncTransfers.find(overlapped);
+	if (found == asyncTransfers.end() || found->second.isPending || !isAsyncRunning)
+	{
+		return FT_INVALID_PARAMETER;
+	}
+	found->second.pipe = pipe;
+	found->second.buffer = buffer;
+	found->second.length = length;
+	found->second.bytesTransferred = 0;
+	found->second.status = FT_IO_PENDING;
+	found->second.isPending = true;
+	asyncQueue.push_back(overlapped);
+	asyncQueued.notify_one();
+	return FT_IO_PENDING;
+}
+
+FT_STATUS VirtualSABR::GetOverlappedResult(LPOVERLAPPED overlapped, PULONG bytesTransferred, bool wait)
+{
+	unique_lock<mutex> lock(asyncMutex);
+	map<LPOVERLAPPED, AsyncTransfer>::iterator found = asyncTransfers.find(overlapped);
+	if (found == asyncTransfers.end())
+	{
+		return FT_INVALID_PARAMETER;
+	}
+	if (found->second.isPending && !wait)
+	{
+		return FT_IO_INCOMPLETE;
+	}
+	while (found->second.isPending)
+	{
+		asyncCompleted.wait(lock);
+	}
+	*bytesTransferred = found->second.bytesTransferred;
+	return found->second.status;
+}
+
+FT_STATUS VirtualSABR::AbortPipe(UCHAR pipe)
+{
+	// Requests that haven't started yet are cancelled; the one in progress runs to completion (or its timeout)
+	lock_guard<mutex> lock(asyncMutex);
+	for (deque<LPOVERLAPPED>::iterator it = asyncQueue.begin(); it != asyncQueue.end();)
+	{
+		AsyncTransfer& transfer = asyncTransfers[*it];
+		if (transfer.pipe == pipe)
+		{
+			transfer.status = FT_OPERATION_ABORTED;
+			transfer.isPending = false;
+			it = asyncQueue.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	asyncCompleted.notify_all();
+	return FT_OK;
+}
+
+FT_STATUS VirtualSABR::FlushPipe(UCHAR pipe)
+{
+	// Only the command pipe buffers anything; IQ data is generated on demand
+	if (pipe == CMD_READ_PIPE)
+	{
+		lock_guard<mutex> lock(commandMutex);
+		pendingResponses.clear();
+	}
+	return FT_OK;
+}
+
+FT_STATUS VirtualSABR::GetWriteQueueStatus(UCHAR fifoId, LPDWORD amountInQueue)
+{
+	if (amountInQueue == NULL || fifoId > 3)
+	{
+		return FT_INVALID_PARAMETER;
+	}
+	// Write pipes 0x02-0x05 map to FIFOs 0-3. Only queued requests count, like data still sitting in the driver.
+	UCHAR pipe = fifoId + 2;
+	DWORD amount = 0;
+	lock_guard<mutex> lock(asyncMutex);
+	for (deque<LPOVERLAPPED>::const_iterator it = asyncQueue.begin(); it != asyncQueue.end(); ++it)
+	{
+		const AsyncTransfer& transfer = asyncTransfers[*it];
+		if (transfer.pipe == pipe)
+		{
+			amount += transfer.length;
+		}
+	}
+	*amountInQueue = amount;
+	return FT_OK;
+}
+
+VirtualDeviceTransport::VirtualDeviceTransport(const VirtualDeviceConfig& config)
+{
+	for (uint32_t i = 0; i < config.numDevices; i++)
+	{
+		char serialNumber[16];
+		snprintf(serialNumber, sizeof(serialNumber), "SM3000V%04u", i);
+		devices.push_back(unique_ptr<VirtualSABR>(new VirtualSABR(config, serialNumber)));
+	}
+}
+
+VirtualSABR* VirtualDeviceTransport::FromHandle(FT_HANDLE handle)
+{
+	for (size_t i = 0; i < devices.size(); i++)
+	{
+		if (devices[i].get() == handle && devices[i]->IsOpen())
+		{
+			return devices[i].get();
+		}
+	}
+	return NULL;
+}
+
+FT_STATUS VirtualDeviceTransport::CreateDeviceInfoList(LPDWORD numDevices)
+{
+	*numDevices = (DWORD)devices.size();
+	return FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::GetDeviceInfoDetail(DWORD index, LPDWORD flags, LPDWORD type, LPDWORD id, LPDWORD locId, LPVOID serialNumber, LPVOID description, FT_HANDLE* handle)
+{
+	if (index >= devices.size())
+	{
+		return FT_DEVICE_NOT_FOUND;
+	}
+	lock_guard<mutex> lock(devicesMutex);
+	VirtualSABR* device = devices[index].get();
+	if (flags != NULL)
+	{
+		*flags = device->IsOpen() ? 1 : 0;
+	}
+	if (type != NULL)
+	{
+		*type = 0;
+	}
+	if (id != NULL)
+	{
+		*id = (0x0403 << 16) | 0x601F;
+	}
+	if (locId != NULL)
+	{
+		*locId = index;
+	}
+	if (serialNumber != NULL)
+	{
+		// Caller buffers follow the FTDI sizes: 16 bytes of serial, 32 bytes of description
+		strncpy((char*)serialNumber, device->GetSerialNumber().c_str(), 15);
+	}
+	if (description != NULL)
+	{
+		strncpy((char*)description, "SABR Virtual", 31);
+	}
+	if (handle != NULL)
+	{
+		*handle = device->IsOpen() ? (FT_HANDLE)device : NULL;
+	}
+	return FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::Create(PVOID arg, DWORD flags, FT_HANDLE* handle)
+{
+	lock_guard<mutex> lock(devicesMutex);
+	*handle = NULL;
+	for (size_t i = 0; i < devices.size(); i++)
+	{
+		bool isMatch = false;
+		if (flags == FT_OPEN_BY_SERIAL_NUMBER)
+		{
+			isMatch = devices[i]->GetSerialNumber() == (const char*)arg;
+		}
+		else if (flags == FT_OPEN_BY_INDEX)
+		{
+			isMatch = (uintptr_t)arg == i;
+		}
+		else
+		{
+			return FT_NOT_SUPPORTED;
+		}
+		if (isMatch)
+		{
+			if (devices[i]->IsOpen())
+			{
+				return FT_BUSY;
+			}
+			devices[i]->Open();
+			*handle = (FT_HANDLE)devices[i].get();
+			return FT_OK;
+		}
+	}
+	return FT_DEVICE_NOT_FOUND;
+}
+
+FT_STATUS VirtualDeviceTransport::Close(FT_HANDLE handle)
+{
+	lock_guard<mutex> lock(devicesMutex);
+	VirtualSABR* device = FromHandle(handle);
+	if (device == NULL)
+	{
+		return FT_INVALID_HANDLE;
+	}
+	device->Close();
+	return FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::GetDeviceDescriptor(FT_HANDLE handle, PFT_DEVICE_DESCRIPTOR descriptor)
+{
+	if (FromHandle(handle) == NULL)
+	{
+		return FT_INVALID_HANDLE;
+	}
+	memset(descriptor, 0, sizeof(FT_DEVICE_DESCRIPTOR));
+	descriptor->bLength = sizeof(FT_DEVICE_DESCRIPTOR);
+	descriptor->bDescriptorType = FT_DEVICE_DESCRIPTOR_TYPE;
+	descriptor->bcdUSB = 0x0310;
+	descriptor->idVendor = CONFIGURATION_DEFAULT_VENDORID;
+	descriptor->idProduct = CONFIGURATION_DEFAULT_PRODUCTID_601;
+	descriptor->bNumConfigurations = 1;
+	return FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::GetStringDescriptor(FT_HANDLE handle, UCHAR stringIndex, PFT_STRING_DESCRIPTOR descriptor)
+{
+	if (FromHandle(handle) == NULL)
+	{
+		return FT_INVALID_HANDLE;
+	}
+	memset(descriptor, 0, sizeof(FT_STRING_DESCRIPTOR));
+	descriptor->bLength = 2;
+	descriptor->bDescriptorType = FT_STRING_DESCRIPTOR_TYPE;
+	return FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::GetConfigurationDescriptor(FT_HANDLE handle, PFT_CONFIGURATION_DESCRIPTOR descriptor)
+{
+	if (FromHandle(handle) == NULL)
+	{
+		return FT_INVALID_HANDLE;
+	}
+	memset(descriptor, 0, sizeof(FT_CONFIGURATION_DESCRIPTOR));
+	descriptor->bLength = sizeof(FT_CONFIGURATION_DESCRIPTOR);
+	descriptor->bDescriptorType = FT_CONFIGURATION_DESCRIPTOR_TYPE;
+	descriptor->bNumInterfaces = 2;
+	descriptor->bConfigurationValue = 1;
+	return FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::ReadGPIO(FT_HANDLE handle, DWORD* data)
+{
+	VirtualSABR* device = FromHandle(handle);
+	if (device == NULL)
+	{
+		return FT_INVALID_HANDLE;
+	}
+	*data = device->GetGPIO();
+	return FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::EnableGPIO(FT_HANDLE handle, DWORD mask, DWORD direction)
+{
+	return FromHandle(handle) == NULL ? FT_INVALID_HANDLE : FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::WriteGPIO(FT_HANDLE handle, DWORD mask, DWORD level)
+{
+	VirtualSABR* device = FromHandle(handle);
+	if (device == NULL)
+	{
+		return FT_INVALID_HANDLE;
+	}
+	device->SetGPIO(mask, level);
+	return FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::SetGPIOPull(FT_HANDLE handle, DWORD mask, DWORD pull)
+{
+	return FromHandle(handle) == NULL ? FT_INVALID_HANDLE : FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::CycleDevicePort(FT_HANDLE handle)
+{
+	return FromHandle(handle) == NULL ? FT_INVALID_HANDLE : FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::SetPipeTimeout(FT_HANDLE handle, UCHAR pipe, DWORD timeoutMs)
+{
+	VirtualSABR* device = FromHandle(handle);
+	if (device == NULL)
+	{
+		return FT_INVALID_HANDLE;
+	}
+	device->SetPipeTimeout(pipe, timeoutMs);
+	return FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::WritePipe(FT_HANDLE handle, UCHAR pipe, PUCHAR buffer, ULONG bufferLength, PULONG bytesTransferred, LPOVERLAPPED overlapped)
+{
+	VirtualSABR* device = FromHandle(handle);
+	if (device == NULL)
+	{
+		return FT_INVALID_HANDLE;
+	}
+	if (pipe != CMD_WRITE_PIPE && pipe != IQ_WRITE_PIPE)
+	{
+		return FT_INVALID_PARAMETER;
+	}
+	if (overlapped != NULL)
+	{
+		return device->SubmitOverlapped(overlapped, pipe, buffer, bufferLength);
+	}
+	return device->Transfer(pipe, buffer, bufferLength, bytesTransferred);
+}
+
+FT_STATUS VirtualDeviceTransport::ReadPipe(FT_HANDLE handle, UCHAR pipe, PUCHAR buffer, ULONG bufferLength, PULONG bytesTransferred, LPOVERLAPPED overlapped)
+{
+	VirtualSABR* device = FromHandle(handle);
+	if (device == NULL)
+	{
+		return FT_INVALID_HANDLE;
+	}
+	if (pipe != CMD_READ_PIPE && pipe != IQ_READ_PIPE)
+	{
+		return FT_INVALID_PARAMETER;
+	}
+	if (overlapped != NULL)
+	{
+		return device->SubmitOverlapped(overlapped, pipe, buffer, bufferLength);
+	}
+	return device->Transfer(pipe, buffer, bufferLength, bytesTransferred);
+}
+
+FT_STATUS VirtualDeviceTransport::InitializeOverlapped(FT_HANDLE handle, LPOVERLAPPED overlapped)
+{
+	VirtualSABR* device = FromHandle(handle);
+	return device == NULL ? FT_INVALID_HANDLE : device->InitializeOverlapped(overlapped);
+}
+
+FT_STATUS VirtualDeviceTransport::ReleaseOverlapped(FT_HANDLE handle, LPOVERLAPPED overlapped)
+{
+	VirtualSABR* device = FromHandle(handle);
+	return device == NULL ? FT_INVALID_HANDLE : device->ReleaseOverlapped(overlapped);
+}
+
+FT_STATUS VirtualDeviceTransport::GetOverlappedResult(FT_HANDLE handle, LPOVERLAPPED overlapped, PULONG bytesTransferred, BOOL wait)
+{
+	VirtualSABR* device = FromHandle(handle);
+	return device == NULL ? FT_INVALID_HANDLE : device->GetOverlappedResult(overlapped, bytesTransferred, wait != 0);
+}
+
+FT_STATUS VirtualDeviceTransport::SetStreamPipe(FT_HANDLE handle, BOOL allWritePipes, BOOL allReadPipes, UCHAR pipe, ULONG streamSize)
+{
+	// Transfers are never split on the virtual device, so there is nothing to configure
+	return FromHandle(handle) == NULL ? FT_INVALID_HANDLE : FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::ClearStreamPipe(FT_HANDLE handle, BOOL allWritePipes, BOOL allReadPipes, UCHAR pipe)
+{
+	return FromHandle(handle) == NULL ? FT_INVALID_HANDLE : FT_OK;
+}
+
+FT_STATUS VirtualDeviceTransport::AbortPipe(FT_HANDLE handle, UCHAR pipe)
+{
+	VirtualSABR* device = FromHandle(handle);
+	return device == NULL ? FT_INVALID_HANDLE : device->AbortPipe(pipe);
+}
+
+FT_STATUS VirtualDeviceTransport::FlushPipe(FT_HANDLE handle, UCHAR pipe)
+{
+	VirtualSABR* device = FromHandle(handle);
+	return device == NULL ? FT_INVALID_HANDLE : device->FlushPipe(pipe);
+}
+
+FT_STATUS VirtualDeviceTransport::GetWriteQueueStatus(FT_HANDLE handle, UCHAR fifoId, LPDWORD amountInQueue)
+{
+	VirtualSABR* device = FromHandle(handle);
+	return device == NULL ? FT_INVALID_HANDLE : device->GetWriteQueueStatus(fifoId, amountInQueue);
+}
+
+shared_ptr<DeviceTransport> THR::GetVirtualDeviceTransport(const VirtualDeviceConfig& config)
+{
+	static mutex transportMutex;
+	static weak_ptr<DeviceTransport> sharedTransport;
+	lock_guard<mutex> lock(transportMutex);
+	shared_ptr<DeviceTransport> transport = sharedTransport.lock();
+	if (!transport)
+	{
+		transport = make_shared<VirtualDeviceTransport>(config);
+		sharedTransport = transport;
+	}
+	return transport;
+}
@@ -0,0 +1,235 @@
+#ifndef VIRTUALDEVICE_H
+#define VIRTUALDEVICE_H
+#include "DeviceTransport.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace THR
+{
+	/// <summary>
+	/// Defines what the virtual SABR streams out of the IQ read pipe.
+	/// </summary>
+	enum class VirtualSignal
+	{
+		/// <summary>
+		/// Complex tone at VirtualDeviceConfig::toneOffsetHz from the LO.
+		/// </summary>
+		Tone = 0,
+		/// <summary>
+		/// Complex gaussian noise.
+		/// </summary>
+		Noise,
+		/// <summary>
+		/// Raw big endian sc16 samples (the device wire format) read from VirtualDeviceConfig::filePath and looped.
+		/// </summary>
+		File
+	};
+
+	/// <summary>
+	/// Settings for the virtual SABR. Parsed from the SABR_VIRTUAL_DEVICE environment variable as a comma separated key=value list, for instance
+	/// "signal=tone,tone=250000,latency_us=100,short_read=0.01,timeout=0.001". Unknown keys are reported and ignored.
+	/// Keys: signal (tone/noise/file), tone (Hz), amplitude (counts), file (path, implies signal=file), tx_file (path TX bytes get appended to),
+	/// latency_us (added to every pipe transfer), short_read (probability a read returns fewer bytes than asked), timeout (probability a transfer times out),
+	/// fifo (device side buffering in bytes, RX overflows and TX back pressure happen past this), devices (number of radios to enumerate),
+	/// realtime (0 to stream as fast as the host can go instead of at the sample rate).
+	/// </summary>
+	struct VirtualDeviceConfig
+	{
+		VirtualSignal signal;
+		double toneOffsetHz;
+		int16_t amplitude;
+		std::string filePath;
+		std::string txFilePath;
+		uint32_t latencyUs;
+		double shortReadProbability;
+		double timeoutProbability;
+		uint32_t fifoBytes;
+		uint32_t numDevices;
+		bool realTime;
+
+		VirtualDeviceConfig();
+
+		static VirtualDeviceConfig FromString(const std::string& args);
+	};
+
+	/// <summary>
+	/// One simulated SABR. Speaks the 16 byte DeviceCommand protocol on the command pipes and streams paced sc16 on the IQ pipes.
+	/// </summary>
+	class VirtualSABR
+	{
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		const VirtualDeviceConfig config;
+		const std::string serialNumber;
+		std::atomic<bool> isOpen;
+		DWORD gpioLevels = 0;
+		std::map<UCHAR, DWORD> pipeTimeouts;
+
+		// Register file, keyed by command ID and channel (header bits 14:0)
+		std::mutex stateMutex;
+		std::map<uint32_t, uint64_t> registers;
+		bool isCaptureEnabled = false;
+		bool isTransmitEnabled = false;
+		uint64_t sampleRate = 0;
+		uint32_t rxChannelCount = 1;
+		uint32_t txChannelCount = 1;
+		// Bumped whenever the stream clock needs restarting (enable, rate or channel layout change)
+		uint64_t captureGeneration = 0;
+		uint64_t transmitGeneration = 0;
+
+		// Command pipe
+		std::mutex commandMutex;
+		std::condition_variable responseReady;
+		std::deque<std::vector<uint8_t>> pendingResponses;
+
+		// IQ read pipe
+		std::mutex readMutex;
+		std::mt19937 readRandom;
+		std::vector<uint8_t> rxPattern;
+		size_t rxPatternIndex = 0;
+		uint64_t rxPatternRate = 0;
+		uint32_t rxPatternChannels = 1;
+		uint64_t rxGeneration = 0;
+		Clock::time_point rxStart;
+		uint64_t rxBytesProduced = 0;
+		uint64_t rxTotalBytes = 0;
+		uint64_t rxOverflowEvents = 0;
+		uint64_t rxDroppedBytes = 0;
+		uint64_t rxTimeouts = 0;
+		uint64_t rxShortReads = 0;
+
+		// IQ write pipe
+		std::mutex writeMutex;
+		std::mt19937 writeRandom;
+		uint64_t txGeneration = 0;
+		Clock::time_point txStart;
+		uint64_t txBytesAccepted = 0;
+		uint64_t txTotalBytes = 0;
+		uint64_t txUnderflows = 0;
+		uint64_t txTimeouts = 0;
+		std::ofstream txFile;
+
+		// Overlapped transfers, carried out one at a time in submission order like the driver's request queue
+		struct AsyncTransfer
+		{
+			UCHAR pipe;
+			PUCHAR buffer;
+			ULONG length;
+			ULONG bytesTransferred;
+			FT_STATUS status;
+			bool isPending;
+		};
+		std::mutex asyncMutex;
+		std::condition_variable asyncQueued;
+		std::condition_variable asyncCompleted;
+		std::map<LPOVERLAPPED, AsyncTransfer> asyncTransfers;
+		std::deque<LPOVERLAPPED> asyncQueue;
+		std::thread asyncThread;
+		bool isAsyncRunning = false;
+
+		void AsyncLoop();
+		void StopAsync();
+		void ResetRegisters();
+		std::vector<uint8_t> ProcessFrame(const uint8_t* frame);
+		void BuildRxPattern(uint64_t rate, uint32_t channels);
+		DWORD GetPipeTimeout(UCHAR pipe);
+		double GetByteRate(uint64_t rate, uint32_t channels);
+		void Delay();
+
+	public:
+		VirtualSABR(const VirtualDeviceConfig& config, const std::string& serialNumber);
+		~VirtualSABR();
+
+		const std::string& GetSerialNumber() const { return serialNumber; }
+		bool IsOpen() const { return isOpen; }
+		void Open();
+		void Close();
+
+		DWORD GetGPIO() const { return gpioLevels; }
+		void SetGPIO(DWORD mask, DWORD levels);
+		void SetPipeTimeout(UCHAR pipe, DWORD timeoutMs);
+
+		FT_STATUS CommandWrite(const uint8_t* buffer, ULONG length, PULONG bytesTransferred);
+		FT_STATUS CommandRead(uint8_t* buffer, ULONG length, PULONG bytesTransferred);
+		FT_STATUS IQRead(uint8_t* buffer, ULONG length, PULONG bytesTransferred, bool isQueued = false);
+		FT_STATUS IQWrite(const uint8_t* buffer, ULONG length, PULONG bytesTransferred, bool isQueued = false);
+
+		/// <summary>
+		/// Carry out a transfer on any of the four pipes.
+		/// </summary>
+		/// <param name="isQueued">true if the request was already queued when the previous one completed, in which case the configured latency is hidden.</param>
+		FT_STATUS Transfer(UCHAR pipe, PUCHAR buffer, ULONG length, PULONG bytesTransferred, bool isQueued = false);
+
+		FT_STATUS InitializeOverlapped(LPOVERLAPPED overlapped);
+		FT_STATUS ReleaseOverlapped(LPOVERLAPPED overlapped);
+		FT_STATUS SubmitOverlapped(LPOVERLAPPED overlapped, UCHAR pipe, PUCHAR buffer, ULONG length);
+		FT_STATUS GetOverlappedResult(LPOVERLAPPED overlapped, PULONG bytesTransferred, bool wait);
+		FT_STATUS AbortPipe(UCHAR pipe);
+		FT_STATUS FlushPipe(UCHAR pipe);
+		FT_STATUS GetWriteQueueStatus(UCHAR fifoId, LPDWORD amountInQueue);
+
+		/// <summary>
+		/// Print the stream statistics (bytes moved, overflows, underflows, injected faults) gathered since the device was opened.
+		/// </summary>
+		void PrintStatistics();
+	};
+
+	/// <summary>
+	/// DeviceTransport backed by VirtualSABR instances instead of the FTDI driver. FT_HANDLEs handed out are the VirtualSABR pointers.
+	/// </summary>
+	class VirtualDeviceTransport : public DeviceTransport
+	{
+	private:
+		std::mutex devicesMutex;
+		std::vector<std::unique_ptr<VirtualSABR>> devices;
+
+		VirtualSABR* FromHandle(FT_HANDLE handle);
+
+	public:
+		explicit VirtualDeviceTransport(const VirtualDeviceConfig& config);
+
+		FT_STATUS CreateDeviceInfoList(LPDWORD numDevices);
+		FT_STATUS GetDeviceInfoDetail(DWORD index, LPDWORD flags, LPDWORD type, LPDWORD id, LPDWORD locId, LPVOID serialNumber, LPVOID description, FT_HANDLE* handle);
+		FT_STATUS Create(PVOID arg, DWORD flags, FT_HANDLE* handle);
+		FT_STATUS Close(FT_HANDLE handle);
+		FT_STATUS GetDeviceDescriptor(FT_HANDLE handle, PFT_DEVICE_DESCRIPTOR descriptor);
+		FT_STATUS GetStringDescriptor(FT_HANDLE handle, UCHAR stringIndex, PFT_STRING_DESCRIPTOR descriptor);
+		FT_STATUS GetConfigurationDescriptor(FT_HANDLE handle, PFT_CONFIGURATION_DESCRIPTOR descriptor);
+		FT_STATUS ReadGPIO(FT_HANDLE handle, DWORD* data);
+		FT_STATUS EnableGPIO(FT_HANDLE handle, DWORD mask, DWORD direction);
+		FT_STATUS WriteGPIO(FT_HANDLE handle, DWORD mask, DWORD level);
+		FT_STATUS SetGPIOPull(FT_HANDLE handle, DWORD mask, DWORD pull);
+		FT_STATUS CycleDevicePort(FT_HANDLE handle);
+		FT_STATUS SetPipeTimeout(FT_HANDLE handle, UCHAR pipe, DWORD timeoutMs);
+		FT_STATUS WritePipe(FT_HANDLE handle, UCHAR pipe, PUCHAR buffer, ULONG bufferLength, PULONG bytesTransferred, LPOVERLAPPED overlapped);
+		FT_STATUS ReadPipe(FT_HANDLE handle, UCHAR pipe, PUCHAR buffer, ULONG bufferLength, PULONG bytesTransferred, LPOVERLAPPED overlapped);
+		FT_STATUS InitializeOverlapped(FT_HANDLE handle, LPOVERLAPPED overlapped);
+		FT_STATUS ReleaseOverlapped(FT_HANDLE handle, LPOVERLAPPED overlapped);
+		FT_STATUS GetOverlappedResult(FT_HANDLE handle, LPOVERLAPPED overlapped, PULONG bytesTransferred, BOOL wait);
+		FT_STATUS SetStreamPipe(FT_HANDLE handle, BOOL allWritePipes, BOOL allReadPipes, UCHAR pipe, ULONG streamSize);
+		FT_STATUS ClearStreamPipe(FT_HANDLE handle, BOOL allWritePipes, BOOL allReadPipes, UCHAR pipe);
+		FT_STATUS AbortPipe(FT_HANDLE handle, UCHAR pipe);
+		FT_STATUS FlushPipe(FT_HANDLE handle, UCHAR pipe);
+		FT_STATUS GetWriteQueueStatus(FT_HANDLE handle, UCHAR fifoId, LPDWORD amountInQueue);
+		bool IsVirtual() const { return true; }
+	};
+
+	/// <summary>
+	/// Get the process wide virtual transport. All RadioDevices share it so the virtual radios behave like real hardware (one open handle per device).
+	/// The config is only applied when the transport is first created.
+	/// </summary>
+	std::shared_ptr<DeviceTransport> GetVirtualDeviceTransport(const VirtualDeviceConfig& config);
+}
+
+#endif
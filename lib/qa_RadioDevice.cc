@@ -0,0 +1,388 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 TapHere! Technology.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+// RadioDevice against the virtual SABR (SABR_VIRTUAL_DEVICE), so these run without hardware. The virtual transport is shared process wide and
+// only takes its config when first created, so every test closes its device before the next one sets the variable.
+
+#include "RadioDevice.h"
+#include "SpecsEnums.h"
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace THR;
+
+namespace
+{
+	const int RX1 = (int)RadioChannel::One;
+	const int TX1 = (int)RadioChannel::Two;
+	const uint64_t SAMPLE_RATE = 2000000;
+	// Tone the virtual SABR streams by default, relative to the LO
+	const double TONE_OFFSET_HZ = 100000.0;
+
+	void UseVirtualDevice(const char* args)
+	{
+		setenv(VIRTUAL_DEVICE_ENV, args, 1);
+	}
+
+	complex<double> ReadSample(const uint8_t* bytes)
+	{
+		// The device wire format is big endian sc16
+		int16_t i = (int16_t)((bytes[0] << 8) | bytes[1]);
+		int16_t q = (int16_t)((bytes[2] << 8) | bytes[3]);
+		return complex<double>(i, q);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(command_round_trip)
+{
+	UseVirtualDevice("latency_us=100");
+	RadioDevice device;
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.Setup()));
+
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.SetSampleRate(RX1, SAMPLE_RATE)));
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.SetLOFrequency(RX1, 915000000)));
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.SetGain(RX1, 20)));
+	// Make the gets go to the device rather than the settings cache
+	device.InvalidateSettingsCache();
+	uint64_t sampleRate = 0;
+	uint64_t frequency = 0;
+	int gain = 0;
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.GetSampleRate(RX1, sampleRate)));
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.GetLOFrequency(RX1, frequency)));
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.GetGain(RX1, gain)));
+	BOOST_CHECK_EQUAL(sampleRate, SAMPLE_RATE);
+	BOOST_CHECK_EQUAL(frequency, 915000000u);
+	BOOST_CHECK_EQUAL(gain, 20);
+
+	// A get, set and get of the same setting in one batch each get their own response, in order
+	vector<CommandRequest> batch;
+	batch.push_back(CommandRequest(CommandType::Gain, RX1, false));
+	batch.push_back(CommandRequest(CommandType::Gain, RX1, true, CommandPayloadValue((uint64_t)30)));
+	batch.push_back(CommandRequest(CommandType::Gain, RX1, false));
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.ProcessCommandBatch(batch)));
+	BOOST_CHECK_EQUAL(batch[0].responsePayload.GetAsInt32(), 20);
+	BOOST_CHECK_EQUAL(batch[1].responsePayload.GetAsInt32(), 30);
+	BOOST_CHECK_EQUAL(batch[2].responsePayload.GetAsInt32(), 30);
+
+	// Async sets complete through the handlers with what the device confirmed
+	mutex completionMutex;
+	vector<CommandCompletion> completions;
+	uint32_t handlerId = device.AddCommandCompletionHandler([&](const CommandCompletion& completion)
+	{
+		lock_guard<mutex> lock(completionMutex);
+		completions.push_back(completion);
+	});
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.SetLOFrequencyAsync(TX1, 2400000000ULL).get()));
+	device.RemoveCommandCompletionHandler(handlerId);
+	lock_guard<mutex> lock(completionMutex);
+	BOOST_REQUIRE_EQUAL(completions.size(), 1u);
+	BOOST_CHECK(completions[0].commandType == CommandType::LOFrequency);
+	BOOST_CHECK_EQUAL(completions[0].radioChannel, TX1);
+	BOOST_CHECK(completions[0].isSetCommand);
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(completions[0].result));
+	BOOST_CHECK_EQUAL(completions[0].responsePayload.GetAsUInt64(), 2400000000ULL);
+
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.CloseDevice()));
+}
+
+BOOST_AUTO_TEST_CASE(gain_cached_only_in_manual_mode)
+{
+	// Every transfer pays the latency, so only a get answered from the settings cache comes back right away
+	UseVirtualDevice("latency_us=20000");
+	RadioDevice device;
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.Setup()));
+	auto isGainFromDevice = [&]()
+	{
+		int gain = 0;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.GetGain(RX1, gain)));
+		BOOST_CHECK_EQUAL(gain, 20);
+		return chrono::steady_clock::now() - start >= chrono::milliseconds(15);
+	};
+
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.SetGain(RX1, 20)));
+	// The gain is known but the mode isn't, so an AGC may be moving it
+	device.InvalidateSettingsCache();
+	BOOST_CHECK(isGainFromDevice());
+	BOOST_CHECK(isGainFromDevice());
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.SetGainMode(RX1, RadioGainMode::Manual)));
+	BOOST_CHECK(isGainFromDevice());
+	BOOST_CHECK(!isGainFromDevice());
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.SetGainMode(RX1, RadioGainMode::SlowAGC)));
+	BOOST_CHECK(isGainFromDevice());
+	BOOST_CHECK(isGainFromDevice());
+
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.CloseDevice()));
+}
+
+BOOST_AUTO_TEST_CASE(receive_stream_survives_timeouts_and_short_reads)
+{
+	// Unlimited device FIFO, so the injected timeouts stall the stream but never lose samples. Not real time, so it runs as fast as the host can go.
+	UseVirtualDevice("short_read=0.2,timeout=0.01,fifo=0,realtime=0");
+	RadioDevice device;
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.Setup()));
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.SetSampleRate(RX1, SAMPLE_RATE)));
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.StartCapture()));
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.StartReceiveStream(1 << 22, OverflowPolicy::Block, 4, 16384)));
+
+	// The tone advances by the same phase every sample, so a lost, repeated or misaligned sample anywhere in the stream shows up as a bad step
+	const double expectedStep = 2.0 * M_PI * TONE_OFFSET_HZ / SAMPLE_RATE;
+	const uint64_t wantedBytes = 4 << 20;
+	uint64_t receivedBytes = 0;
+	uint64_t badSteps = 0;
+	uint32_t seenFlags = 0;
+	bool hasPrevious = false;
+	complex<double> previous;
+	chrono::steady_clock::time_point giveUp = chrono::steady_clock::now() + chrono::seconds(20);
+	while ((receivedBytes < wantedBytes || device.GetReceiveTimeoutCount() == 0) && chrono::steady_clock::now() < giveUp)
+	{
+		const uint8_t* data;
+		uint32_t numBytes;
+		uint32_t flags;
+		uint64_t timestampNs;
+		if (ERROR_FLAGS_FAILURE(device.AcquireReceiveData(data, numBytes, flags, timestampNs, 100)))
+		{
+			continue;
+		}
+		BOOST_CHECK_EQUAL(numBytes % 4, 0u);
+		seenFlags |= flags;
+		for (uint32_t offset = 0; offset + 4 <= numBytes; offset += 4)
+		{
+			complex<double> sample = ReadSample(data + offset);
+			if (hasPrevious && fabs(arg(sample * conj(previous)) - expectedStep) > 0.01)
+			{
+				badSteps++;
+			}
+			previous = sample;
+			hasPrevious = true;
+		}
+		receivedBytes += numBytes;
+		device.ReleaseReceiveData(numBytes);
+	}
+
+	BOOST_CHECK_GE(receivedBytes, wantedBytes);
+	BOOST_CHECK_GT(device.GetReceiveTimeoutCount(), 0u);
+	BOOST_CHECK((seenFlags & RING_SLOT_READ_TIMEOUT) != 0);
+	BOOST_CHECK((seenFlags & (RING_SLOT_DATA_LOST | RING_SLOT_READ_ERROR)) == 0);
+	BOOST_CHECK_EQUAL(device.GetReceiveErrorCount(), 0u);
+	BOOST_CHECK_EQUAL(device.GetReceiveOverflowCount(), 0u);
+	BOOST_CHECK_EQUAL(badSteps, 0u);
+
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.StopReceiveStream()));
+	device.StopCapture();
+	device.CloseDevice();
+}
+
+BOOST_AUTO_TEST_CASE(multi_channel_receive_stays_aligned)
+{
+	// The same with RX1 and RX2 interleaved. Short reads end slots in the middle of a frame, and after a timeout the rest of that frame is at the
+	// head of the next slot; dropping it would put every later sample on the wrong channel.
+	UseVirtualDevice("short_read=0.5,timeout=0.01,fifo=0,realtime=0");
+	RadioDevice device;
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.Setup()));
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.SetSampleRate(RX1, SAMPLE_RATE)));
+	const int numChannels = 2;
+	const uint32_t frameBytes = 4 * numChannels;
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.ClaimReceiveChannels(numChannels)));
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.StartCapture()));
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.StartReceiveStream(1 << 22, OverflowPolicy::Block, 4, 16384)));
+
+	// The virtual SABR puts channel k's tone at (k + 1) times the offset
+	const double expectedStep = 2.0 * M_PI * TONE_OFFSET_HZ / SAMPLE_RATE;
+	const uint64_t wantedBytes = 4 << 20;
+	uint64_t receivedBytes = 0;
+	uint64_t timeoutsMidFrame = 0;
+	vector<uint64_t> badSteps(numChannels, 0);
+	vector<complex<double>> previous(numChannels);
+	bool hasPrevious = false;
+	uint32_t seenFlags = 0;
+	FrameCarry carry(frameBytes);
+	auto checkFrame = [&](const uint8_t* frame)
+	{
+		for (int channel = 0; channel < numChannels; channel++)
+		{
+			complex<double> sample = ReadSample(frame + 4 * channel);
+			if (hasPrevious && fabs(arg(sample * conj(previous[channel])) - (channel + 1) * expectedStep) > 0.01)
+			{
+				badSteps[channel]++;
+			}
+			previous[channel] = sample;
+		}
+		hasPrevious = true;
+	};
+	chrono::steady_clock::time_point giveUp = chrono::steady_clock::now() + chrono::seconds(30);
+	while ((receivedBytes < wantedBytes || timeoutsMidFrame == 0) && chrono::steady_clock::now() < giveUp)
+	{
+		const uint8_t* data;
+		uint32_t numBytes;
+		uint32_t flags;
+		uint64_t timestampNs;
+		if (ERROR_FLAGS_FAILURE(device.AcquireReceiveData(data, numBytes, flags, timestampNs, 100)))
+		{
+			continue;
+		}
+		seenFlags |= flags;
+		timeoutsMidFrame += (flags & RING_SLOT_READ_TIMEOUT) && carry.GetBytes() > 0;
+		// Consumed the way the SABR Source does it
+		carry.OnGap(flags);
+		uint32_t numUsed;
+		if (carry.GetBytes() > 0 || numBytes < frameBytes)
+		{
+			numUsed = carry.Fill(data, numBytes);
+			if (carry.IsComplete())
+			{
+				checkFrame(carry.GetFrame());
+				carry.Clear();
+			}
+		}
+		else
+		{
+			numUsed = numBytes - numBytes % frameBytes;
+			for (uint32_t offset = 0; offset < numUsed; offset += frameBytes)
+			{
+				checkFrame(data + offset);
+			}
+		}
+		receivedBytes += numUsed;
+		device.ReleaseReceiveData(numUsed);
+	}
+
+	BOOST_CHECK_GE(receivedBytes, wantedBytes);
+	BOOST_CHECK_GT(timeoutsMidFrame, 0u);
+	BOOST_CHECK((seenFlags & (RING_SLOT_DATA_LOST | RING_SLOT_READ_ERROR)) == 0);
+	BOOST_CHECK_EQUAL(device.GetReceiveOverflowCount(), 0u);
+	for (int channel = 0; channel < numChannels; channel++)
+	{
+		BOOST_CHECK_MESSAGE(badSteps[channel] == 0, "RX" << channel + 1 << ": " << badSteps[channel] << " bad phase steps");
+	}
+
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.StopReceiveStream()));
+	device.StopCapture();
+	device.ReleaseReceiveChannels();
+	device.CloseDevice();
+}
+
+BOOST_AUTO_TEST_CASE(transmit_back_pressure)
+{
+	const uint32_t fifoBytes = 262144;
+	UseVirtualDevice("fifo=262144");
+	RadioDevice device;
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.Setup()));
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.SetSampleRate(TX1, SAMPLE_RATE)));
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.StartTransmit()));
+	const double byteRate = 4.0 * SAMPLE_RATE;
+
+	// Direct writes: once the device FIFO is full each write waits for the DAC to make room
+	vector<uint8_t> zeros(65536, 0);
+	const uint64_t directBytes = 2 << 20;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (uint64_t written = 0; written < directBytes; written += zeros.size())
+	{
+		BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.TransmitSamples(&zeros[0], zeros.size())));
+	}
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	BOOST_CHECK_GE(elapsed, 0.9 * (directBytes - fifoBytes) / byteRate);
+
+	// Streaming: a producer that never stops is held back by the full ring, and the writer keeps the device fed without underflows
+	const uint32_t transferBytes = 32768;
+	const uint64_t ringBytes = 262144;
+	device.SetTransmitStreamRate((double)SAMPLE_RATE);
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.StartTransmitStream(ringBytes, transferBytes, ringBytes / 2, 0.01)));
+	atomic<bool> isRunning(true);
+	atomic<uint64_t> committedBytes(0);
+	thread producer([&]()
+	{
+		while (isRunning)
+		{
+			uint8_t* buffer = device.AcquireTransmitBuffer();
+			if (buffer == NULL)
+			{
+				break;
+			}
+			memset(buffer, 0, transferBytes);
+			device.CommitTransmitBuffer(transferBytes);
+			committedBytes += transferBytes;
+		}
+	});
+	start = chrono::steady_clock::now();
+	this_thread::sleep_for(chrono::milliseconds(1000));
+	elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	uint64_t committedInTime = committedBytes;
+	TransmitStatistics statistics;
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.GetTransmitStatistics(statistics)));
+	isRunning = false;
+	// Stopping the stream releases the producer if it is waiting on a full ring
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.StopTransmitStream()));
+	producer.join();
+
+	// What the producer got in is bounded by the rate plus what the ring and the device can hold
+	BOOST_CHECK_LE(committedInTime, (uint64_t)(elapsed * byteRate) + ringBytes + fifoBytes + transferBytes);
+	BOOST_CHECK_GE(committedInTime, (uint64_t)(0.5 * elapsed * byteRate));
+	BOOST_CHECK_EQUAL(statistics.failedWrites, 0u);
+	BOOST_CHECK_EQUAL(statistics.underflows, 0u);
+	BOOST_CHECK_EQUAL(statistics.bytesAccepted, statistics.bytesSubmitted);
+
+	device.StopTransmit();
+	device.CloseDevice();
+}
+
+BOOST_AUTO_TEST_CASE(transmit_underflow_once_per_dry_spell)
+{
+	// No prefill: the writer starts on the first slot queued, and once the ring runs dry it waits for more instead of counting the same gap
+	// over and over
+	UseVirtualDevice("fifo=262144");
+	RadioDevice device;
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.Setup()));
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.SetSampleRate(TX1, SAMPLE_RATE)));
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.StartTransmit()));
+	const uint32_t transferBytes = 32768;
+	BOOST_REQUIRE(ERROR_FLAGS_SUCCESS(device.StartTransmitStream(8 * transferBytes, transferBytes, 0, 0.01)));
+	const uint64_t numSpells = 3;
+	for (uint64_t spell = 0; spell < numSpells; spell++)
+	{
+		// The writer holds off while there is no rate, so all of this spell's slots are queued before it starts on them
+		device.SetTransmitStreamRate(0);
+		this_thread::sleep_for(chrono::milliseconds(10));
+		for (int slot = 0; slot < 4; slot++)
+		{
+			uint8_t* buffer = device.AcquireTransmitBuffer();
+			BOOST_REQUIRE(buffer != NULL);
+			memset(buffer, 0, transferBytes);
+			device.CommitTransmitBuffer(transferBytes);
+		}
+		device.SetTransmitStreamRate((double)SAMPLE_RATE);
+		// Four slots play out in about 16 ms, then the ring stays dry
+		this_thread::sleep_for(chrono::milliseconds(200));
+		BOOST_CHECK_EQUAL(device.GetTransmitUnderflowCount(), spell + 1);
+	}
+
+	BOOST_CHECK(ERROR_FLAGS_SUCCESS(device.StopTransmitStream()));
+	device.StopTransmit();
+	device.CloseDevice();
+}
@@ -0,0 +1,279 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 TapHere! Technology.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+// Every kernel this CPU can run has to give bit-identical output and clip counts to the scalar reference, for any length and alignment.
+
+#include "SampleConversion.h"
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace THR;
+
+namespace
+{
+	// Odd tails on either side of every SIMD width, and past the 256 frame block the multi-channel conversions work in
+	const size_t LENGTHS[] = { 0, 1, 2, 3, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 64, 65, 127, 129, 255, 256, 257, 513, 1000 };
+	// Offsets in elements, so the SIMD loads and stores see every alignment
+	const size_t OFFSETS[] = { 0, 1, 2, 3 };
+	const float SCALES[] = { 1.0f, 32767.0f, 1.0f / 32768.0f };
+	const size_t MAX_VALUES = 2 * 4 * 1000 + 64;
+
+	vector<ConversionKernel> GetKernels()
+	{
+		vector<ConversionKernel> kernels;
+		for (int kernel = (int)ConversionKernel::SSE2; kernel <= (int)ConversionKernel::NEON; kernel++)
+		{
+			if (IsConversionKernelAvailable((ConversionKernel)kernel))
+			{
+				kernels.push_back((ConversionKernel)kernel);
+			}
+		}
+		return kernels;
+	}
+
+	// Puts the detected kernel back however the test ends
+	struct KernelGuard
+	{
+		const ConversionKernel detected;
+		KernelGuard() : detected(GetConversionKernel()) {}
+		~KernelGuard() { SetConversionKernel(detected); }
+	};
+
+	vector<uint8_t> MakeRaw(mt19937& random)
+	{
+		vector<uint8_t> raw(MAX_VALUES * 2);
+		for (size_t i = 0; i < raw.size(); i++)
+		{
+			raw[i] = (uint8_t)random();
+		}
+		// Both ends of the int16 range
+		raw[0] = 0x80;
+		raw[1] = 0x00;
+		raw[2] = 0x7f;
+		raw[3] = 0xff;
+		return raw;
+	}
+
+	// Mostly in range, with out of range values, NaN, the infinities and values right at the clamp limits mixed in all through
+	vector<float> MakeFloats(mt19937& random)
+	{
+		const float specials[] = { numeric_limits<float>::quiet_NaN(), numeric_limits<float>::infinity(), -numeric_limits<float>::infinity(),
+			32767.0f, 32767.5f, 32768.0f, -32768.0f, -32768.5f, -32769.0f, 1e30f, -1e30f, -0.0f, 0.5f, -0.5f, 1.0f, -1.0f };
+		const size_t numSpecials = sizeof(specials) / sizeof(specials[0]);
+		uniform_real_distribution<float> values(-40000.0f, 40000.0f);
+		vector<float> floats(MAX_VALUES);
+		for (size_t i = 0; i < floats.size(); i++)
+		{
+			floats[i] = random() % 5 == 0 ? specials[random() % numSpecials] : values(random);
+		}
+		return floats;
+	}
+
+	size_t GetUnitBytes(StreamType type)
+	{
+		return type == StreamType::PlanarFC32 ? sizeof(float) : GetStreamItemSize(type);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(scalar_reference_clamps)
+{
+	KernelGuard guard;
+	BOOST_REQUIRE(SetConversionKernel(ConversionKernel::Scalar));
+	const float in[] = { numeric_limits<float>::quiet_NaN(), numeric_limits<float>::infinity(), -numeric_limits<float>::infinity(), 40000.0f,
+		-40000.0f, 32767.0f, -32768.0f, 1.9f, -1.9f, 0.0f };
+	const int16_t expected[] = { -32768, 32767, -32768, 32767, -32768, 32767, -32768, 1, -1, 0 };
+	uint8_t out[sizeof(in) / sizeof(in[0]) * 2];
+	BOOST_CHECK_EQUAL(ConvertFC32ToSC16BE(in, out, 5), 5u);
+	for (size_t i = 0; i < sizeof(in) / sizeof(in[0]); i++)
+	{
+		BOOST_CHECK_EQUAL((int16_t)((out[2 * i] << 8) | out[2 * i + 1]), expected[i]);
+	}
+	// The scale is applied before the clamp; full scale after scaling is not a clip
+	const float halves[] = { 0.5f, -0.5f, 1.0f, -1.0f };
+	BOOST_CHECK_EQUAL(ConvertFC32ToSC16BE(halves, out, 2, 32767.0f), 0u);
+	BOOST_CHECK_EQUAL((int16_t)((out[0] << 8) | out[1]), 16383);
+	BOOST_CHECK_EQUAL((int16_t)((out[6] << 8) | out[7]), -32767);
+}
+
+BOOST_AUTO_TEST_CASE(kernels_match_scalar)
+{
+	KernelGuard guard;
+	vector<ConversionKernel> kernels = GetKernels();
+	BOOST_TEST_MESSAGE("Detected " << GetConversionKernelName(guard.detected) << ", comparing " << kernels.size() << " kernels against scalar");
+	mt19937 random(1);
+	vector<uint8_t> raw = MakeRaw(random);
+	vector<float> floats = MakeFloats(random);
+	vector<float> expectedFloats(MAX_VALUES);
+	vector<float> actualFloats(MAX_VALUES);
+	vector<uint8_t> expectedRaw(MAX_VALUES * 2);
+	vector<uint8_t> actualRaw(MAX_VALUES * 2);
+
+	for (ConversionKernel kernel : kernels)
+	{
+		for (size_t numSamples : LENGTHS)
+		{
+			for (size_t inOffset : OFFSETS)
+			{
+				for (size_t outOffset : OFFSETS)
+				{
+					const uint8_t* rawIn = &raw[2 * inOffset];
+					const float* floatIn = &floats[inOffset];
+					for (float scale : SCALES)
+					{
+						BOOST_REQUIRE(SetConversionKernel(ConversionKernel::Scalar));
+						ConvertSC16BEToFC32(rawIn, &expectedFloats[outOffset], numSamples, scale);
+						size_t expectedClipped = ConvertFC32ToSC16BE(floatIn, &expectedRaw[2 * outOffset], numSamples, scale);
+						BOOST_REQUIRE(SetConversionKernel(kernel));
+						ConvertSC16BEToFC32(rawIn, &actualFloats[outOffset], numSamples, scale);
+						size_t actualClipped = ConvertFC32ToSC16BE(floatIn, &actualRaw[2 * outOffset], numSamples, scale);
+
+						BOOST_TEST_CONTEXT(GetConversionKernelName(kernel) << " " << numSamples << " samples, offsets " << inOffset << "/" << outOffset
+							<< ", scale " << scale)
+						{
+							BOOST_CHECK(memcmp(&expectedFloats[outOffset], &actualFloats[outOffset], numSamples * 2 * sizeof(float)) == 0);
+							BOOST_CHECK(memcmp(&expectedRaw[2 * outOffset], &actualRaw[2 * outOffset], numSamples * 4) == 0);
+							BOOST_CHECK_EQUAL(expectedClipped, actualClipped);
+						}
+					}
+
+					BOOST_REQUIRE(SetConversionKernel(ConversionKernel::Scalar));
+					SwapSC16(rawIn, &expectedRaw[2 * outOffset], numSamples);
+					BOOST_REQUIRE(SetConversionKernel(kernel));
+					SwapSC16(rawIn, &actualRaw[2 * outOffset], numSamples);
+					BOOST_CHECK_MESSAGE(memcmp(&expectedRaw[2 * outOffset], &actualRaw[2 * outOffset], numSamples * 4) == 0,
+						GetConversionKernelName(kernel) << " SwapSC16 " << numSamples << " samples, offsets " << inOffset << "/" << outOffset);
+				}
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(multi_channel_kernels_match_scalar)
+{
+	KernelGuard guard;
+	vector<ConversionKernel> kernels = GetKernels();
+	kernels.insert(kernels.begin(), ConversionKernel::Scalar);
+	mt19937 random(2);
+	vector<uint8_t> raw = MakeRaw(random);
+	vector<float> floats = MakeFloats(random);
+	const StreamType types[] = { StreamType::FC32, StreamType::SC16, StreamType::SC8, StreamType::PlanarFC32 };
+	const size_t numFrames[] = { 0, 1, 3, 7, 8, 9, 17, 255, 256, 257, 1000 };
+
+	for (ConversionKernel kernel : kernels)
+	{
+		for (StreamType type : types)
+		{
+			const size_t unitBytes = GetUnitBytes(type);
+			for (int numChannels = 1; numChannels <= MAX_DEINTERLEAVE_CHANNELS; numChannels++)
+			{
+				const int numPorts = numChannels * GetStreamPortCount(type);
+				for (size_t frames : numFrames)
+				{
+					for (size_t offset : OFFSETS)
+					{
+						BOOST_TEST_CONTEXT(GetConversionKernelName(kernel) << " type " << (int)type << ", " << numChannels << " channels, " << frames
+							<< " frames, offset " << offset)
+						{
+							// Deinterleave: channel k of frame f is sample f * numChannels + k of the single channel conversion
+							const uint8_t* rawIn = &raw[offset];
+							vector<vector<uint8_t>> expected(numPorts, vector<uint8_t>((frames + 1) * unitBytes));
+							vector<vector<uint8_t>> actual(numPorts, vector<uint8_t>((frames + 1) * unitBytes + offset));
+							vector<void*> actualOut(numPorts);
+							for (int port = 0; port < numPorts; port++)
+							{
+								actualOut[port] = &actual[port][offset];
+							}
+							BOOST_REQUIRE(SetConversionKernel(ConversionKernel::Scalar));
+							for (size_t frame = 0; frame < frames; frame++)
+							{
+								for (int channel = 0; channel < numChannels; channel++)
+								{
+									const uint8_t* sample = rawIn + (frame * numChannels + channel) * 4;
+									if (type == StreamType::PlanarFC32)
+									{
+										ConvertSC16BEToPlanarFC32(sample, (float*)&expected[2 * channel][frame * unitBytes],
+											(float*)&expected[2 * channel + 1][frame * unitBytes], 1, 0.5f);
+									}
+									else
+									{
+										void* single[] = { &expected[channel][frame * unitBytes] };
+										DeinterleaveSC16BE(sample, single, type, 1, 1, 0.5f);
+									}
+								}
+							}
+							BOOST_REQUIRE(SetConversionKernel(kernel));
+							DeinterleaveSC16BE(rawIn, &actualOut[0], type, numChannels, frames, 0.5f);
+							for (int port = 0; port < numPorts; port++)
+							{
+								BOOST_CHECK(memcmp(&expected[port][0], actualOut[port], frames * unitBytes) == 0);
+							}
+
+							// Interleave: the reverse, with the clip count of the single channel conversions added up
+							vector<vector<uint8_t>> inputs(numPorts, vector<uint8_t>((frames + 1) * unitBytes + offset));
+							vector<const void*> inputPointers(numPorts);
+							for (int port = 0; port < numPorts; port++)
+							{
+								uint8_t* input = &inputs[port][offset];
+								if (type == StreamType::FC32 || type == StreamType::PlanarFC32)
+								{
+									memcpy(input, &floats[(port * 7 + offset) % 64], frames * unitBytes);
+								}
+								else
+								{
+									memcpy(input, &raw[(port * 7 + offset) % 64], frames * unitBytes);
+								}
+								inputPointers[port] = input;
+							}
+							vector<uint8_t> expectedRaw(frames * numChannels * 4 + 1);
+							vector<uint8_t> actualRaw(frames * numChannels * 4 + offset + 1);
+							size_t expectedClipped = 0;
+							BOOST_REQUIRE(SetConversionKernel(ConversionKernel::Scalar));
+							for (size_t frame = 0; frame < frames; frame++)
+							{
+								for (int channel = 0; channel < numChannels; channel++)
+								{
+									uint8_t* sample = &expectedRaw[(frame * numChannels + channel) * 4];
+									if (type == StreamType::PlanarFC32)
+									{
+										expectedClipped += ConvertPlanarFC32ToSC16BE((const float*)inputPointers[2 * channel] + frame,
+											(const float*)inputPointers[2 * channel + 1] + frame, sample, 1, 2.0f);
+									}
+									else
+									{
+										const void* single[] = { (const uint8_t*)inputPointers[channel] + frame * unitBytes };
+										expectedClipped += InterleaveSC16BE(single, sample, type, 1, 1, 2.0f);
+									}
+								}
+							}
+							BOOST_REQUIRE(SetConversionKernel(kernel));
+							size_t actualClipped = InterleaveSC16BE(&inputPointers[0], &actualRaw[offset], type, numChannels, frames, 2.0f);
+							BOOST_CHECK(memcmp(&expectedRaw[0], &actualRaw[offset], frames * numChannels * 4) == 0);
+							BOOST_CHECK_EQUAL(expectedClipped, actualClipped);
+						}
+					}
+				}
+			}
+		}
+	}
+}
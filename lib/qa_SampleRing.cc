@@ -0,0 +1,326 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 TapHere! Technology.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+// SampleRing with a real producer and consumer thread. Boost.Test checks aren't thread safe, so the threads only record what they saw and the
+// checks run once they are joined.
+
+#include "SampleRing.h"
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <thread>
+
+using namespace std;
+using namespace THR;
+
+namespace
+{
+	const uint32_t SLOT_BYTES = 256;
+	const uint32_t NUM_SLOTS = 8;
+	const uint32_t NUM_TRANSFERS = 10000;
+
+	// Every 37th transfer is an empty commit that only carries RING_SLOT_READ_TIMEOUT, like RadioDevice does for a timed out read
+	bool IsEmptyTransfer(uint32_t transfer)
+	{
+		return transfer % 37 == 36;
+	}
+
+	uint32_t GetTransferWords(uint32_t transfer)
+	{
+		return IsEmptyTransfer(transfer) ? 0 : 1 + transfer * 7 % (SLOT_BYTES / 4);
+	}
+
+	// Word k of transfer t, so the consumer can tell exactly where every byte came from
+	uint32_t MakeWord(uint32_t transfer, uint32_t word)
+	{
+		return (transfer << 8) | word;
+	}
+
+	struct RunResult
+	{
+		uint64_t producedBytes = 0;
+		uint64_t consumedBytes = 0;
+		uint64_t outOfOrder = 0;
+		uint64_t gapsWithoutFlag = 0;
+		uint64_t dataLostFlags = 0;
+		uint64_t timeoutFlags = 0;
+		uint64_t misplacedTimeoutFlags = 0;
+		uint64_t nullAcquires = 0;
+		uint64_t overflowCount = 0;
+		uint64_t droppedBytes = 0;
+	};
+
+	// The producer keeps up to maxPendingWrites transfers acquired at once, like the queued USB reads do. The consumer takes each slot in
+	// uneven pieces and now and then stalls long enough for the ring to overflow.
+	RunResult RunProducerConsumer(OverflowPolicy policy, uint32_t maxPendingWrites)
+	{
+		SampleRing ring(NUM_SLOTS, SLOT_BYTES, policy, maxPendingWrites);
+		RunResult result;
+		atomic<bool> isProducerDone(false);
+
+		thread producer([&]()
+		{
+			deque<uint32_t> pending;
+			uint32_t transfer = 0;
+			while (transfer < NUM_TRANSFERS || !pending.empty())
+			{
+				while (pending.size() < maxPendingWrites && transfer < NUM_TRANSFERS)
+				{
+					uint32_t* buffer = (uint32_t*)ring.AcquireWrite();
+					if (buffer == NULL)
+					{
+						result.nullAcquires++;
+						break;
+					}
+					for (uint32_t word = 0; word < GetTransferWords(transfer); word++)
+					{
+						buffer[word] = MakeWord(transfer, word);
+					}
+					pending.push_back(transfer++);
+				}
+				uint32_t committed = pending.front();
+				pending.pop_front();
+				uint32_t numBytes = GetTransferWords(committed) * 4;
+				ring.CommitWrite(numBytes, numBytes == 0 ? RING_SLOT_READ_TIMEOUT : 0, committed);
+				result.producedBytes += numBytes;
+				// About as fast as the consumer, so the ring only overflows while the consumer stalls
+				if (committed % 8 == 7)
+				{
+					this_thread::sleep_for(chrono::microseconds(100));
+				}
+			}
+			isProducerDone = true;
+		});
+
+		uint32_t expectedTransfer = 0;
+		uint32_t expectedWord = 0;
+		uint32_t numSlotsRead = 0;
+		while (true)
+		{
+			const uint8_t* data;
+			uint32_t length;
+			uint32_t flags;
+			uint64_t timestamp;
+			bool isDone = isProducerDone;
+			if (!ring.AcquireRead(data, length, flags, timestamp, 20))
+			{
+				if (isDone)
+				{
+					break;
+				}
+				continue;
+			}
+			const uint32_t* words = (const uint32_t*)data;
+			uint32_t transfer = words[0] >> 8;
+			if (words[0] == MakeWord(transfer, 0))
+			{
+				// Start of a slot: anything skipped other than empty transfers was dropped and has to be flagged
+				numSlotsRead++;
+				uint32_t nextWithData = expectedTransfer;
+				while (IsEmptyTransfer(nextWithData))
+				{
+					nextWithData++;
+				}
+				result.outOfOrder += transfer < nextWithData || timestamp != transfer;
+				result.gapsWithoutFlag += transfer > nextWithData && !(flags & RING_SLOT_DATA_LOST);
+				result.dataLostFlags += (flags & RING_SLOT_DATA_LOST) != 0;
+				result.timeoutFlags += (flags & RING_SLOT_READ_TIMEOUT) != 0;
+				// Nothing dropped: the flag of an empty commit lands on the very next slot
+				result.misplacedTimeoutFlags += transfer == nextWithData && !(flags & RING_SLOT_DATA_LOST) &&
+					((flags & RING_SLOT_READ_TIMEOUT) != 0) != (transfer > 0 && IsEmptyTransfer(transfer - 1));
+				expectedTransfer = transfer;
+			}
+			else
+			{
+				// Rest of a slot we already started on
+				result.outOfOrder += transfer != expectedTransfer || (words[0] & 0xff) != expectedWord || flags != 0;
+			}
+			// Take it in pieces of up to 5 words
+			uint32_t numWords = min<uint32_t>(length / 4, 1 + numSlotsRead % 5);
+			for (uint32_t word = 0; word < numWords; word++)
+			{
+				result.outOfOrder += words[word] != MakeWord(transfer, (words[0] & 0xff) + word);
+			}
+			expectedWord = (words[0] & 0xff) + numWords;
+			if (expectedWord == GetTransferWords(transfer))
+			{
+				expectedTransfer = transfer + 1;
+				expectedWord = 0;
+			}
+			result.consumedBytes += numWords * 4;
+			ring.ReleaseRead(numWords * 4);
+			if (numSlotsRead % 64 == 0 && expectedWord == 0)
+			{
+				this_thread::sleep_for(chrono::milliseconds(2));
+			}
+		}
+		producer.join();
+		result.overflowCount = ring.GetOverflowCount();
+		result.droppedBytes = ring.GetDroppedBytes();
+		return result;
+	}
+
+	void CheckRun(OverflowPolicy policy, uint32_t maxPendingWrites)
+	{
+		RunResult result = RunProducerConsumer(policy, maxPendingWrites);
+		BOOST_TEST_MESSAGE("Policy " << (int)policy << ", " << maxPendingWrites << " pending: " << result.overflowCount << " overflows, "
+			<< result.droppedBytes << " of " << result.producedBytes << " bytes dropped");
+		BOOST_CHECK_EQUAL(result.outOfOrder, 0u);
+		BOOST_CHECK_EQUAL(result.gapsWithoutFlag, 0u);
+		BOOST_CHECK_EQUAL(result.nullAcquires, 0u);
+		// Every byte is either handed to the consumer or counted as dropped
+		BOOST_CHECK_EQUAL(result.consumedBytes + result.droppedBytes, result.producedBytes);
+		BOOST_CHECK_LE(result.dataLostFlags, result.overflowCount);
+		BOOST_CHECK_LE(result.timeoutFlags, NUM_TRANSFERS / 37);
+		BOOST_CHECK_EQUAL(result.misplacedTimeoutFlags, 0u);
+		if (policy == OverflowPolicy::Block)
+		{
+			BOOST_CHECK_EQUAL(result.overflowCount, 0u);
+			BOOST_CHECK_EQUAL(result.droppedBytes, 0u);
+			BOOST_CHECK_EQUAL(result.dataLostFlags, 0u);
+			BOOST_CHECK_EQUAL(result.timeoutFlags, NUM_TRANSFERS / 37);
+		}
+		else
+		{
+			BOOST_CHECK_GT(result.overflowCount, 0u);
+			BOOST_CHECK_GT(result.droppedBytes, 0u);
+			BOOST_CHECK_GT(result.dataLostFlags, 0u);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(drop_oldest)
+{
+	CheckRun(OverflowPolicy::DropOldest, 1);
+}
+
+BOOST_AUTO_TEST_CASE(drop_newest)
+{
+	CheckRun(OverflowPolicy::DropNewest, 1);
+}
+
+BOOST_AUTO_TEST_CASE(block)
+{
+	CheckRun(OverflowPolicy::Block, 1);
+}
+
+BOOST_AUTO_TEST_CASE(multiple_pending_writes)
+{
+	CheckRun(OverflowPolicy::DropOldest, 4);
+	CheckRun(OverflowPolicy::DropNewest, 4);
+	CheckRun(OverflowPolicy::Block, 4);
+
+	// No more than maxPendingWrites buffers out at once, and they are committed in the order they were acquired
+	SampleRing ring(NUM_SLOTS, SLOT_BYTES, OverflowPolicy::Block, 3);
+	uint8_t* buffers[3];
+	for (int i = 0; i < 3; i++)
+	{
+		buffers[i] = ring.AcquireWrite();
+		BOOST_REQUIRE(buffers[i] != NULL);
+		buffers[i][0] = (uint8_t)i;
+	}
+	BOOST_CHECK(ring.AcquireWrite() == NULL);
+	for (int i = 0; i < 3; i++)
+	{
+		ring.CommitWrite(4, 0, i);
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		const uint8_t* data;
+		uint32_t length;
+		uint32_t flags;
+		uint64_t timestamp;
+		BOOST_REQUIRE(ring.AcquireRead(data, length, flags, timestamp, 0));
+		BOOST_CHECK_EQUAL(data[0], i);
+		BOOST_CHECK_EQUAL(timestamp, (uint64_t)i);
+		ring.ReleaseRead(length);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(flags_carry_over_empty_commits)
+{
+	SampleRing ring(NUM_SLOTS, SLOT_BYTES, OverflowPolicy::DropNewest);
+	ring.AcquireWrite();
+	ring.CommitWrite(0, RING_SLOT_READ_TIMEOUT);
+	ring.AcquireWrite();
+	ring.CommitWrite(0, RING_SLOT_READ_ERROR);
+	ring.AcquireWrite();
+	ring.CommitWrite(16, 0);
+	ring.AcquireWrite();
+	ring.CommitWrite(16, 0);
+
+	const uint8_t* data;
+	uint32_t length;
+	uint32_t flags;
+	uint64_t timestamp;
+	BOOST_REQUIRE(ring.AcquireRead(data, length, flags, timestamp, 0));
+	BOOST_CHECK_EQUAL(length, 16u);
+	BOOST_CHECK_EQUAL(flags, RING_SLOT_READ_TIMEOUT | RING_SLOT_READ_ERROR);
+	// Only on the first piece of the slot
+	ring.ReleaseRead(8);
+	BOOST_REQUIRE(ring.AcquireRead(data, length, flags, timestamp, 0));
+	BOOST_CHECK_EQUAL(length, 8u);
+	BOOST_CHECK_EQUAL(flags, 0u);
+	ring.ReleaseRead(8);
+	BOOST_REQUIRE(ring.AcquireRead(data, length, flags, timestamp, 0));
+	BOOST_CHECK_EQUAL(flags, 0u);
+	ring.ReleaseRead(length);
+	// Nothing left, including the empty slots
+	BOOST_CHECK(!ring.AcquireRead(data, length, flags, timestamp, 0));
+	BOOST_CHECK_EQUAL(ring.GetNumQueuedSlots(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(shutdown_releases_blocked_producer)
+{
+	SampleRing ring(2, SLOT_BYTES, OverflowPolicy::Block);
+	// Fill the ring, then block on the next slot
+	future<uint8_t*> blocked = async(launch::async, [&ring]()
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			ring.AcquireWrite();
+			ring.CommitWrite(SLOT_BYTES, 0);
+		}
+		return ring.AcquireWrite();
+	});
+	BOOST_CHECK(blocked.wait_for(chrono::milliseconds(100)) == future_status::timeout);
+	ring.Shutdown();
+	BOOST_REQUIRE(blocked.wait_for(chrono::seconds(1)) == future_status::ready);
+	// It gets a scratch buffer to write into, and whatever goes in there is dropped
+	BOOST_CHECK(blocked.get() != NULL);
+	ring.CommitWrite(SLOT_BYTES, 0);
+	BOOST_CHECK_EQUAL(ring.GetDroppedBytes(), SLOT_BYTES);
+
+	// The consumer still gets what was queued before the shutdown, then stops waiting
+	const uint8_t* data;
+	uint32_t length;
+	uint32_t flags;
+	uint64_t timestamp;
+	for (int i = 0; i < 2; i++)
+	{
+		BOOST_REQUIRE(ring.AcquireRead(data, length, flags, timestamp, 0));
+		ring.ReleaseRead(length);
+	}
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	BOOST_CHECK(!ring.AcquireRead(data, length, flags, timestamp, 5000));
+	BOOST_CHECK(chrono::steady_clock::now() - start < chrono::seconds(1));
+}
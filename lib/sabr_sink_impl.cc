@@ -23,7 +23,11 @@
 #endif
 
 #include <gnuradio/io_signature.h>
+#include <gnuradio/block_detail.h>
+#include <gnuradio/buffer.h>
 #include "sabr_sink_impl.h"
+#include <algorithm>
+#include <climits>
 
 using namespace THR;
 
@@ -33,15 +37,62 @@ namespace gr
 	{
 
 		sabr_sink::sptr
-			sabr_sink::make(double frequency, double sampleRate, float attenuation)
+			sabr_sink::make(double frequency, double sampleRate, float attenuation, float scale, int streamType, float leadTime, int ringSize, int prefill, bool burstMode,
+			int channelConfig, const std::string& serialNumber, int cpuCore)
 		{
 			return gnuradio::get_initial_sptr
-			(new sabr_sink_impl(frequency, sampleRate, attenuation));
+			(new sabr_sink_impl(frequency, sampleRate, attenuation, scale, streamType, leadTime, ringSize, prefill, burstMode, channelConfig, serialNumber, cpuCore));
+		}
+
+		static StreamType ToStreamType(int streamType)
+		{
+			return streamType >= 0 && streamType <= (int)StreamType::PlanarFC32 ? (StreamType)streamType : StreamType::FC32;
+		}
+
+		// Any mode with at least one transmitter; receive only modes fall back to TX1 alone
+		static IQChannelConfig ToChannelConfig(int channelConfig)
+		{
+			if (channelConfig < (int)IQChannelConfig::Default || channelConfig > (int)IQChannelConfig::R3T1 ||
+				RadioDevice::GetTransmitChannelCount((IQChannelConfig)channelConfig) == 0)
+			{
+				return IQChannelConfig::Default;
+			}
+			return (IQChannelConfig)channelConfig;
+		}
+
+		static gr::io_signature::sptr MakeInputSignature(int streamType, int channelConfig)
+		{
+			StreamType type = ToStreamType(streamType);
+			int numPorts = GetStreamPortCount(type) * RadioDevice::GetTransmitChannelCount(ToChannelConfig(channelConfig));
+			return gr::io_signature::make(numPorts, numPorts, GetStreamItemSize(type));
+		}
+
+		// Input channel 0 is TX1 (RadioChannel::Two), 1 is TX2 (RadioChannel::Four) and so on
+		static int ToRadioChannel(int channel)
+		{
+			return 2 * channel + 1;
+		}
+
+		static const pmt::pmt_t SOB_KEY = pmt::intern("tx_sob");
+		static const pmt::pmt_t EOB_KEY = pmt::intern("tx_eob");
+		static const pmt::pmt_t TIME_KEY = pmt::intern("tx_time");
+		static const uint64_t NS_PER_SECOND = 1000000000;
+		static const pmt::pmt_t STATISTICS_PORT = pmt::mp("tx_stats");
+		// How often work() sends the transmit counters out of the tx_stats port
+		static const uint64_t STATISTICS_INTERVAL_NS = NS_PER_SECOND;
+
+		// Where a burst tag takes effect: tx_eob marks the last sample of a burst so it applies after that sample. At the same position a burst ends
+		// before the next one starts, and tx_time has to be known before the tx_sob it goes with.
+		static uint64_t GetBurstTagPosition(const gr::tag_t& tag)
+		{
+			return pmt::eqv(tag.key, EOB_KEY) ? tag.offset + 1 : tag.offset;
+		}
+
+		static int GetBurstTagRank(const gr::tag_t& tag)
+		{
+			return pmt::eqv(tag.key, EOB_KEY) ? 0 : pmt::eqv(tag.key, TIME_KEY) ? 1 : 2;
 		}
 
-		// Number of input streams
-		static const int MIN_IN = 1;
-		static const int MAX_IN = 1;
 		// Number of output streams  
 		static const int MIN_OUT = 0;
 		static const int MAX_OUT = 0;
@@ -49,24 +100,103 @@ namespace gr
 		/*
 		 * The private constructor
 		 */
-		sabr_sink_impl::sabr_sink_impl(double frequency, double sampleRate, float attenuation)
+		sabr_sink_impl::sabr_sink_impl(double frequency, double sampleRate, float attenuation, float scale, int streamType, float leadTime, int ringSize, int prefill, bool burstMode,
+			int channelConfig, const std::string& serialNumber, int cpuCore)
 			: gr::sync_block("sabr_sink",
-				gr::io_signature::make(MIN_IN, MAX_IN, sizeof(gr_complex)),
-				gr::io_signature::make(MIN_OUT, MAX_OUT, sizeof(gr_complex)))
+				MakeInputSignature(streamType, channelConfig),
+				gr::io_signature::make(MIN_OUT, MAX_OUT, sizeof(gr_complex))),
+			numChannels(RadioDevice::GetTransmitChannelCount(ToChannelConfig(channelConfig))),
+			numPorts(numChannels * GetStreamPortCount(ToStreamType(streamType))),
+			frameBytes(BYTES_PER_SAMPLE * numChannels),
+			portInputs(numPorts),
+			samplesPerChunk(txChunkSize / frameBytes),
+			chunkBytes(samplesPerChunk * frameBytes),
+			confirmedSampleRate(0),
+			pacerSampleRate(0),
+			ringSize(ringSize > 0 ? (uint64_t)ringSize : 0),
+			prefill(prefill > 0 ? (uint64_t)prefill : 0),
+			leadTime(leadTime),
+			burstMode(burstMode),
+			isInBurst(false),
+			burstTime(0),
+			burstTimeSample(0),
+			transmitBuffer(NULL),
+			transmitBufferFill(0),
+			transmitBufferFlags(0),
+			transmitBufferTime(0),
+			scale(scale),
+			streamType(ToStreamType(streamType)),
+			clipCount(0),
+			starvedCounts(numChannels, 0),
+			lastUnderflowCount(0),
+			sampleBytes(chunkBytes),
+			lastStatisticsNs(0)
 		{
-			ErrorFlags result = sabrDevice.Setup();
-			if (ERROR_FLAGS_FAILURE(result))
+			message_port_register_out(STATISTICS_PORT);
+			ErrorFlags result;
+			sabrDevice = DeviceRegistry::Open(serialNumber, result);
+			if (!sabrDevice)
+			{
+				std::cerr << "Unable to connect to SABR device" << (serialNumber.empty() ? "" : " " + serialNumber) << "!" << std::endl;
+				exit(0);
+			}
+			if (cpuCore >= 0)
+			{
+				if (this->ringSize > 0)
+				{
+					sabrDevice->SetTransmitThreadCpu(cpuCore);
+				}
+				else
+				{
+					set_processor_affinity(std::vector<int>(1, cpuCore));
+				}
+			}
+			pacer.SetLeadTime(leadTime);
+			if (this->burstMode && this->ringSize == 0)
 			{
-				std::cerr << "Unable to connect to SABR device!" << std::endl;
+				std::cerr << "Burst mode needs the TX ring (ring size > 0); ignoring tx_sob/tx_eob tags" << std::endl;
+				this->burstMode = false;
+			}
+			// Bursts can end anywhere, so only continuous transmission waits for whole chunks
+			if (!this->burstMode)
+			{
+				set_output_multiple(samplesPerChunk);
+			}
+			// Switches the multiplex mode to carry our channels alongside whatever another block sharing the device streams
+			result = sabrDevice->ClaimTransmitChannels(numChannels);
+			if (result == ErrorFlags::ResourceUnavailable)
+			{
+				std::cerr << "Another SABR Sink is already using this device's TX stream!" << std::endl;
 				exit(0);
 			}
-			samplesPerChunk = txChunkSize / BYTES_PER_SAMPLE;
-			t1 = std::chrono::high_resolution_clock::now();
-			set_output_multiple(samplesPerChunk);
+			else if (ERROR_FLAGS_FAILURE(result))
+			{
+				std::cerr << "Failed to enable " << numChannels << " TX channels (" << result << ")" << std::endl;
+			}
 			start();
-			set_center_freq(frequency);
-			set_sample_rate(sampleRate);
-			set_attenuation(attenuation);
+			// All the initial settings go out in one command batch per channel instead of a set and a get round trip each
+			uint64_t actualRate = (uint64_t)sampleRate;
+			for (int channel = 0; channel < numChannels; channel++)
+			{
+				uint64_t actualFrequency = (uint64_t)frequency;
+				uint64_t channelRate = (uint64_t)sampleRate;
+				result = sabrDevice->ConfigureTransmitChannel(ToRadioChannel(channel), actualFrequency, channelRate, attenuation);
+				if (ERROR_FLAGS_FAILURE(result))
+				{
+					std::cerr << "Failed to apply the initial TX" << channel + 1 << " settings (" << result << ")" << std::endl;
+				}
+				else if (channel == 0)
+				{
+					actualRate = channelRate;
+				}
+			}
+			double pacerRate = actualRate > 0 ? (double)actualRate : sampleRate;
+			pacer.SetSampleRate(pacerRate);
+			pacerSampleRate = pacerRate;
+			confirmedSampleRate = pacerRate;
+			sabrDevice->SetTransmitStreamRate(pacerRate);
+			// The setters only queue their commands; pacing follows once the device has applied a new rate
+			completionHandlerId = sabrDevice->AddCommandCompletionHandler([this](const CommandCompletion& completion) { OnCommandCompleted(completion); });
 		}
 
 		/*
@@ -74,8 +204,9 @@ namespace gr
 		 */
 		sabr_sink_impl::~sabr_sink_impl()
 		{
+			sabrDevice->RemoveCommandCompletionHandler(completionHandlerId);
 			stop();
-			sabrDevice.CloseDevice();
+			sabrDevice->ReleaseTransmitChannels();
 		}
 
 		int
@@ -85,60 +216,282 @@ namespace gr
 		{
 			int numSamplesIn = noutput_items;
 			int numPipeTransfers = numSamplesIn / samplesPerChunk;
-
-			const gr_complex* in = (const gr_complex*)input_items[0];
+			CountStarvation();
 
 			//Convert number of input items into bytes then send to the radio
-			// Currently assumes that input is scaled properly before hand
-			int sampleIndex = 0;
-			short currI;
-			short currQ;
-			uint8_t* sampleBytes = new uint8_t[txChunkSize];
-			for (int i = 0; i < numPipeTransfers; i++)
-			{
-				int byteIndex = 0;
-				for (int j = 0; j < samplesPerChunk; j++)
-				{
-					// Grab the I and Q sample from each complex value
-					currI = (short)real(in[sampleIndex]);
-					currQ = (short)imag(in[sampleIndex]);
-					sampleIndex++;
-					// Interleave I and Q samples
-					sampleBytes[byteIndex] = (uint8_t)(currI >> 8);
-					sampleBytes[byteIndex + 1] = (uint8_t)currI;
-					sampleBytes[byteIndex + 2] = (uint8_t)(currQ >> 8);
-					sampleBytes[byteIndex + 3] = (uint8_t)currQ;
-					byteIndex += 4;
+			// Input is expected in DAC counts once scaled; anything out of range saturates and is counted
+			if (burstMode)
+			{
+				QueueBursts(numSamplesIn, input_items);
+			}
+			else if (ringSize > 0)
+			{
+				// The writer thread paces and sends; this only waits if its ring is full
+				QueueSamples(input_items, 0, numSamplesIn);
+			}
+			else
+			{
+				// The pacer is only touched from here, a rate change from the command thread is picked up between chunks
+				double sampleRate = confirmedSampleRate.load();
+				if (sampleRate != pacerSampleRate)
+				{
+					pacer.SetSampleRate(sampleRate);
+					pacerSampleRate = sampleRate;
 				}
-				
-				// We want to ensure that samples aren't sent out too fast. They should be delivered as close to the sample rate as possible.
-				while (std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now()-t1).count() < waitTime)
+				for (int i = 0; i < numPipeTransfers; i++)
 				{
+					clipCount += PackSamples(input_items, i * samplesPerChunk, samplesPerChunk, &sampleBytes[0]);
+
+					// We want to ensure that samples aren't sent out too fast. They should be delivered as close to the sample rate as possible.
+					pacer.Wait(samplesPerChunk);
+					ErrorFlags result = sabrDevice->TransmitSamples(&sampleBytes[0], chunkBytes);
 				}
-				ErrorFlags result = sabrDevice.TransmitSamples(sampleBytes, txChunkSize);
-				// Restart timer
-				t1 = std::chrono::high_resolution_clock::now();
+			}
+			if (TransmitPacer::GetMonotonicNs() - lastStatisticsNs >= STATISTICS_INTERVAL_NS)
+			{
+				PublishStatistics();
 			}
 			// Tell runtime system how many input items we consumed
 			consume_each(numSamplesIn);
-			delete[] sampleBytes;
 			return 0;
 		}
 
+		void sabr_sink_impl::QueueSamples(const gr_vector_const_void_star& input_items, int offset, int numSamples)
+		{
+			while (numSamples > 0)
+			{
+				// A full buffer is held back in burst mode in case the burst ends right after it
+				if (transmitBuffer != NULL && transmitBufferFill == chunkBytes)
+				{
+					CommitTransmitBuffer(0);
+				}
+				if (transmitBuffer == NULL)
+				{
+					transmitBuffer = sabrDevice->AcquireTransmitBuffer();
+					if (transmitBuffer == NULL)
+					{
+						return;
+					}
+					transmitBufferFill = 0;
+				}
+				int numPacked = std::min(numSamples, (int)((chunkBytes - transmitBufferFill) / frameBytes));
+				clipCount += PackSamples(input_items, offset, numPacked, transmitBuffer + transmitBufferFill);
+				transmitBufferFill += numPacked * frameBytes;
+				offset += numPacked;
+				numSamples -= numPacked;
+				if (!burstMode && transmitBufferFill == chunkBytes)
+				{
+					CommitTransmitBuffer(0);
+				}
+			}
+		}
+
+		void sabr_sink_impl::CommitTransmitBuffer(uint32_t flags)
+		{
+			sabrDevice->CommitTransmitBuffer(transmitBufferFill, transmitBufferFlags | flags, transmitBufferTime);
+			transmitBuffer = NULL;
+			transmitBufferFill = 0;
+			transmitBufferFlags = 0;
+			transmitBufferTime = 0;
+		}
+
+		void sabr_sink_impl::QueueBursts(int noutput_items, const gr_vector_const_void_star& input_items)
+		{
+			uint64_t firstSample = nitems_read(0);
+			burstTags.clear();
+			get_tags_in_range(burstTags, 0, firstSample, firstSample + noutput_items);
+			std::sort(burstTags.begin(), burstTags.end(), [](const gr::tag_t& a, const gr::tag_t& b)
+				{
+					uint64_t positionA = GetBurstTagPosition(a);
+					uint64_t positionB = GetBurstTagPosition(b);
+					return positionA != positionB ? positionA < positionB : GetBurstTagRank(a) < GetBurstTagRank(b);
+				});
+
+			// Send the samples between tags that fall inside a burst, and drop the rest
+			int position = 0;
+			for (size_t i = 0; i <= burstTags.size(); i++)
+			{
+				int end = i < burstTags.size() ? (int)(GetBurstTagPosition(burstTags[i]) - firstSample) : noutput_items;
+				if (end > position)
+				{
+					if (isInBurst)
+					{
+						QueueSamples(input_items, position, end - position);
+					}
+					position = end;
+				}
+				if (i < burstTags.size())
+				{
+					ApplyBurstTag(burstTags[i]);
+				}
+			}
+		}
+
+		void sabr_sink_impl::ApplyBurstTag(const gr::tag_t& tag)
+		{
+			if (pmt::eqv(tag.key, TIME_KEY))
+			{
+				// (whole seconds, fractional seconds) on the host clock, like rx_time from sabr_source
+				if (pmt::is_tuple(tag.value))
+				{
+					burstTime = pmt::to_uint64(pmt::tuple_ref(tag.value, 0)) * NS_PER_SECOND + (uint64_t)(pmt::to_double(pmt::tuple_ref(tag.value, 1)) * NS_PER_SECOND);
+					burstTimeSample = tag.offset;
+				}
+			}
+			else if (pmt::eqv(tag.key, SOB_KEY))
+			{
+				// A missing tx_eob ends the previous burst here
+				EndBurst();
+				isInBurst = true;
+				transmitBufferFlags = RING_SLOT_START_OF_BURST;
+				transmitBufferTime = burstTimeSample == tag.offset ? burstTime : 0;
+			}
+			else if (pmt::eqv(tag.key, EOB_KEY))
+			{
+				EndBurst();
+			}
+		}
+
+		void sabr_sink_impl::EndBurst()
+		{
+			if (!isInBurst)
+			{
+				return;
+			}
+			isInBurst = false;
+			if (transmitBuffer != NULL && transmitBufferFill > 0)
+			{
+				CommitTransmitBuffer(RING_SLOT_END_OF_BURST);
+			}
+			else
+			{
+				// Nothing of the burst was queued
+				transmitBufferFlags = 0;
+				transmitBufferTime = 0;
+			}
+		}
+
+		void sabr_sink_impl::PublishStatistics()
+		{
+			lastStatisticsNs = TransmitPacer::GetMonotonicNs();
+			TransmitStatistics statistics;
+			sabrDevice->GetTransmitStatistics(statistics);
+			// The device counts late writes from its writer thread; without the ring work() does the pacing itself
+			uint64_t lateWrites = ringSize > 0 ? statistics.lateWrites : pacer.GetLateCount();
+			pmt::pmt_t message = pmt::make_dict();
+			message = pmt::dict_add(message, pmt::mp("underflows"), pmt::from_uint64(statistics.underflows));
+			message = pmt::dict_add(message, pmt::mp("late_writes"), pmt::from_uint64(lateWrites));
+			message = pmt::dict_add(message, pmt::mp("failed_writes"), pmt::from_uint64(statistics.failedWrites));
+			message = pmt::dict_add(message, pmt::mp("bytes_submitted"), pmt::from_uint64(statistics.bytesSubmitted));
+			message = pmt::dict_add(message, pmt::mp("bytes_accepted"), pmt::from_uint64(statistics.bytesAccepted));
+			message = pmt::dict_add(message, pmt::mp("driver_queue_bytes"), pmt::from_uint64(statistics.driverQueueBytes));
+			message = pmt::dict_add(message, pmt::mp("ring_queue_bytes"), pmt::from_uint64(statistics.ringQueueBytes));
+			message = pmt::dict_add(message, pmt::mp("clipped"), pmt::from_uint64(clipCount));
+			message = pmt::dict_add(message, pmt::mp("starved"), pmt::init_u64vector(starvedCounts.size(), starvedCounts));
+			message_port_pub(STATISTICS_PORT, message);
+		}
+
+		void sabr_sink_impl::CountStarvation()
+		{
+			// The device ran dry since the last call. Every input lines up sample for sample, so whichever has the least queued upstream is what held
+			// the rest back; with all of them equally short it's the whole flowgraph, and every channel is charged.
+			uint64_t underflows = ringSize > 0 ? sabrDevice->GetTransmitUnderflowCount() : pacer.GetLateCount();
+			if (underflows == lastUnderflowCount)
+			{
+				return;
+			}
+			lastUnderflowCount = underflows;
+			int portsPerChannel = GetStreamPortCount(streamType);
+			std::vector<int> available(numChannels, INT_MAX);
+			int fewest = INT_MAX;
+			for (int port = 0; port < numPorts; port++)
+			{
+				int channel = port / portsPerChannel;
+				available[channel] = std::min(available[channel], detail()->input(port)->items_available());
+				fewest = std::min(fewest, available[channel]);
+			}
+			for (int channel = 0; channel < numChannels; channel++)
+			{
+				if (available[channel] == fewest)
+				{
+					starvedCounts[channel]++;
+				}
+			}
+		}
+
+		size_t sabr_sink_impl::PackSamples(const gr_vector_const_void_star& input_items, int offset, int numSamples, uint8_t* rawSamples)
+		{
+			size_t itemSize = GetStreamItemSize(streamType);
+			for (int port = 0; port < numPorts; port++)
+			{
+				portInputs[port] = (const uint8_t*)input_items[port] + offset * itemSize;
+			}
+			return InterleaveSC16BE(&portInputs[0], rawSamples, streamType, numChannels, numSamples, scale);
+		}
+
 		bool sabr_sink_impl::start()
 		{
-			ErrorFlags result = sabrDevice.StartTransmit();
+			clipCount = 0;
+			std::fill(starvedCounts.begin(), starvedCounts.end(), 0);
+			lastUnderflowCount = 0;
+			lastStatisticsNs = TransmitPacer::GetMonotonicNs();
+			pacer.Reset();
+			isInBurst = false;
+			ErrorFlags result = ErrorFlags::None;
+			// In burst mode the writer thread turns the transmitter on and off around each burst
+			if (!burstMode)
+			{
+				result = sabrDevice->StartTransmit();
+			}
 			if (ERROR_FLAGS_FAILURE(result))
 			{
 				std::cerr << "Failed to start TX streaming (" << result << ")" << std::endl;
 				return false;
 			}
+			if (ringSize > 0)
+			{
+				result = sabrDevice->StartTransmitStream(ringSize * frameBytes, chunkBytes, prefill * frameBytes, leadTime, burstMode);
+				// The constructor already starts transmitting before the scheduler calls start()
+				if (ERROR_FLAGS_FAILURE(result) && result != ErrorFlags::AlreadyRunning)
+				{
+					std::cerr << "Failed to start TX writer thread (" << result << ")" << std::endl;
+					return false;
+				}
+			}
 			return true;
 		}
 
 		bool sabr_sink_impl::stop()
 		{
-			ErrorFlags result = sabrDevice.StopTransmit();
+			if (clipCount > 0)
+			{
+				std::cerr << "TX input clipped " << clipCount << " times; check the input level or scale" << std::endl;
+			}
+			if (pacer.GetLateCount() > 0)
+			{
+				std::cerr << "TX fell behind the sample clock " << pacer.GetLateCount() << " times" << std::endl;
+			}
+			for (int channel = 0; channel < numChannels; channel++)
+			{
+				if (starvedCounts[channel] > 0)
+				{
+					std::cerr << "TX" << channel + 1 << " input ran short " << starvedCounts[channel] << " times" << std::endl;
+				}
+			}
+			// Flush what is still queued before the transmitter is turned off
+			EndBurst();
+			if (transmitBuffer != NULL)
+			{
+				CommitTransmitBuffer(0);
+			}
+			sabrDevice->StopTransmitStream();
+			// Final counters, including what the writer did while flushing. Only once, since the destructor calls stop() again.
+			if (lastStatisticsNs != 0)
+			{
+				PublishStatistics();
+				lastStatisticsNs = 0;
+			}
+			ErrorFlags result = sabrDevice->StopTransmit();
 			if (ERROR_FLAGS_FAILURE(result))
 			{
 				std::cerr << "Failed to stop TX streaming (" << result << ")" << std::endl;
@@ -150,40 +503,56 @@ namespace gr
 		double sabr_sink_impl::get_sample_rate(int chan)
 		{
 			uint64_t receivedSampleRate;
-			ErrorFlags result = sabrDevice.GetSampleRate(chan, receivedSampleRate);
+			ErrorFlags result = sabrDevice->GetSampleRate(ToRadioChannel(chan), receivedSampleRate);
 			return (double)receivedSampleRate;
 		}
 
 		double sabr_sink_impl::set_sample_rate(double rate, int chan)
 		{
-			ErrorFlags result = sabrDevice.SetSampleRate(chan, (uint64_t)rate);
-			waitTime = (uint64_t)((double)samplesPerChunk / rate * 1000000000); 
-			return get_sample_rate(chan);
+			// Returns right away; the pacer switches over once OnCommandCompleted() has seen the device apply it
+			sabrDevice->SetSampleRateAsync(ToRadioChannel(chan), (uint64_t)rate);
+			return rate;
+		}
+
+		void sabr_sink_impl::OnCommandCompleted(const CommandCompletion& completion)
+		{
+			if (completion.commandType != CommandType::SampleRate || !completion.isSetCommand || ERROR_FLAGS_FAILURE(completion.result))
+			{
+				return;
+			}
+			// Answered from the RadioDevice settings cache. The rate is one for the whole device, so this also picks up changes made through a source
+			// sharing it.
+			uint64_t actualRate;
+			if (ERROR_FLAGS_SUCCESS(sabrDevice->GetSampleRate(completion.radioChannel, actualRate)) && actualRate > 0)
+			{
+				confirmedSampleRate = (double)actualRate;
+				sabrDevice->SetTransmitStreamRate((double)actualRate);
+			}
 		}
 
 		double sabr_sink_impl::get_center_freq(int chan)
 		{
 			uint64_t receivedFrequency;
-			ErrorFlags result = sabrDevice.GetLOFrequency(chan, receivedFrequency);
+			ErrorFlags result = sabrDevice->GetLOFrequency(ToRadioChannel(chan), receivedFrequency);
 			return (double)receivedFrequency;
 		}
 
 		double sabr_sink_impl::set_center_freq(double freq, int chan)
 		{
-			ErrorFlags result = sabrDevice.SetLOFrequency(chan, (uint64_t)freq);
-			return get_center_freq(chan);
+			sabrDevice->SetLOFrequencyAsync(ToRadioChannel(chan), (uint64_t)freq);
+			return freq;
 		}
 
 		float sabr_sink_impl::set_attenuation(float attenuation, int chan)
 		{
-			ErrorFlags result = sabrDevice.SetTransmitAttenuation(chan, attenuation);
-			return get_attenuation(chan);
+			sabrDevice->SetTransmitAttenuationAsync(ToRadioChannel(chan), attenuation);
+			return attenuation;
 		}
 
 		float sabr_sink_impl::get_attenuation(int chan)
 		{
 			float receivedAttenuation;
-			ErrorFlags result = sabrDevice.GetTransmitAttenuation(chan, receivedAttenuation);
+			ErrorFlags result = sabrDevice->GetTransmitAttenuation(ToRadioChannel(chan), receivedAttenuation);
 			return receivedAttenuation;
 		}
 
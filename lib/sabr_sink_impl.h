@@ -23,10 +23,15 @@
 #define BYTES_PER_SAMPLE 4
 #include <sabrSDR/sabr_sink.h>
 #include "RadioDevice.h"
+#include "DeviceRegistry.h"
 #include "ErrorFlags.h"
 #include "SpecsEnums.h"
+#include "SampleConversion.h"
+#include "TransmitPacer.h"
+#include <atomic>
 #include <cstdint>
-#include <chrono>
+#include <memory>
+#include <vector>
 using namespace THR;
 
 namespace gr {
@@ -34,26 +39,75 @@ namespace gr {
 
 		class sabr_sink_impl : public sabr_sink
 		{
-#define tx1Channel 1
 #define txChunkSize 32768
 		private:
-			RadioDevice sabrDevice;
+			// Shared with any other SABR block in the flowgraph, see DeviceRegistry
+			std::shared_ptr<RadioDevice> sabrDevice;
+			uint32_t completionHandlerId;
+			// TX channels the device expects interleaved on the IQ pipe, one frame of numChannels samples at a time. Input channel k is TX(k+1)
+			int numChannels;
+			int numPorts;
+			uint32_t frameBytes;
+			std::vector<const void*> portInputs;
+			// Frames per chunk, and the chunk size rounded down to whole frames
 			int samplesPerChunk;
-			std::chrono::high_resolution_clock::time_point t1;
-			uint64_t waitTime;
+			uint32_t chunkBytes;
+			// Releases each chunk when the device is due to need it, when writing synchronously from work()
+			TransmitPacer pacer;
+			// Rate the device last confirmed, set from the command thread; work() applies it to the pacer before its next Wait()
+			std::atomic<double> confirmedSampleRate;
+			double pacerSampleRate;
+			// Writer thread ring size and prefill in samples; ringSize 0 writes synchronously from work()
+			uint64_t ringSize;
+			uint64_t prefill;
+			double leadTime;
+			// Only send samples between tx_sob and tx_eob tags
+			bool burstMode;
+			bool isInBurst;
+			// tx_time seen on the sample a burst is about to start at
+			uint64_t burstTime;
+			uint64_t burstTimeSample;
+			std::vector<gr::tag_t> burstTags;
+			// Ring buffer being filled, and the RING_SLOT_* flags and time it will be committed with
+			uint8_t* transmitBuffer;
+			uint32_t transmitBufferFill;
+			uint32_t transmitBufferFlags;
+			uint64_t transmitBufferTime;
+			// Applied to every input value before it is packed (float stream types only)
+			float scale;
+			StreamType streamType;
+			// I or Q values that were out of range and saturated since start()
+			uint64_t clipCount;
+			// Per channel: device underflows that happened while this input held the others back
+			std::vector<uint64_t> starvedCounts;
+			uint64_t lastUnderflowCount;
+			std::vector<uint8_t> sampleBytes;
+			// When the tx_stats message was last sent, on the TransmitPacer clock
+			uint64_t lastStatisticsNs;
+
+			size_t PackSamples(const gr_vector_const_void_star& input_items, int offset, int numSamples, uint8_t* rawSamples);
+			void QueueSamples(const gr_vector_const_void_star& input_items, int offset, int numSamples);
+			void CommitTransmitBuffer(uint32_t flags);
+			void QueueBursts(int noutput_items, const gr_vector_const_void_star& input_items);
+			void ApplyBurstTag(const gr::tag_t& tag);
+			void EndBurst();
+			void PublishStatistics();
+			void CountStarvation();
+			void OnCommandCompleted(const CommandCompletion& completion);
 
 		public:
-			sabr_sink_impl(double frequency, double sampleRate, float attenuation);
+			sabr_sink_impl(double frequency, double sampleRate, float attenuation, float scale, int streamType, float leadTime, int ringSize, int prefill, bool burstMode,
+				int channelConfig, const std::string& serialNumber, int cpuCore);
 			~sabr_sink_impl();
 
-			double set_center_freq(double freq, int chan = tx1Channel);
-			double get_center_freq(int chan = 1);
+			double set_center_freq(double freq, int chan = 0);
+			double get_center_freq(int chan = 0);
 
-			float set_attenuation(float attenuation, int chan = tx1Channel);
-			float get_attenuation(int chan = tx1Channel);
+			float set_attenuation(float attenuation, int chan = 0);
+			float get_attenuation(int chan = 0);
 
-			double set_sample_rate(double rate, int chan = tx1Channel);
-			double get_sample_rate(int chan = tx1Channel);
+			double set_sample_rate(double rate, int chan = 0);
+			double get_sample_rate(int chan = 0);
 
 			bool start();
 			bool stop();
@@ -24,6 +24,7 @@
 
 #include <gnuradio/io_signature.h>
 #include "sabr_source_impl.h"
+#include <algorithm>
 
 using namespace THR;
 
@@ -34,44 +35,140 @@ namespace gr
 
 		static const int MIN_IN = 0;	// mininum number of input streams
 		static const int MAX_IN = 0;	// maximum number of input streams
-		static const int MIN_OUT = 1;	// minimum number of output streams
-		static const int MAX_OUT = 1;	// maximum number of output streams
+		static const uint32_t RECEIVE_WAIT_MS = 100;	// how long work() waits for the reader thread before returning nothing
+		static const pmt::pmt_t DISCONTINUITY_KEY = pmt::intern("rx_discontinuity");
+		static const pmt::pmt_t OVERFLOW_VALUE = pmt::intern("overflow");
+		static const pmt::pmt_t TIMEOUT_VALUE = pmt::intern("timeout");
+		static const pmt::pmt_t ERROR_VALUE = pmt::intern("error");
+		static const pmt::pmt_t TIME_KEY = pmt::intern("rx_time");
+		static const pmt::pmt_t RATE_KEY = pmt::intern("rx_rate");
+		static const pmt::pmt_t FREQ_KEY = pmt::intern("rx_freq");
+		static const pmt::pmt_t SETTLE_KEY = pmt::intern("rx_settle");
+		static const uint64_t NS_PER_SECOND = 1000000000;
+
+		static StreamType ToStreamType(int streamType)
+		{
+			return streamType >= 0 && streamType <= (int)StreamType::PlanarFC32 ? (StreamType)streamType : StreamType::FC32;
+		}
+
+		static IQChannelConfig ToChannelConfig(int channelConfig)
+		{
+			return channelConfig >= (int)IQChannelConfig::Default && channelConfig <= (int)IQChannelConfig::R4T0 ? (IQChannelConfig)channelConfig : IQChannelConfig::Default;
+		}
+
+		static gr::io_signature::sptr MakeOutputSignature(int streamType, int channelConfig)
+		{
+			StreamType type = ToStreamType(streamType);
+			int numPorts = GetStreamPortCount(type) * RadioDevice::GetReceiveChannelCount(ToChannelConfig(channelConfig));
+			return gr::io_signature::make(numPorts, numPorts, GetStreamItemSize(type));
+		}
+
+		// Output channel 0 is RX1 (RadioChannel::One), 1 is RX2 (RadioChannel::Three) and so on
+		static int ToRadioChannel(int channel)
+		{
+			return 2 * channel;
+		}
 
 		sabr_source::sptr
-			sabr_source::make(double frequency, double sampleRate, double gain, int gainMode)
+			sabr_source::make(double frequency, double sampleRate, double gain, int gainMode, int ringSize, int overflowPolicy, int numTransfers, int transferSize, float scale, int streamType,
+				const std::vector<double>& hopFrequencies, const std::vector<int>& hopDwells, int hopSettle, int channelConfig, const std::string& serialNumber, int cpuCore)
 		{
 			return gnuradio::get_initial_sptr
-			(new sabr_source_impl(frequency, sampleRate, gain, gainMode));
+			(new sabr_source_impl(frequency, sampleRate, gain, gainMode, ringSize, overflowPolicy, numTransfers, transferSize, scale, streamType, hopFrequencies, hopDwells, hopSettle,
+				channelConfig, serialNumber, cpuCore));
 		}
 
 		/*
 		 * The private constructor
 		 */
-		sabr_source_impl::sabr_source_impl(double frequency, double sampleRate, double gain, int gainMode)
+		sabr_source_impl::sabr_source_impl(double frequency, double sampleRate, double gain, int gainMode, int ringSize, int overflowPolicy, int numTransfers, int transferSize, float scale, int streamType,
+			const std::vector<double>& hopFrequencies, const std::vector<int>& hopDwells, int hopSettle, int channelConfig, const std::string& serialNumber, int cpuCore)
 			: gr::sync_block("sabr_source",
 				gr::io_signature::make(MIN_IN, MAX_IN, sizeof(gr_complex)),
-				gr::io_signature::make(MIN_OUT, MAX_OUT, sizeof(gr_complex)))
+				MakeOutputSignature(streamType, channelConfig)),
+			ringSize(ringSize > 0 ? (uint64_t)ringSize : 0),
+			overflowPolicy(overflowPolicy >= 0 && overflowPolicy <= (int)OverflowPolicy::Block ? (OverflowPolicy)overflowPolicy : OverflowPolicy::DropOldest),
+			numTransfers(numTransfers > 1 ? (uint32_t)numTransfers : 1),
+			transferSize(transferSize > 0 ? (uint32_t)transferSize : 0),
+			scale(scale),
+			streamType(ToStreamType(streamType)),
+			numChannels(RadioDevice::GetReceiveChannelCount(ToChannelConfig(channelConfig))),
+			numPorts(numChannels * GetStreamPortCount(ToStreamType(streamType))),
+			frameBytes(BYTES_PER_SAMPLE * numChannels),
+			portOutputs(numPorts),
+			carry(frameBytes),
+			pendingDiscontinuity(0),
+			overflowCount(0),
+			timeoutCount(0),
+			errorCount(0),
+			sampleRate(0),
+			centerFrequency(),
+			isTuningChanged(true),
+			isStarted(false),
+			hopSettle(0),
+			tagSampleRate(0),
+			tagFrequency(),
+			isTimeAnchored(false),
+			timeAnchorSample(0),
+			timeAnchorNs(0),
+			isTimingTagDue(false)
 		{
-			ErrorFlags result = sabrDevice.Setup();
-			if (ERROR_FLAGS_FAILURE(result))
+			ErrorFlags result;
+			sabrDevice = DeviceRegistry::Open(serialNumber, result);
+			if (!sabrDevice)
 			{
-				std::cout << "Unable to connect to SABR device!" << std::endl;
+				std::cout << "Unable to connect to SABR device" << (serialNumber.empty() ? "" : " " + serialNumber) << "!" << std::endl;
 				exit(0);
 			}
-			result = sabrDevice.StartCapture();
+			if (cpuCore >= 0)
+			{
+				if (this->ringSize > 0)
+				{
+					sabrDevice->SetReceiveThreadCpu(cpuCore);
+				}
+				else
+				{
+					set_processor_affinity(std::vector<int>(1, cpuCore));
+				}
+			}
+			result = sabrDevice->StartCapture();
 			// This should most likely be set based on the desired sample rate for the radio.
 			// See how iqStreamSize is set as this is how we do it in other applications.
 			// However GNURadio seems to complain about the buffer being to small if we try to increase this later on...
 			// Keep in mind the factor of 4 difference between bytes we get from device and number of samples produced.
 			set_output_multiple(65536);
 			set_max_noutput_items(1048576);
-			set_center_freq(frequency);
-			set_sample_rate(sampleRate);
-			set_gain_mode(gainMode);
-			if (gainMode == 0)
+			// Switches the multiplex mode to carry our channels alongside whatever another block sharing the device streams
+			result = sabrDevice->ClaimReceiveChannels(numChannels);
+			if (result == ErrorFlags::ResourceUnavailable)
 			{
-				set_gain(gain);
+				std::cerr << "Another SABR Source is already using this device's RX stream!" << std::endl;
+				exit(0);
 			}
+			else if (ERROR_FLAGS_FAILURE(result))
+			{
+				std::cerr << "Failed to enable " << numChannels << " RX channels (" << result << ")" << std::endl;
+			}
+			// All the initial settings go out in one command batch per channel instead of a set and a get round trip each
+			for (int channel = 0; channel < numChannels; channel++)
+			{
+				uint64_t actualFrequency = (uint64_t)frequency;
+				uint64_t actualRate = (uint64_t)sampleRate;
+				result = sabrDevice->ConfigureReceiveChannel(ToRadioChannel(channel), actualFrequency, actualRate, (RadioGainMode)gainMode, (int)gain);
+				if (ERROR_FLAGS_FAILURE(result))
+				{
+					std::cerr << "Failed to apply the initial RX" << channel + 1 << " settings (" << result << ")" << std::endl;
+				}
+				std::lock_guard<std::mutex> lock(tuningMutex);
+				centerFrequency[channel] = (double)actualFrequency;
+				if (channel == 0)
+				{
+					this->sampleRate = (double)actualRate;
+				}
+			}
+			set_hop_schedule(hopFrequencies, hopDwells, hopSettle);
+			// The setters only queue their commands; tuning is picked up once the device has applied it
+			completionHandlerId = sabrDevice->AddCommandCompletionHandler([this](const CommandCompletion& completion) { OnCommandCompleted(completion); });
 		}
 
 		/*
@@ -79,8 +176,12 @@ namespace gr
 		 */
 		sabr_source_impl::~sabr_source_impl()
 		{
-			sabrDevice.StopCapture();
-			sabrDevice.CloseDevice();
+			// The device may live on for a sink sharing it, so leave it the way we found it
+			sabrDevice->RemoveCommandCompletionHandler(completionHandlerId);
+			sabrDevice->StopHopSchedule();
+			sabrDevice->StopReceiveStream();
+			sabrDevice->StopCapture();
+			sabrDevice->ReleaseReceiveChannels();
 		}
 
 		int
@@ -88,37 +189,363 @@ namespace gr
 				gr_vector_const_void_star& input_items,
 				gr_vector_void_star& output_items)
 		{
-			gr_complex* out = (gr_complex*)output_items[0];
-			uint8_t* rawSamples;
-			uint64_t numRawBytes = BYTES_PER_SAMPLE * (uint64_t)noutput_items;
-			ErrorFlags result = sabrDevice.ReceiveSamples(rawSamples, numRawBytes);
-			int currIndex = 0;
-			for (int i = 0; i < noutput_items; i++)
+			if (isTuningChanged.exchange(false))
+			{
+				std::lock_guard<std::mutex> lock(tuningMutex);
+				pendingTuningChanges.insert(pendingTuningChanges.end(), tuningChanges.begin(), tuningChanges.end());
+				tuningChanges.clear();
+			}
+			while (!pendingTuningChanges.empty() && (!isTimeAnchored || pendingTuningChanges.front().changeNs == 0))
+			{
+				// Nothing to line the change up with, so it starts right here
+				ApplyTuningChange(0);
+			}
+
+			if (ringSize == 0)
+			{
+				uint32_t numRawBytes = frameBytes * (uint32_t)noutput_items;
+				uint32_t numReceivedBytes;
+				uint8_t* rawSamples;
+				if (streamType == StreamType::SC16 && numChannels == 1)
+				{
+					// sc16 output only differs from the wire format by byte order, so have the driver write straight into the output buffer and swap it in place
+					rawSamples = (uint8_t*)output_items[0];
+				}
+				else
+				{
+					if (receiveBuffer.size() < numRawBytes)
+					{
+						receiveBuffer.resize(numRawBytes);
+					}
+					rawSamples = &receiveBuffer[0];
+				}
+				// Finish the frame the last read ended in the middle of (never happens with one channel)
+				uint32_t numCarried = carry.Take(rawSamples);
+				ErrorFlags result = sabrDevice->ReceiveSamplesInto(rawSamples + numCarried, numRawBytes - numCarried, numReceivedBytes);
+				// Only whole samples that actually arrived are produced; a torn sample or failed read leaves a gap before the next one
+				uint32_t numBytes = numCarried + numReceivedBytes - numReceivedBytes % BYTES_PER_SAMPLE;
+				int numSamples = (int)(numBytes / frameBytes);
+				if (numSamples > 0)
+				{
+					if (pendingDiscontinuity != 0 || !isTimeAnchored)
+					{
+						// The read returns as its last sample arrives
+						AnchorTime(0, RadioDevice::GetHostTimeNs() - SamplesToNs(numSamples));
+					}
+					TagDiscontinuity(0, pendingDiscontinuity);
+					TagTiming(0);
+					pendingDiscontinuity = 0;
+					ConvertSamples(rawSamples, output_items, 0, numSamples);
+				}
+				carry.Fill(rawSamples + numSamples * frameBytes, numBytes - numSamples * frameBytes);
+				uint32_t readFlags = 0;
+				if (numReceivedBytes % BYTES_PER_SAMPLE != 0)
+				{
+					readFlags |= RING_SLOT_DATA_LOST;
+				}
+				if (result == ErrorFlags::NotResponding)
+				{
+					readFlags |= RING_SLOT_READ_TIMEOUT;
+				}
+				else if (ERROR_FLAGS_FAILURE(result))
+				{
+					readFlags |= RING_SLOT_READ_ERROR;
+				}
+				// Only this read's flags: a loss still waiting to be tagged was already accounted for when it happened
+				carry.OnGap(readFlags);
+				pendingDiscontinuity |= readFlags;
+				PlaceTuningChanges(numSamples);
+				// Tell runtime system how many output items we produced.
+				return numSamples;
+			}
+
+			// Drain whatever the reader thread has queued, only waiting if there is nothing at all yet
+			int numProduced = 0;
+			while (numProduced < noutput_items)
+			{
+				const uint8_t* rawSamples;
+				uint32_t numRawBytes;
+				uint32_t flags;
+				uint64_t timestampNs;
+				ErrorFlags result = sabrDevice->AcquireReceiveData(rawSamples, numRawBytes, flags, timestampNs, numProduced == 0 ? RECEIVE_WAIT_MS : 0);
+				if (ERROR_FLAGS_FAILURE(result))
+				{
+					break;
+				}
+				// Flags are only reported the first time a slot is acquired, which is exactly the sample right after the gap
+				if (flags != 0 || !isTimeAnchored)
+				{
+					// Slots are sized in whole frames, so one dropped on overflow leaves the next starting on a frame boundary. After a timeout or read
+					// error nothing was lost and the rest of the frame is at the head of this slot.
+					carry.OnGap(flags);
+					// The slot is untouched here, so its timestamp is when the last of these numRawBytes arrived
+					AnchorTime(numProduced, timestampNs - SamplesToNs((carry.GetBytes() + numRawBytes) / frameBytes));
+				}
+				TagDiscontinuity(numProduced, flags);
+				TagTiming(numProduced);
+				if (carry.GetBytes() > 0 || numRawBytes < frameBytes)
+				{
+					// A frame split across two transfers is put back together before it is converted (never happens with one channel)
+					sabrDevice->ReleaseReceiveData(carry.Fill(rawSamples, numRawBytes));
+					if (carry.IsComplete())
+					{
+						ConvertSamples(carry.GetFrame(), output_items, numProduced, 1);
+						carry.Clear();
+						numProduced++;
+					}
+					continue;
+				}
+				int numSamples = std::min((int)(numRawBytes / frameBytes), noutput_items - numProduced);
+				ConvertSamples(rawSamples, output_items, numProduced, numSamples);
+				sabrDevice->ReleaseReceiveData(numSamples * frameBytes);
+				numProduced += numSamples;
+			}
+			PlaceTuningChanges(numProduced);
+			return numProduced;
+		}
+
+		void sabr_source_impl::ConvertSamples(const uint8_t* rawSamples, gr_vector_void_star& output_items, int offset, int numSamples)
+		{
+			size_t itemSize = GetStreamItemSize(streamType);
+			for (int port = 0; port < numPorts; port++)
+			{
+				portOutputs[port] = (uint8_t*)output_items[port] + offset * itemSize;
+			}
+			DeinterleaveSC16BE(rawSamples, &portOutputs[0], streamType, numChannels, numSamples, scale);
+		}
+
+		void sabr_source_impl::TagDiscontinuity(int offset, uint32_t flags)
+		{
+			if (flags == 0)
+			{
+				return;
+			}
+			pmt::pmt_t reason;
+			if (flags & RING_SLOT_DATA_LOST)
+			{
+				overflowCount++;
+				reason = OVERFLOW_VALUE;
+			}
+			else if (flags & RING_SLOT_READ_TIMEOUT)
+			{
+				timeoutCount++;
+				reason = TIMEOUT_VALUE;
+			}
+			else
+			{
+				errorCount++;
+				reason = ERROR_VALUE;
+			}
+			for (int port = 0; port < numPorts; port++)
 			{
-				short currI = (int)rawSamples[currIndex] << 8 | (int)rawSamples[currIndex + 1];
-				short currQ = (int)rawSamples[currIndex + 2] << 8 | (int)rawSamples[currIndex + 3];
-				currIndex += 4;
-				*out++ = gr_complex(currI, currQ);
+				add_item_tag((unsigned)port, nitems_written((unsigned)port) + offset, DISCONTINUITY_KEY, reason, alias_pmt());
+			}
+		}
+
+		void sabr_source_impl::OnCommandCompleted(const CommandCompletion& completion)
+		{
+			if (!completion.isSetCommand || ERROR_FLAGS_FAILURE(completion.result))
+			{
+				return;
+			}
+			// The device may be shared with a sink, so only frequencies of our own channels count. The sample rate is one for the whole device.
+			int channel = completion.radioChannel / 2;
+			bool isOwnChannel = completion.radioChannel == ToRadioChannel(channel) && channel < numChannels;
+			// Read back what the device actually applied; both are answered from the RadioDevice settings cache
+			if (completion.commandType == CommandType::LOFrequency && isOwnChannel)
+			{
+				uint64_t frequency;
+				if (ERROR_FLAGS_SUCCESS(sabrDevice->GetLOFrequency(completion.radioChannel, frequency)))
+				{
+					std::lock_guard<std::mutex> lock(tuningMutex);
+					centerFrequency[channel] = (double)frequency;
+					QueueTuningChange(channel, completion.hostTimeNs, hopSettle);
+				}
+				isTuningChanged = true;
+			}
+			else if (completion.commandType == CommandType::SampleRate)
+			{
+				uint64_t rate;
+				if (ERROR_FLAGS_SUCCESS(sabrDevice->GetSampleRate(completion.radioChannel, rate)))
+				{
+					std::lock_guard<std::mutex> lock(tuningMutex);
+					sampleRate = (double)rate;
+					QueueTuningChange(isOwnChannel ? channel : 0, completion.hostTimeNs, 0);
+				}
+				isTuningChanged = true;
+			}
+		}
+
+		void sabr_source_impl::QueueTuningChange(int channel, uint64_t changeNs, uint64_t settleSamples)
+		{
+			// Called with tuningMutex held
+			TuningChange change;
+			change.channel = channel;
+			change.sampleRate = sampleRate;
+			change.frequency = centerFrequency[channel];
+			change.changeNs = changeNs;
+			change.settleSamples = settleSamples;
+			tuningChanges.push_back(change);
+		}
+
+		int sabr_source_impl::GetTuningChangeOffset(const TuningChange& change, int numProduced)
+		{
+			// First sample captured after the device applied the change. Never before the anchor: a gap since then means the timing was reset.
+			uint64_t changeSample = timeAnchorSample;
+			if (change.changeNs > timeAnchorNs)
+			{
+				changeSample += NsToSamples(change.changeNs - timeAnchorNs);
+			}
+			uint64_t firstSample = nitems_written(0);
+			return changeSample > firstSample ? (int)std::min<uint64_t>(changeSample - firstSample, (uint64_t)numProduced) : 0;
+		}
+
+		void sabr_source_impl::PlaceTuningChanges(int numProduced)
+		{
+			if (!isTimeAnchored)
+			{
+				return;
+			}
+			while (!pendingTuningChanges.empty())
+			{
+				int offset = GetTuningChangeOffset(pendingTuningChanges.front(), numProduced);
+				if (offset >= numProduced)
+				{
+					break;
+				}
+				ApplyTuningChange(offset);
+				// A rate and frequency change landing on the same sample share one set of timing tags
+				if (pendingTuningChanges.empty() || GetTuningChangeOffset(pendingTuningChanges.front(), numProduced) != offset)
+				{
+					TagTiming(offset);
+				}
+			}
+		}
+
+		void sabr_source_impl::ApplyTuningChange(int offset)
+		{
+			const TuningChange& change = pendingTuningChanges.front();
+			if (isTimeAnchored)
+			{
+				// Keep the time continuous across a rate change
+				timeAnchorNs = GetSampleTimeNs(offset);
+				timeAnchorSample = nitems_written(0) + offset;
+			}
+			tagSampleRate = change.sampleRate;
+			tagFrequency[change.channel] = change.frequency;
+			isTimingTagDue = true;
+			if (change.settleSamples > 0)
+			{
+				pmt::pmt_t settle = pmt::from_uint64(change.settleSamples);
+				int portsPerChannel = GetStreamPortCount(streamType);
+				for (int port = change.channel * portsPerChannel; port < (change.channel + 1) * portsPerChannel; port++)
+				{
+					add_item_tag((unsigned)port, nitems_written((unsigned)port) + offset, SETTLE_KEY, settle, alias_pmt());
+				}
+			}
+			pendingTuningChanges.pop_front();
+		}
+
+		uint64_t sabr_source_impl::SamplesToNs(uint64_t numSamples)
+		{
+			return tagSampleRate > 0 ? (uint64_t)((double)numSamples * NS_PER_SECOND / tagSampleRate) : 0;
+		}
+
+		uint64_t sabr_source_impl::NsToSamples(uint64_t ns)
+		{
+			return (uint64_t)((double)ns * tagSampleRate / NS_PER_SECOND);
+		}
+
+		uint64_t sabr_source_impl::GetSampleTimeNs(int offset)
+		{
+			return timeAnchorNs + SamplesToNs(nitems_written(0) + offset - timeAnchorSample);
+		}
+
+		void sabr_source_impl::AnchorTime(int offset, uint64_t sampleTimeNs)
+		{
+			timeAnchorSample = nitems_written(0) + offset;
+			timeAnchorNs = sampleTimeNs;
+			isTimeAnchored = true;
+			isTimingTagDue = true;
+		}
+
+		void sabr_source_impl::TagTiming(int offset)
+		{
+			if (!isTimingTagDue || !isTimeAnchored)
+			{
+				return;
+			}
+			isTimingTagDue = false;
+			uint64_t timeNs = GetSampleTimeNs(offset);
+			pmt::pmt_t time = pmt::make_tuple(pmt::from_uint64(timeNs / NS_PER_SECOND), pmt::from_double((double)(timeNs % NS_PER_SECOND) / NS_PER_SECOND));
+			pmt::pmt_t rate = pmt::from_double(tagSampleRate);
+			int portsPerChannel = GetStreamPortCount(streamType);
+			for (int port = 0; port < numPorts; port++)
+			{
+				uint64_t sample = nitems_written((unsigned)port) + offset;
+				add_item_tag((unsigned)port, sample, TIME_KEY, time, alias_pmt());
+				add_item_tag((unsigned)port, sample, RATE_KEY, rate, alias_pmt());
+				add_item_tag((unsigned)port, sample, FREQ_KEY, pmt::from_double(tagFrequency[port / portsPerChannel]), alias_pmt());
 			}
-			delete[] rawSamples;
-			// Tell runtime system how many output items we produced.
-			return noutput_items;
 		}
 
 		bool sabr_source_impl::start()
 		{
-			ErrorFlags result = sabrDevice.StartCapture();
+			pendingDiscontinuity = 0;
+			overflowCount = 0;
+			timeoutCount = 0;
+			errorCount = 0;
+			// Tag the first sample with fresh timing
+			isTimeAnchored = false;
+			pendingTuningChanges.clear();
+			{
+				std::lock_guard<std::mutex> lock(tuningMutex);
+				tuningChanges.clear();
+				for (int channel = 0; channel < numChannels; channel++)
+				{
+					QueueTuningChange(channel, 0, 0);
+				}
+			}
+			carry.Clear();
+			isTuningChanged = true;
+			ErrorFlags result = sabrDevice->StartCapture();
 			if (ERROR_FLAGS_FAILURE(result))
 			{
 				std::cerr << "Failed to start RX streaming (" << result << ")" << std::endl;
 				return false;
 			}
+			if (ringSize > 0)
+			{
+				result = sabrDevice->StartReceiveStream(ringSize * frameBytes, overflowPolicy, numTransfers, transferSize * frameBytes);
+				if (ERROR_FLAGS_FAILURE(result))
+				{
+					std::cerr << "Failed to start RX reader thread (" << result << ")" << std::endl;
+					return false;
+				}
+			}
+			std::lock_guard<std::mutex> lock(hopMutex);
+			isStarted = true;
+			StartHopping();
 			return true;
 		}
 
 		bool sabr_source_impl::stop()
 		{
-			ErrorFlags result = sabrDevice.StopCapture();
+			{
+				std::lock_guard<std::mutex> lock(hopMutex);
+				isStarted = false;
+				sabrDevice->StopHopSchedule();
+			}
+			if (sabrDevice->GetLateHopCount() > 0)
+			{
+				std::cerr << "RX hops queued late: " << sabrDevice->GetLateHopCount() << std::endl;
+			}
+			sabrDevice->StopReceiveStream();
+			if (overflowCount > 0 || timeoutCount > 0 || errorCount > 0)
+			{
+				std::cerr << "RX discontinuities tagged: " << overflowCount << " overflows, " << timeoutCount << " timeouts, " << errorCount << " read errors" << std::endl;
+			}
+			ErrorFlags result = sabrDevice->StopCapture();
 			if (ERROR_FLAGS_FAILURE(result))
 			{
 				std::cerr << "Failed to stop RX streaming (" << result << ")" << std::endl;
@@ -130,65 +557,108 @@ namespace gr
 		double sabr_source_impl::get_sample_rate(int chan)
 		{
 			uint64_t receivedSampleRate;
-			ErrorFlags result = sabrDevice.GetSampleRate(chan, receivedSampleRate);
+			ErrorFlags result = sabrDevice->GetSampleRate(ToRadioChannel(chan), receivedSampleRate);
 			return (double)receivedSampleRate;
 		}
 
 		double sabr_source_impl::set_sample_rate(double rate, int chan)
 		{
-			ErrorFlags result = sabrDevice.SetSampleRate(chan, (uint64_t)rate);
-			return get_sample_rate(chan);
+			// Returns right away; rx_rate is tagged once the device has applied the new rate
+			sabrDevice->SetSampleRateAsync(ToRadioChannel(chan), (uint64_t)rate);
+			return rate;
 		}
 
 		double sabr_source_impl::get_center_freq(int chan)
 		{
 			uint64_t receivedFrequency;
-			ErrorFlags result = sabrDevice.GetLOFrequency(chan, receivedFrequency);
+			ErrorFlags result = sabrDevice->GetLOFrequency(ToRadioChannel(chan), receivedFrequency);
 			return (double)receivedFrequency;
 		}
 
 		double sabr_source_impl::set_center_freq(double freq, int chan)
 		{
-			ErrorFlags result = sabrDevice.SetLOFrequency(chan, (uint64_t)freq);
-			return get_center_freq(chan);
+			// Returns right away; rx_freq is tagged once the device has retuned
+			sabrDevice->SetLOFrequencyAsync(ToRadioChannel(chan), (uint64_t)freq);
+			return freq;
 		}
 
 		int sabr_source_impl::set_gain_mode(int gainMode, int chan)
 		{
-			ErrorFlags result = sabrDevice.SetGainMode(chan, (RadioGainMode)gainMode);
-			return get_gain_mode(chan);
+			sabrDevice->SetGainModeAsync(ToRadioChannel(chan), (RadioGainMode)gainMode);
+			return gainMode;
 		}
 
 		int sabr_source_impl::get_gain_mode(int chan)
 		{
 			RadioGainMode gainMode;
-			ErrorFlags result = sabrDevice.GetGainMode(chan, gainMode);
+			ErrorFlags result = sabrDevice->GetGainMode(ToRadioChannel(chan), gainMode);
 			return (int)gainMode;
 		}
 
 		double sabr_source_impl::get_gain(int chan)
 		{
 			int gain;
-			ErrorFlags result = sabrDevice.GetGain(chan, gain);
+			ErrorFlags result = sabrDevice->GetGain(ToRadioChannel(chan), gain);
 			return (double)gain;
 		}
 
 		double sabr_source_impl::set_gain(double gain, int chan)
 		{
-			ErrorFlags result = sabrDevice.SetGain(chan, (int)gain);
-			return get_gain(chan);
+			sabrDevice->SetGainAsync(ToRadioChannel(chan), (int)gain);
+			return gain;
 		}
 
 		double sabr_source_impl::set_bandwidth(double bandwidth, int chan)
 		{
-			ErrorFlags result = sabrDevice.SetComplexBandwidth(chan, (uint64_t)bandwidth);
-			return get_bandwidth(chan);
+			sabrDevice->SetComplexBandwidthAsync(ToRadioChannel(chan), (uint64_t)bandwidth);
+			return bandwidth;
+		}
+
+		void sabr_source_impl::set_hop_schedule(const std::vector<double>& frequencies, const std::vector<int>& dwells, int settle)
+		{
+			std::vector<HopDwell> schedule;
+			if (!frequencies.empty() && (dwells.size() == 1 || dwells.size() == frequencies.size()))
+			{
+				for (size_t i = 0; i < frequencies.size(); i++)
+				{
+					HopDwell dwell;
+					dwell.frequency = (uint64_t)frequencies[i];
+					dwell.numSamples = (uint64_t)std::max(0, dwells[dwells.size() == 1 ? 0 : i]);
+					schedule.push_back(dwell);
+				}
+			}
+			else if (!frequencies.empty())
+			{
+				std::cerr << "Hop schedule ignored: needs one dwell, or one per frequency" << std::endl;
+			}
+			hopSettle = (uint64_t)std::max(0, settle);
+			std::lock_guard<std::mutex> lock(hopMutex);
+			hopSchedule = schedule;
+			if (isStarted)
+			{
+				StartHopping();
+			}
+		}
+
+		void sabr_source_impl::StartHopping()
+		{
+			// Called with hopMutex held
+			if (hopSchedule.empty())
+			{
+				sabrDevice->StopHopSchedule();
+				return;
+			}
+			ErrorFlags result = sabrDevice->StartHopSchedule(0, hopSchedule);
+			if (ERROR_FLAGS_FAILURE(result))
+			{
+				std::cerr << "Failed to start the hop schedule (" << result << ")" << std::endl;
+			}
 		}
 
 		double sabr_source_impl::get_bandwidth(int chan)
 		{
 			uint64_t bandwidth;
-			ErrorFlags result = sabrDevice.GetComplexBandwidth(chan, bandwidth);
+			ErrorFlags result = sabrDevice->GetComplexBandwidth(ToRadioChannel(chan), bandwidth);
 			return (double)bandwidth;
 		}
 
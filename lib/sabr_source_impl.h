@@ -23,9 +23,16 @@
 #define BYTES_PER_SAMPLE 4
 #include <sabrSDR/sabr_source.h>
 #include "RadioDevice.h"
+#include "DeviceRegistry.h"
 #include "ErrorFlags.h"
 #include "SpecsEnums.h"
+#include "SampleConversion.h"
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
 using namespace THR;
 
 namespace gr {
@@ -34,11 +41,88 @@ namespace gr {
 		class sabr_source_impl : public sabr_source
 		{
 		private:
-			RadioDevice sabrDevice;
+			// Shared with any other SABR block in the flowgraph, see DeviceRegistry
+			std::shared_ptr<RadioDevice> sabrDevice;
+			uint32_t completionHandlerId;
 			uint32_t rawReceiveLength;
+			// Reader thread ring size in samples per channel, 0 when reading synchronously in work()
+			uint64_t ringSize;
+			OverflowPolicy overflowPolicy;
+			uint32_t numTransfers;
+			// Samples per channel per USB read in the reader thread, 0 for the device default
+			uint32_t transferSize;
+			// Applied to every output value during conversion (float stream types only)
+			float scale;
+			StreamType streamType;
+			// RX channels the device interleaves into the IQ stream, one frame of numChannels samples at a time. Output channel k is RX(k+1)
+			int numChannels;
+			int numPorts;
+			uint32_t frameBytes;
+			std::vector<void*> portOutputs;
+			// Start of a frame split across two reads or ring slots
+			FrameCarry carry;
+			// Reused for every synchronous read that needs converting; sc16 reads go straight to the output buffer instead
+			std::vector<uint8_t> receiveBuffer;
+			// RING_SLOT_* flags of a gap that still has to be tagged on the next sample produced
+			uint32_t pendingDiscontinuity;
+			uint64_t overflowCount;
+			uint64_t timeoutCount;
+			uint64_t errorCount;
+
+			// Sample rate and frequency read back from the device, and every change to them in the order the device confirmed it. Written by the
+			// command completion handler, which runs on the RadioDevice command thread while work() runs
+			struct TuningChange
+			{
+				// Output channel whose frequency changed
+				int channel;
+				double sampleRate;
+				double frequency;
+				// Host time the device applied it at, 0 to apply it right away
+				uint64_t changeNs;
+				// Samples to discard after it while the LO settles, 0 for none
+				uint64_t settleSamples;
+			};
+			std::mutex tuningMutex;
+			double sampleRate;
+			double centerFrequency[MAX_DEINTERLEAVE_CHANNELS];
+			std::deque<TuningChange> tuningChanges;
+			std::atomic<bool> isTuningChanged;
+			// Changes picked up by work() that haven't reached the sample they apply to yet, oldest first
+			std::deque<TuningChange> pendingTuningChanges;
+			// Hop schedule run on the device while streaming. Separate from tuningMutex, which the completion handler needs while the hop engine
+			// is being stopped
+			std::mutex hopMutex;
+			std::vector<HopDwell> hopSchedule;
+			bool isStarted;
+			// rx_settle count tagged on every retune
+			std::atomic<uint64_t> hopSettle;
+			// Rate and frequency of the samples work() is producing
+			double tagSampleRate;
+			double tagFrequency[MAX_DEINTERLEAVE_CHANNELS];
+			// rx_time of every sample is extrapolated from the anchor sample at tagSampleRate
+			bool isTimeAnchored;
+			uint64_t timeAnchorSample;
+			uint64_t timeAnchorNs;
+			// rx_time/rx_rate/rx_freq are owed on the next sample produced
+			bool isTimingTagDue;
+
+			void ConvertSamples(const uint8_t* rawSamples, gr_vector_void_star& output_items, int offset, int numSamples);
+			void TagDiscontinuity(int offset, uint32_t flags);
+			void OnCommandCompleted(const CommandCompletion& completion);
+			void QueueTuningChange(int channel, uint64_t changeNs, uint64_t settleSamples);
+			void PlaceTuningChanges(int numProduced);
+			int GetTuningChangeOffset(const TuningChange& change, int numProduced);
+			void ApplyTuningChange(int offset);
+			void StartHopping();
+			uint64_t SamplesToNs(uint64_t numSamples);
+			uint64_t NsToSamples(uint64_t ns);
+			uint64_t GetSampleTimeNs(int offset);
+			void AnchorTime(int offset, uint64_t sampleTimeNs);
+			void TagTiming(int offset);
 
 		public:
-			sabr_source_impl(double frequency, double sampleRate, double gain, int gainMode);
+			sabr_source_impl(double frequency, double sampleRate, double gain, int gainMode, int ringSize, int overflowPolicy, int numTransfers, int transferSize, float scale, int streamType,
+				const std::vector<double>& hopFrequencies, const std::vector<int>& hopDwells, int hopSettle, int channelConfig, const std::string& serialNumber, int cpuCore);
 			~sabr_source_impl();
 
 			double set_sample_rate(double rate, int chan = 0);
@@ -56,6 +140,8 @@ namespace gr {
 			double set_bandwidth(double bandwidth, int chan = 0);
 			double get_bandwidth(int chan = 0);
 
+			void set_hop_schedule(const std::vector<double>& frequencies, const std::vector<int>& dwells, int settle);
+
 			bool start();
 			bool stop();
 